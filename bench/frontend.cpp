@@ -0,0 +1,319 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "ast-visitor.h"
+#include "generator.h"
+#include "lexer.h"
+#include "parser.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Every allocation made by the front end goes through these, so that we can
+// tell how many of them a token or an AST node costs.
+static uint64_t allocations_count = 0;
+
+void* operator new(std::size_t size) {
+  ++allocations_count;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+  ++allocations_count;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+using namespace monicelli;
+
+namespace {
+
+class AstNodeCounter final : public ConstAstVisitor<AstNodeCounter, void> {
+public:
+  AstNodeCounter() : count_(0) {}
+
+  uint64_t getCount() const { return count_; }
+
+  void visitModule(const Module* m) {
+    ++count_;
+    for (const Function* f : m->functions()) visit(f);
+    if (m->hasEntryPoint()) visit(m->getEntryPoint());
+  }
+  void visitFunction(const Function* f) {
+    ++count_;
+    visitBody(f->body());
+  }
+  void visitAssertStatement(const AssertStatement* s) {
+    ++count_;
+    visit(s->getExpression());
+  }
+  void visitExpressionStatement(const ExpressionStatement* s) {
+    ++count_;
+    visit(s->getExpression());
+  }
+  void visitInputStatement(const InputStatement*) { ++count_; }
+  void visitAbortStatement(const AbortStatement*) { ++count_; }
+  void visitBranchStatement(const BranchStatement* s) {
+    ++count_;
+    for (const BranchCase& c : s->cases()) {
+      visit(c.getExpression());
+      visitBody(c.body());
+    }
+    if (s->hasBranchElse()) visitBody(s->getBranchElse()->body());
+  }
+  void visitVardeclStatement(const VardeclStatement* s) {
+    ++count_;
+    if (s->hasInitializer()) visit(s->getInitializer());
+  }
+  void visitLoopStatement(const LoopStatement* s) {
+    ++count_;
+    visitBody(s->body());
+    visit(s->getCondition());
+  }
+  void visitReturnStatement(const ReturnStatement* s) {
+    ++count_;
+    if (s->hasExpression()) visit(s->getExpression());
+  }
+  void visitPrintStatement(const PrintStatement* s) {
+    ++count_;
+    visit(s->getExpression());
+  }
+  void visitAssignStatement(const AssignStatement* s) {
+    ++count_;
+    visit(s->getExpression());
+  }
+  void visitFunctionCallExpression(const FunctionCallExpression* e) {
+    ++count_;
+    for (const Expression* arg : e->args()) visit(arg);
+  }
+  void visitBinaryExpression(const BinaryExpression* e) {
+    ++count_;
+    // The left side of a semi-expression is the lead variable of the branch,
+    // which is shared among all of its cases.
+    if (!e->isSemiExpression()) visit(e->getLeft());
+    visit(e->getRight());
+  }
+  void visitAtomicExpression(const AtomicExpression*) { ++count_; }
+
+private:
+  template<typename Range> void visitBody(const Range& body) {
+    for (const Statement* s : body) visit(s);
+  }
+
+  uint64_t count_;
+};
+
+struct BenchmarkOptions {
+  uint64_t seed = 42;
+  size_t input_size = 4 * 1024 * 1024;
+  double min_time = 0.5;
+  std::string filter;
+};
+
+struct BenchmarkResult {
+  std::string name;
+  double seconds = 0;
+  int iterations = 0;
+  size_t bytes = 0;
+  uint64_t tokens = 0;
+  uint64_t nodes = 0;
+  uint64_t allocations = 0;
+};
+
+// Grows the program until it reaches the requested size, changing only the
+// number of functions so that the shape of the code is preserved.
+std::string generateSizedProgram(GeneratorOptions options, size_t size) {
+  std::string source = generateProgram(options);
+  while (source.size() < size) {
+    options.functions *= 2;
+    source = generateProgram(options);
+  }
+  return source;
+}
+
+template<typename Body>
+void runBenchmark(const BenchmarkOptions& options, BenchmarkResult& result, Body body) {
+  using Clock = std::chrono::steady_clock;
+  std::chrono::duration<double> elapsed{0};
+  do {
+    auto start = Clock::now();
+    body(result);
+    elapsed += Clock::now() - start;
+    ++result.iterations;
+  } while (elapsed.count() < options.min_time || result.iterations < 3);
+  result.seconds = elapsed.count() / result.iterations;
+}
+
+BenchmarkResult benchmarkLexer(const BenchmarkOptions& options, const std::string& name,
+                               const std::string& source) {
+  BenchmarkResult result;
+  result.name = name;
+  result.bytes = source.size();
+  runBenchmark(options, result, [&source](BenchmarkResult& result) {
+    std::istringstream input{source};
+    Lexer lexer{input};
+    uint64_t tokens = 0;
+    uint64_t allocations_before = allocations_count;
+    for (;;) {
+      auto token = lexer.getNextToken();
+      ++tokens;
+      if (token->getType() == Token::TOKEN_END || token->getType() == Token::TOKEN_UNKNOWN) break;
+    }
+    result.allocations = allocations_count - allocations_before;
+    result.tokens = tokens;
+  });
+  return result;
+}
+
+BenchmarkResult benchmarkParser(const BenchmarkOptions& options, const std::string& name,
+                                const std::string& source) {
+  BenchmarkResult result;
+  result.name = name;
+  result.bytes = source.size();
+  runBenchmark(options, result, [&source](BenchmarkResult& result) {
+    std::istringstream input{source};
+    Parser parser{input, "bench.mc"};
+    uint64_t allocations_before = allocations_count;
+    auto ast = parser.parse();
+    result.allocations = allocations_count - allocations_before;
+    AstNodeCounter counter;
+    counter.visit(ast.get());
+    result.nodes = counter.getCount();
+  });
+  return result;
+}
+
+void printHeader() {
+  std::cout << std::left << std::setw(24) << "benchmark" << std::right << std::setw(12) << "MB/s"
+            << std::setw(14) << "tokens/s" << std::setw(14) << "allocs/token" << std::setw(12)
+            << "nodes" << std::setw(14) << "allocs/node" << '\n';
+}
+
+void printResult(const BenchmarkResult& result) {
+  double megabytes = result.bytes / (1024.0 * 1024.0);
+  std::cout << std::left << std::setw(24) << result.name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(12) << megabytes / result.seconds;
+  if (result.tokens) {
+    std::cout << std::setw(14) << std::setprecision(0) << result.tokens / result.seconds
+              << std::setw(14) << std::setprecision(3)
+              << static_cast<double>(result.allocations) / result.tokens;
+  } else {
+    std::cout << std::setw(14) << '-' << std::setw(14) << '-';
+  }
+  if (result.nodes) {
+    std::cout << std::setw(12) << result.nodes << std::setw(14) << std::setprecision(3)
+              << static_cast<double>(result.allocations) / result.nodes;
+  } else {
+    std::cout << std::setw(12) << '-' << std::setw(14) << '-';
+  }
+  std::cout << '\n';
+}
+
+void printHelp(const char* program_name) {
+  std::cout << "Usage: " << program_name
+            << " [options...]\n\n"
+               "Options:\n"
+               "  --seed n           : Seed of the program generator (default: 42).\n"
+               "  --size bytes       : Size of the generated inputs (default: 4 MiB).\n"
+               "  --min-time seconds : Minimum running time of each benchmark (default: 0.5).\n"
+               "  --filter name      : Only run benchmarks whose name contains this.\n"
+               "  --help, -h         : Print this message.\n"
+               "\n";
+}
+
+BenchmarkOptions parseCommandLine(int argc, char** argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i < argc - 1;
+    if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "--size") == 0 && has_value) {
+      options.input_size = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "--min-time") == 0 && has_value) {
+      options.min_time = std::strtod(argv[++i], nullptr);
+      continue;
+    }
+    if (strcmp(argv[i], "--filter") == 0 && has_value) {
+      options.filter = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0) {
+      std::cerr << "Unknown option " << argv[i] << ".\n\n";
+      printHelp(argv[0]);
+      exit(1);
+    }
+    printHelp(argv[0]);
+    exit(0);
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  BenchmarkOptions options = parseCommandLine(argc, argv);
+
+  GeneratorOptions mixed;
+  mixed.seed = options.seed;
+
+  GeneratorOptions statements;
+  statements.seed = options.seed;
+  statements.statements_per_function = 64;
+  statements.expression_length = 1;
+  statements.nesting_depth = 0;
+
+  GeneratorOptions expressions;
+  expressions.seed = options.seed;
+  expressions.statements_per_function = 8;
+  expressions.expression_length = 64;
+  expressions.nesting_depth = 0;
+
+  GeneratorOptions branches;
+  branches.seed = options.seed;
+  branches.statements_per_function = 8;
+  branches.expression_length = 2;
+  branches.branch_cases = 4;
+  branches.nesting_depth = 8;
+
+  struct {
+    const char* name;
+    bool parse;
+    const GeneratorOptions& generator_options;
+  } benchmarks[] = {
+      {"lexer/mixed", false, mixed},
+      {"parser/mixed", true, mixed},
+      {"parser/statements", true, statements},
+      {"parser/expressions", true, expressions},
+      {"parser/branches", true, branches},
+  };
+
+  printHeader();
+  for (const auto& benchmark : benchmarks) {
+    std::string name = benchmark.name;
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) continue;
+    auto source = generateSizedProgram(benchmark.generator_options, options.input_size);
+    if (benchmark.parse) {
+      printResult(benchmarkParser(options, name, source));
+    } else {
+      printResult(benchmarkLexer(options, name, source));
+    }
+  }
+}
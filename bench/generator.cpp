@@ -0,0 +1,496 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "generator.h"
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace monicelli;
+
+namespace {
+
+enum class ValueKind { INTEGER, FLOATING };
+
+struct GeneratedVariable {
+  std::string name;
+  const char* type_name;
+  ValueKind kind;
+};
+
+struct GeneratedFunction {
+  std::string name;
+  bool has_result;
+  ValueKind result_kind;
+  std::vector<GeneratedVariable> params;
+};
+
+// Identifiers are chosen so that no prefix of theirs is a keyword that could
+// win the longest match in the lexer (e.g. "bituma" or "del").
+static const char* VARIABLE_NAMES[] = {"pastene",   "barilotto", "vicesindaco", "tarapia",
+                                       "antani",    "sbiriguda", "scappellato", "zingarata",
+                                       "cofandina", "pulitina",  "fuochino",    "ispettore"};
+
+static const char* FUNCTION_NAMES[] = {"antanizzata", "tapiocata", "sbirigudata", "scappellata",
+                                       "cofandinata"};
+
+static const char* ARTICLES[] = {"il", "lo", "la", "un", "una"};
+
+static const char* COMMENT_WORDS[] = {"come", "fosse", "antani", "tarapia", "tapioco",
+                                      "prematurata", "scusi", "noi", "siamo", "in", "quattro"};
+
+class ProgramGenerator final {
+public:
+  explicit ProgramGenerator(const GeneratorOptions& options)
+      : options_(options), rng_(options.seed), next_id_(0), indent_(0) {}
+
+  std::string generate();
+
+private:
+  template<typename T, int N> const T& pickFrom(const T (&values)[N]) { return values[pick(N)]; }
+
+  // std::uniform_int_distribution is not the same across standard libraries,
+  // but std::mt19937_64 is, so we reduce its output ourselves.
+  int pick(int n) { return static_cast<int>(rng_() % n); }
+  bool chance(int percent) { return pick(100) < percent; }
+
+  std::string freshName(const char* prefix) { return prefix + std::to_string(next_id_++); }
+
+  void declareFunctions();
+  void emitExternDeclaration();
+  void emitFunction(const GeneratedFunction& f);
+  void emitEntryPoint();
+  void emitComment();
+
+  void emitStatements(int count, int depth, bool nest_last);
+  void emitStatement(int depth, bool nest);
+  void emitVardecl();
+  void emitAssign();
+  void emitPrint();
+  void emitInput();
+  void emitAssert();
+  void emitCallStatement();
+  void emitBranch(int depth);
+  void emitLoop(int depth);
+
+  void emitExpression(ValueKind kind, int length, bool allow_calls = true);
+  void emitAtom(ValueKind kind, bool allow_calls);
+  void emitCall(const GeneratedFunction& f);
+  void emitCondition();
+  void emitIntegerLiteral(bool non_zero);
+  void emitFloatLiteral();
+  void emitVariableReference(const GeneratedVariable& var);
+
+  const GeneratedVariable* pickVariable(ValueKind kind, bool only_necchi = false);
+  const GeneratedFunction* pickCallee(ValueKind kind);
+
+  std::ostream& line() {
+    out_ << '\n';
+    for (int i = 0; i < indent_; ++i) out_ << "  ";
+    return out_;
+  }
+
+  const GeneratorOptions& options_;
+  std::mt19937_64 rng_;
+  int next_id_;
+  int indent_;
+  std::ostringstream out_;
+  std::vector<GeneratedFunction> functions_;
+  std::vector<GeneratedVariable> variables_;
+};
+
+std::string ProgramGenerator::generate() {
+  emitComment();
+  emitExternDeclaration();
+  declareFunctions();
+  for (const GeneratedFunction& f : functions_) {
+    emitFunction(f);
+  }
+  emitEntryPoint();
+  out_ << '\n';
+  return out_.str();
+}
+
+void ProgramGenerator::declareFunctions() {
+  functions_.reserve(options_.functions);
+  for (int i = 0; i < options_.functions; ++i) {
+    GeneratedFunction f;
+    f.name = freshName(pickFrom(FUNCTION_NAMES));
+    f.has_result = chance(75);
+    f.result_kind = chance(50) ? ValueKind::INTEGER : ValueKind::FLOATING;
+    int params_count = pick(4);
+    for (int j = 0; j < params_count; ++j) {
+      if (chance(50)) {
+        f.params.push_back({freshName(pickFrom(VARIABLE_NAMES)), "Necchi", ValueKind::INTEGER});
+      } else {
+        f.params.push_back(
+            {freshName(pickFrom(VARIABLE_NAMES)), "Sassaroli", ValueKind::FLOATING});
+      }
+    }
+    functions_.emplace_back(std::move(f));
+  }
+}
+
+void ProgramGenerator::emitComment() {
+  line() << "bituma";
+  int words = 1 + pick(6);
+  for (int i = 0; i < words; ++i) {
+    out_ << ' ' << pickFrom(COMMENT_WORDS);
+  }
+}
+
+void ProgramGenerator::emitExternDeclaration() {
+  // An empty body is a declaration, which is the only place where a pointer
+  // type can be used without being able to do anything with it.
+  line() << "blinda la supercazzola " << freshName("esterna") << " con il "
+         << freshName("buffer") << " conte Mascetti, " << freshName("lunghezza")
+         << " Necchi o scherziamo?";
+  out_ << '\n';
+}
+
+void ProgramGenerator::emitFunction(const GeneratedFunction& f) {
+  variables_ = f.params;
+
+  out_ << '\n';
+  emitComment();
+  line() << "blinda la " << (chance(50) ? "supercazzola " : "supercazzora ");
+  if (f.has_result) {
+    out_ << (f.result_kind == ValueKind::INTEGER ? "Necchi " : "Sassaroli ");
+  }
+  out_ << f.name;
+  if (!f.params.empty()) {
+    out_ << " con ";
+    for (size_t i = 0; i < f.params.size(); ++i) {
+      if (i > 0) out_ << ", ";
+      out_ << f.params[i].name << ' ' << f.params[i].type_name;
+    }
+  }
+  out_ << " o scherziamo?";
+
+  ++indent_;
+  emitStatements(options_.statements_per_function, 0, false);
+  if (f.has_result) {
+    line() << "vaffanzum ";
+    emitExpression(f.result_kind, options_.expression_length);
+    out_ << '!';
+  } else if (chance(50)) {
+    line() << "vaffanzum!";
+  }
+  --indent_;
+  out_ << '\n';
+}
+
+void ProgramGenerator::emitEntryPoint() {
+  variables_.clear();
+  out_ << '\n';
+  line() << "Lei ha clacsonato";
+  ++indent_;
+  emitStatements(options_.statements_per_function, 0, false);
+  line() << "vaffanzum 0!";
+  --indent_;
+}
+
+void ProgramGenerator::emitStatements(int count, int depth, bool nest_last) {
+  size_t scope_size = variables_.size();
+  for (int i = 0; i < count; ++i) {
+    if (i > 0 && chance(20)) out_ << ',';
+    emitStatement(depth, nest_last && i == count - 1 && depth < options_.nesting_depth);
+  }
+  // Variables declared in a nested block are gone, or at least not reliably
+  // initialized, when the block ends.
+  if (depth > 0) variables_.resize(scope_size);
+}
+
+void ProgramGenerator::emitStatement(int depth, bool nest) {
+  // Below the top level, only one statement per block opens a nested block,
+  // so that the size of the program grows linearly with the nesting depth.
+  if (nest) {
+    if (chance(50)) {
+      emitBranch(depth);
+    } else {
+      emitLoop(depth);
+    }
+    return;
+  }
+
+  // The first statements of a function have nothing to work on, declare
+  // something first.
+  if (variables_.size() < 2) {
+    emitVardecl();
+    return;
+  }
+
+  bool can_nest = depth == 0 && options_.nesting_depth > 0;
+  switch (pick(can_nest ? 10 : 8)) {
+  case 0:
+  case 1:
+    emitVardecl();
+    break;
+  case 2:
+  case 3:
+    emitAssign();
+    break;
+  case 4:
+    emitPrint();
+    break;
+  case 5:
+    if (pickVariable(ValueKind::INTEGER, true)) {
+      emitInput();
+    } else {
+      emitAssign();
+    }
+    break;
+  case 6:
+    emitAssert();
+    break;
+  case 7:
+    emitCallStatement();
+    break;
+  case 8:
+    emitBranch(depth);
+    break;
+  case 9:
+    emitLoop(depth);
+    break;
+  }
+}
+
+void ProgramGenerator::emitVardecl() {
+  static const GeneratedVariable TYPES[] = {
+      {"", "Necchi", ValueKind::INTEGER},    {"", "Mascetti", ValueKind::INTEGER},
+      {"", "Melandri", ValueKind::INTEGER},  {"", "Perozzi", ValueKind::FLOATING},
+      {"", "Sassaroli", ValueKind::FLOATING}};
+
+  GeneratedVariable var = pickFrom(TYPES);
+  var.name = freshName(pickFrom(VARIABLE_NAMES));
+
+  line() << "voglio ";
+  if (chance(50)) out_ << pickFrom(ARTICLES) << ' ';
+  out_ << var.name << ", " << var.type_name << (chance(50) ? " come se fosse " : " come fosse ");
+  emitExpression(var.kind, options_.expression_length);
+
+  variables_.emplace_back(std::move(var));
+}
+
+void ProgramGenerator::emitAssign() {
+  const GeneratedVariable& var = variables_[pick(variables_.size())];
+  line();
+  emitVariableReference(var);
+  out_ << " come fosse ";
+  emitExpression(var.kind, options_.expression_length);
+}
+
+void ProgramGenerator::emitPrint() {
+  line();
+  emitExpression(chance(50) ? ValueKind::INTEGER : ValueKind::FLOATING,
+                 options_.expression_length);
+  out_ << " a posterdati";
+}
+
+void ProgramGenerator::emitInput() {
+  line() << "mi porga ";
+  emitVariableReference(*pickVariable(ValueKind::INTEGER, true));
+}
+
+void ProgramGenerator::emitAssert() {
+  line() << "ho visto ";
+  emitCondition();
+  out_ << '!';
+}
+
+void ProgramGenerator::emitCallStatement() {
+  line();
+  emitCall(functions_.empty() ? GeneratedFunction{} : functions_[pick(functions_.size())]);
+}
+
+void ProgramGenerator::emitBranch(int depth) {
+  const GeneratedVariable* lead = pickVariable(ValueKind::INTEGER, true);
+  if (!lead) {
+    emitVardecl();
+    return;
+  }
+
+  static const char* CASE_OPERATORS[] = {"",           "minore di ",          "maggiore di ",
+                                         "minore o uguale a ", "maggiore uguale di "};
+
+  line() << "che cos'" << (chance(50) ? "è" : "e`") << ' ';
+  emitVariableReference(*lead);
+  out_ << '?';
+
+  int statements = 1 + pick(3);
+  int cases = options_.branch_cases > 0 ? options_.branch_cases : 1;
+  for (int i = 0; i < cases; ++i) {
+    if (i > 0) line() << "o magari";
+    out_ << ' ' << pickFrom(CASE_OPERATORS);
+    emitExpression(ValueKind::INTEGER, 1, false);
+    out_ << ':';
+    ++indent_;
+    if (chance(5)) line() << "avvertite don ulrico";
+    emitStatements(statements, depth + 1, i == 0);
+    --indent_;
+  }
+  if (chance(50)) {
+    line() << "o tarapia tapioco:";
+    ++indent_;
+    emitStatements(statements, depth + 1, false);
+    --indent_;
+  }
+  line() << "e velocit" << (chance(50) ? "à" : "a`") << " di esecuzione";
+}
+
+void ProgramGenerator::emitLoop(int depth) {
+  line() << "stuzzica";
+  ++indent_;
+  emitStatements(1 + pick(3), depth + 1, true);
+  --indent_;
+  line() << "e " << (chance(50) ? "brematura" : "prematura") << " anche, se ";
+  emitCondition();
+}
+
+void ProgramGenerator::emitExpression(ValueKind kind, int length, bool allow_calls) {
+  emitAtom(kind, allow_calls);
+  for (int i = 1; i < length; ++i) {
+    int op = pick(kind == ValueKind::INTEGER ? 6 : 4);
+    switch (op) {
+    case 0:
+      out_ << (chance(50) ? " più " : " piu` ");
+      break;
+    case 1:
+      out_ << " meno ";
+      break;
+    case 2:
+      out_ << " per ";
+      break;
+    case 3:
+      out_ << " diviso ";
+      // Keep the generated programs runnable.
+      emitIntegerLiteral(true);
+      continue;
+    case 4:
+      out_ << " con scappellamento a sinistra per " << pick(8);
+      continue;
+    case 5:
+      out_ << " con scappellamento a destra per " << pick(8);
+      continue;
+    }
+    emitAtom(kind, allow_calls);
+  }
+}
+
+void ProgramGenerator::emitAtom(ValueKind kind, bool allow_calls) {
+  switch (pick(allow_calls ? 5 : 4)) {
+  case 0:
+  case 1:
+    if (auto var = pickVariable(kind)) {
+      emitVariableReference(*var);
+      return;
+    }
+    break;
+  case 2:
+    if (allow_calls) {
+      if (auto f = pickCallee(kind)) {
+        emitCall(*f);
+        return;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  if (kind == ValueKind::INTEGER) {
+    emitIntegerLiteral(false);
+  } else {
+    emitFloatLiteral();
+  }
+}
+
+void ProgramGenerator::emitCall(const GeneratedFunction& f) {
+  if (f.name.empty()) {
+    out_ << "1 a posterdati";
+    return;
+  }
+  out_ << (chance(50) ? "prematurata" : "brematurata") << " la supercazzola " << f.name;
+  if (!f.params.empty()) {
+    out_ << " con ";
+    for (size_t i = 0; i < f.params.size(); ++i) {
+      if (i > 0) out_ << ", ";
+      emitExpression(f.params[i].kind, 1 + pick(2), false);
+    }
+  }
+  out_ << " o scherziamo?";
+}
+
+void ProgramGenerator::emitCondition() {
+  static const char* OPERATORS[] = {" minore di ", " maggiore di ", " minore o uguale a ",
+                                    " maggiore o uguale di "};
+
+  const GeneratedVariable* var = pickVariable(ValueKind::INTEGER);
+  if (var) {
+    emitVariableReference(*var);
+  } else {
+    emitIntegerLiteral(false);
+  }
+  out_ << pickFrom(OPERATORS);
+  emitExpression(ValueKind::INTEGER, 1 + pick(2), false);
+}
+
+void ProgramGenerator::emitIntegerLiteral(bool non_zero) {
+  int value = pick(1000);
+  if (non_zero) {
+    out_ << value + 1;
+  } else if (chance(10)) {
+    out_ << '-' << value;
+  } else {
+    out_ << value;
+  }
+}
+
+void ProgramGenerator::emitFloatLiteral() {
+  switch (pick(3)) {
+  case 0:
+    out_ << pick(100) << '.' << pick(100);
+    break;
+  case 1:
+    out_ << '-' << pick(100) << '.' << pick(100);
+    break;
+  case 2:
+    out_ << pick(10) << '.' << pick(10) << 'e' << pick(5);
+    break;
+  }
+}
+
+void ProgramGenerator::emitVariableReference(const GeneratedVariable& var) {
+  if (chance(30)) out_ << pickFrom(ARTICLES) << ' ';
+  out_ << var.name;
+}
+
+const GeneratedVariable* ProgramGenerator::pickVariable(ValueKind kind, bool only_necchi) {
+  std::vector<const GeneratedVariable*> candidates;
+  for (const GeneratedVariable& var : variables_) {
+    if (var.kind != kind) continue;
+    if (only_necchi && std::string{var.type_name} != "Necchi") continue;
+    candidates.push_back(&var);
+  }
+  if (candidates.empty()) return nullptr;
+  return candidates[pick(candidates.size())];
+}
+
+const GeneratedFunction* ProgramGenerator::pickCallee(ValueKind kind) {
+  if (functions_.empty()) return nullptr;
+  const GeneratedFunction& f = functions_[pick(functions_.size())];
+  if (!f.has_result || f.result_kind != kind) return nullptr;
+  return &f;
+}
+
+} // namespace
+
+namespace monicelli {
+
+std::string generateProgram(const GeneratorOptions& options) {
+  ProgramGenerator generator{options};
+  return generator.generate();
+}
+
+} // namespace monicelli
@@ -0,0 +1,34 @@
+#ifndef MONICELLI_BENCH_GENERATOR_H
+#define MONICELLI_BENCH_GENERATOR_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include <cstdint>
+#include <string>
+
+namespace monicelli {
+
+// Shape of a synthetic program. Every knob is independent, so that a
+// benchmark can sweep one of them while keeping the others fixed.
+struct GeneratorOptions {
+  uint64_t seed = 42;
+  int functions = 8;
+  int statements_per_function = 16;
+  int expression_length = 4;
+  int branch_cases = 3;
+  int nesting_depth = 2;
+};
+
+// Generates a valid Monicelli program, which is guaranteed to go through
+// the whole compiler without errors. The same options always produce the same
+// program, regardless of the platform.
+//
+// The output uses every token class in lexer.def that has a spelling, i.e.
+// everything except OP_EQ (which is only implied by a branch case without an
+// operator), END and UNKNOWN.
+std::string generateProgram(const GeneratorOptions& options);
+
+} // namespace monicelli
+
+#endif
@@ -0,0 +1,251 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+extern "C" {
+#include "runtime.h"
+}
+
+namespace {
+
+// Reads the same random input once with the runtime and once with scanf,
+// with the formats in types.def, and checks that both read the same values
+// and stop at the same place each time.
+
+// One for each function of the runtime that reads.
+#define INPUT_READERS(V) \
+  V(I32) \
+  V(CHAR) \
+  V(BOOL) \
+  V(F32) \
+  V(F64)
+
+enum Reader {
+#define DECLARE_READER(NAME) READER_##NAME,
+  INPUT_READERS(DECLARE_READER)
+#undef DECLARE_READER
+  READERS_COUNT
+};
+
+const char* READER_NAMES[] = {
+#define READER_NAME(NAME) #NAME,
+    INPUT_READERS(READER_NAME)
+#undef READER_NAME
+};
+
+// Pieces of input that are hard to get right, besides random numbers.
+const char* const TRICKY_TOKENS[] = {
+    "-", "+", "--1", "+-1", "0x", "0xg", "0x.", "0x1p", "0x1.8p+3", "0X.8P-1", "1e", "1e+", "1e-5x",
+    ".5", "5.", ".", "-.e1", "inf", "-INF", "infinity", "infinit", "infx", "in", "nan", "NaN(1)",
+    "nax", "1.5e400", "1e-400", "2e-308", "1e99999", "0e99999", "2147483648", "-2147483649",
+    "4294967296", "9223372036854775807", "9223372036854775808", "-9223372036854775808",
+    "-9223372036854775809", "18446744073709551616", "00000000000000000000012",
+    "0.1000000000000000055511151231257827", "9007199254740993", "123456789012345678901234567890",
+    "3.4028235e38", "3.4028236e38", "1.17549435e-38", "7.0064923e-46", "x", "\t", "\n\n", "  ",
+};
+
+struct CheckOptions {
+  uint64_t seed = 1;
+  int records = 500000;
+};
+
+// A number, a tricky token or a run of characters, with spaces around it.
+std::string randomToken(std::mt19937_64& random) {
+  uint64_t r = random();
+  std::string token;
+  switch (r % 8) {
+    case 0:
+      token = TRICKY_TOKENS[r / 8 % (sizeof(TRICKY_TOKENS) / sizeof(TRICKY_TOKENS[0]))];
+      break;
+    case 1:
+      token = std::to_string(static_cast<int64_t>(random()) >> (r / 8 % 64));
+      break;
+    case 2: {
+      // Long enough for any buffer of the runtime.
+      token = std::string(r / 8 % 300, '0') + std::string(r / 4096 % 300, '7');
+      if (r & (1 << 20)) token += '.' + std::string(r / (1 << 21) % 300, '1');
+      break;
+    }
+    case 3:
+    case 4: {
+      char number[64];
+      double value;
+      uint64_t bits = random();
+      memcpy(&value, &bits, sizeof(value));
+      const char* formats[] = {"%g", "%.17g", "%a", "%.3f", "%e"};
+      snprintf(number, sizeof(number), formats[r / 8 % 5], value);
+      token = number;
+      break;
+    }
+    case 5:
+      token = std::to_string(static_cast<int>(r >> 32) % 1000);
+      if (r & 8) token += '.' + std::to_string(r >> 16 & 0xffff);
+      if (r & 16) token += 'e' + std::to_string(static_cast<int>(r >> 40 & 0xff) - 128);
+      break;
+    default:
+      token = std::string(1 + r / 8 % 3, static_cast<char>(' ' + r / 64 % 95));
+      break;
+  }
+  const char* spaces[] = {"", " ", "\n", "\t ", "\r\n"};
+  return spaces[r >> 60 & 3] + token + spaces[(r >> 58 & 3) + 1];
+}
+
+// What a read gave, and where it left the input.
+struct Read {
+  uint64_t value;
+  long position;
+
+  bool operator==(const Read& other) const = default;
+};
+
+template <typename T>
+uint64_t valueBits(T value) {
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(value));
+  return bits;
+}
+
+// The value before each read, so that the ones that read nothing are seen.
+template <typename T>
+T currentValue(size_t i) {
+  return static_cast<T>(i % 97 + 3);
+}
+
+Read readWithRuntime(Reader reader, size_t i) {
+  uint64_t value = 0;
+  switch (reader) {
+    case READER_I32: value = valueBits(mc_read_i32(currentValue<int32_t>(i))); break;
+    case READER_CHAR:
+      value = valueBits(static_cast<char>(mc_read_char(currentValue<char>(i))));
+      break;
+    case READER_BOOL: value = valueBits(mc_read_bool(currentValue<int32_t>(i))); break;
+    case READER_F32: value = valueBits(mc_read_f32(currentValue<float>(i))); break;
+    case READER_F64: value = valueBits(mc_read_f64(currentValue<double>(i))); break;
+    case READERS_COUNT: break;
+  }
+  return {value, ftell(stdin)};
+}
+
+// The same as the code that mcc generates with --libc-io.
+Read readWithScanf(Reader reader, size_t i) {
+  uint64_t value = 0;
+  switch (reader) {
+#define SCANF_READ(TYPE, FORMAT) \
+  { \
+    TYPE input = currentValue<TYPE>(i); \
+    if (scanf(FORMAT, &input)) {} \
+    value = valueBits(input); \
+    break; \
+  }
+    case READER_I32: SCANF_READ(int32_t, "%d")
+    case READER_CHAR: SCANF_READ(char, "%c")
+    case READER_BOOL: {
+      int32_t input = currentValue<int32_t>(i);
+      if (scanf("%d", &input)) {}
+      value = valueBits(static_cast<int32_t>(input != 0));
+      break;
+    }
+    case READER_F32: SCANF_READ(float, "%f")
+    case READER_F64: SCANF_READ(double, "%lf")
+#undef SCANF_READ
+    case READERS_COUNT: break;
+  }
+  return {value, ftell(stdin)};
+}
+
+void printHelp(const char* program_name) {
+  std::cout << "Usage: " << program_name
+            << " [options...]\n\n"
+               "Options:\n"
+               "  --seed n            : Seed of the random input (default: 1).\n"
+               "  --records n         : Number of reads (default: 500000).\n"
+               "  --help, -h          : Print this message.\n"
+               "\n";
+}
+
+CheckOptions parseCommandLine(int argc, char** argv) {
+  CheckOptions options;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i < argc - 1;
+    if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      options.seed = strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "--records") == 0 && has_value) {
+      options.records = std::max(1, atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0) {
+      std::cerr << "Unknown option " << argv[i] << ".\n\n";
+      printHelp(argv[0]);
+      exit(1);
+    }
+    printHelp(argv[0]);
+    exit(0);
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  CheckOptions options = parseCommandLine(argc, argv);
+
+  std::mt19937_64 random{options.seed};
+  std::string input;
+  std::vector<Reader> readers;
+  for (int i = 0; i < options.records; ++i) {
+    input += randomToken(random);
+    readers.push_back(static_cast<Reader>(random() % READERS_COUNT));
+  }
+
+  const char* tmpdir = getenv("TMPDIR");
+  std::string input_filename = std::string{tmpdir ? tmpdir : "/tmp"} + "/mcc-inputcheck-XXXXXX";
+  int fd = mkstemp(&input_filename[0]);
+  if (fd == -1 || write(fd, input.data(), input.size()) != static_cast<ssize_t>(input.size()) ||
+      close(fd) == -1 || !freopen(input_filename.c_str(), "r", stdin)) {
+    std::cerr << "Cannot write the input to " << input_filename << ".\n";
+    return 1;
+  }
+  unlink(input_filename.c_str());
+
+  mc_init_input();
+  std::vector<Read> runtime_reads;
+  for (size_t i = 0; i < readers.size(); ++i) {
+    runtime_reads.push_back(readWithRuntime(readers[i], i));
+  }
+
+  rewind(stdin);
+  int counts[READERS_COUNT] = {};
+  for (Reader reader : readers) ++counts[reader];
+  for (int r = 0; r < READERS_COUNT; ++r) {
+    std::cout << READER_NAMES[r] << ": " << counts[r] << " reads\n";
+  }
+
+  for (size_t i = 0; i < readers.size(); ++i) {
+    Read read = readWithScanf(readers[i], i);
+    if (read == runtime_reads[i]) continue;
+    // Reading on from different places would only give more mismatches.
+    long start = i ? runtime_reads[i - 1].position : 0;
+    long end = std::max(runtime_reads[i].position, read.position) + 8;
+    std::cerr << "Read " << i << " of " << READER_NAMES[readers[i]] << " gives " << std::hex
+              << runtime_reads[i].value << std::dec << " at " << runtime_reads[i].position
+              << " with the runtime, but " << std::hex << read.value << std::dec << " at "
+              << read.position << " with scanf, after \"" << input.substr(start, end - start)
+              << "\".\n";
+    return 1;
+  }
+  std::cout << "The runtime agrees with scanf.\n";
+  return 0;
+}
@@ -0,0 +1,650 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// The input of read-numbers: a million integers and a hundred thousand
+// doubles, with a few numbers longer than any input buffer. It is generated
+// rather than kept with the sources, always the same, so that the golden
+// output holds.
+void writeNumbersInput(std::ostream& stream) {
+  // Unlike the distributions, the raw output of mt19937_64 is the same
+  // everywhere.
+  std::mt19937_64 random{37};
+  const int integers = 1000000;
+  stream << integers << '\n';
+  for (int i = 1; i <= integers; ++i) {
+    uint64_t r = random();
+    if (i % 200000 == 0) {
+      // Leading zeros, and values that only fit a long or not even that.
+      switch (i / 200000) {
+        case 1: stream << std::string(100000, '0') << "42"; break;
+        case 2: stream << std::string(80000, '9'); break;
+        case 3: stream << '-' << std::string(80000, '9'); break;
+        case 4: stream << "9223372036854775808"; break;
+        default: stream << "-4294967297"; break;
+      }
+    } else {
+      int64_t value = static_cast<int64_t>(r >> 8 & 0x1fffff) - 1000000;
+      stream << (value < 0 ? "-" : r % 16 == 0 ? "+" : "");
+      if (r % 16 == 1) stream << "000";
+      stream << (value < 0 ? -value : value);
+    }
+    stream << (i % 10 == 0 ? '\n' : ' ');
+  }
+  const int doubles = 100000;
+  stream << doubles << '\n';
+  for (int i = 1; i <= doubles; ++i) {
+    uint64_t r = random();
+    char number[64];
+    if (i % 25000 == 0) {
+      stream << "0." << std::string(70000, '3') << "e-" << i / 25000;
+    } else if (r % 4 == 0) {
+      // All 17 digits, which are left to strtod.
+      double value = std::ldexp(static_cast<double>(r >> 11), static_cast<int>(r % 64) - 80);
+      snprintf(number, sizeof(number), "%.17g", value);
+      stream << number;
+    } else {
+      snprintf(number, sizeof(number), "%s%d.%03d", r % 3 == 0 ? "-" : "",
+               static_cast<int>(r >> 16 & 0xfffff), static_cast<int>(r >> 40 & 0x3ff) % 1000);
+      stream << number;
+    }
+    stream << (i % 10 == 0 ? '\n' : ' ');
+  }
+}
+
+// Name and source of every program, relative to the source directory, and
+// the function that writes its standard input, if it is generated. The
+// golden output of a program is bench/programs/<name>.out, and its standard
+// input is otherwise bench/programs/<name>.in, if there is one.
+#define RUNTIME_PROGRAMS(V) \
+  V("factorial", "examples/factorial.mc", nullptr) \
+  V("fibonacci", "examples/fibonacci.mc", nullptr) \
+  V("mandelbrot", "examples/mandelbrot.mc", nullptr) \
+  V("primes", "examples/primes.mc", nullptr) \
+  V("collatz", "bench/programs/collatz.mc", nullptr) \
+  V("dispatch", "bench/programs/dispatch.mc", nullptr) \
+  V("loop-locals", "bench/programs/loop-locals.mc", nullptr) \
+  V("mandelbrot-sum", "bench/programs/mandelbrot-sum.mc", nullptr) \
+  V("primes-count", "bench/programs/primes-count.mc", nullptr) \
+  V("print-floats", "bench/programs/print-floats.mc", nullptr) \
+  V("read-numbers", "bench/programs/read-numbers.mc", writeNumbersInput) \
+  V("probes", "bench/programs/probes.mc", nullptr)
+
+struct Program {
+  const char* name;
+  const char* source;
+  void (*write_input)(std::ostream& stream);
+};
+
+const Program PROGRAMS[] = {
+#define DECLARE_PROGRAM(NAME, SOURCE, WRITE_INPUT) {NAME, SOURCE, WRITE_INPUT},
+    RUNTIME_PROGRAMS(DECLARE_PROGRAM)
+#undef DECLARE_PROGRAM
+};
+
+// One value along an axis of the configuration matrix, together with the
+// mcc options that select it.
+struct Setting {
+  const char* name;
+  std::vector<const char*> flags;
+  // Whether the setting lets float results round differently, so that the
+  // output may differ from the golden one without being wrong.
+  bool inexact = false;
+};
+
+const Setting CPU_SETTINGS[] = {
+    {"generic", {"--cpu", "generic"}},
+    {"native", {"--cpu", "native"}},
+};
+
+const Setting RELOCATION_SETTINGS[] = {
+    {"pic", {}},
+    {"nopic", {"--no-pic"}},
+};
+
+const Setting PIPELINE_SETTINGS[] = {
+    {"default", {}},
+    {"noswitch", {"--no-switch"}},
+    {"libcio", {"--libc-io"}},
+    {"whole", {"--whole-program"}},
+    {"nofold", {"--no-fold-calls"}},
+    {"contract", {"--fp-model=contract"}, true},
+    {"fastmath", {"--fp-model=fast"}, true},
+};
+
+struct Config {
+  std::string name;
+  std::vector<const char*> flags;
+  // Runs the program with mcc --interpret instead of compiling it, which
+  // checks the interpreter against the same golden output.
+  bool interpret = false;
+  // Compiles the program with --usdt, and checks the probes in it against
+  // bench/programs/<name>.probes, if there is one.
+  bool probes = false;
+  bool inexact = false;
+};
+
+#define HARDWARE_COUNTERS(V) \
+  V(CYCLES, "cycles") \
+  V(INSTRUCTIONS, "instructions") \
+  V(BRANCH_MISSES, "branch_misses") \
+  V(CACHE_MISSES, "cache_misses")
+
+enum Counter {
+#define DECLARE_COUNTER(NAME, _) COUNTER_##NAME,
+  HARDWARE_COUNTERS(DECLARE_COUNTER)
+#undef DECLARE_COUNTER
+  COUNTERS_COUNT
+};
+
+const char* COUNTER_NAMES[] = {
+#define COUNTER_NAME(_, STRING) STRING,
+    HARDWARE_COUNTERS(COUNTER_NAME)
+#undef COUNTER_NAME
+};
+
+struct Measurement {
+  int status = 0;
+  double seconds = 0;
+  bool has_counters = false;
+  uint64_t counters[COUNTERS_COUNT] = {};
+};
+
+#define RESULT_STATUSES(V) \
+  V(OK, "ok") \
+  V(UNSUPPORTED, "unsupported") \
+  V(FAILED, "failed") \
+  V(MISMATCH, "mismatch") \
+  V(INEXACT, "inexact")
+
+enum ResultStatus {
+#define DECLARE_STATUS(NAME, _) STATUS_##NAME,
+  RESULT_STATUSES(DECLARE_STATUS)
+#undef DECLARE_STATUS
+};
+
+const char* STATUS_NAMES[] = {
+#define STATUS_NAME(_, STRING) STRING,
+    RESULT_STATUSES(STATUS_NAME)
+#undef STATUS_NAME
+};
+
+struct Result {
+  std::string program;
+  std::string config;
+  ResultStatus status = STATUS_OK;
+  double compile_seconds = 0;
+  double min_seconds = 0;
+  double median_seconds = 0;
+  bool has_counters = false;
+  uint64_t counters[COUNTERS_COUNT] = {};
+};
+
+struct RunbenchOptions {
+  std::string mcc;
+  std::string source_dir = ".";
+  std::string output_filename = "runbench.json";
+  int repetitions = 5;
+  std::string filter;
+};
+
+#ifdef __linux__
+
+const uint64_t PERF_CONFIGS[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static_assert(sizeof(PERF_CONFIGS) / sizeof(PERF_CONFIGS[0]) == COUNTERS_COUNT,
+              "PERF_CONFIGS must match HARDWARE_COUNTERS");
+
+// Opens a counter on a process which has not called exec() yet. The counter
+// starts when it does, so that none of the setup work in the child is measured.
+int openCounter(pid_t pid, uint64_t config) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  // Counting only userspace keeps this working with the default paranoia level.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+#endif
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+bool fileExists(const std::string& filename) {
+  struct stat buffer;
+  return stat(filename.c_str(), &buffer) == 0;
+}
+
+bool readFile(const std::string& filename, std::string& content) {
+  std::ifstream input{filename, std::ios::binary};
+  if (!input) return false;
+  std::ostringstream buffer;
+  buffer << input.rdbuf();
+  content = buffer.str();
+  return true;
+}
+
+// The probes that readelf -n lists, sorted, one on each line with its
+// provider, name and the size of each argument, negative if signed. Where the
+// arguments are depends on the code around the probe, and is left out, and a
+// probe that the optimizer copied is listed once.
+std::string listProbes(const std::string& notes) {
+  std::set<std::string> probes;
+  std::istringstream stream{notes};
+  std::string line;
+  std::string provider;
+  std::string name;
+  while (std::getline(stream, line)) {
+    line.erase(0, line.find_first_not_of(' '));
+    if (line.starts_with("Provider: ")) {
+      provider = line.substr(10);
+    } else if (line.starts_with("Name: ")) {
+      name = line.substr(6);
+    } else if (line.starts_with("Arguments:")) {
+      std::string probe = provider + ':' + name;
+      std::istringstream arguments{line.substr(10)};
+      std::string argument;
+      while (arguments >> argument) probe += ' ' + argument.substr(0, argument.find('@'));
+      probes.insert(std::move(probe));
+    }
+  }
+  std::string list;
+  for (const std::string& probe : probes) list += probe + '\n';
+  return list;
+}
+
+// Runs args[0], looked up in PATH if it is not a path, with stdin and stdout
+// redirected to the given files, which may be empty to use /dev/null, and
+// stderr to stdout. Returns the exit status, or -1 if the process could not
+// be run to completion.
+Measurement runProcess(const std::vector<const char*>& args, const std::string& input_filename,
+                       const std::string& output_filename) {
+  Measurement measurement;
+  measurement.status = -1;
+
+  // The child blocks on this pipe until the counters are attached to it.
+  int go[2];
+  if (pipe(go) == -1) return measurement;
+
+  std::vector<char*> argv;
+  for (const char* arg : args) argv.push_back(const_cast<char*>(arg));
+  argv.push_back(nullptr);
+
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    close(go[1]);
+    const char* input = input_filename.empty() ? "/dev/null" : input_filename.c_str();
+    const char* output = output_filename.empty() ? "/dev/null" : output_filename.c_str();
+    int input_fd = open(input, O_RDONLY);
+    int output_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (input_fd == -1 || output_fd == -1) _exit(127);
+    dup2(input_fd, STDIN_FILENO);
+    dup2(output_fd, STDOUT_FILENO);
+    dup2(output_fd, STDERR_FILENO);
+    char ready;
+    while (read(go[0], &ready, 1) == -1 && errno == EINTR) {}
+    close(go[0]);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+
+  close(go[0]);
+
+  if (pid == -1) {
+    close(go[1]);
+    return measurement;
+  }
+
+  int counter_fds[COUNTERS_COUNT];
+  std::fill(counter_fds, counter_fds + COUNTERS_COUNT, -1);
+#ifdef __linux__
+  measurement.has_counters = true;
+  for (int i = 0; i < COUNTERS_COUNT; ++i) {
+    counter_fds[i] = openCounter(pid, PERF_CONFIGS[i]);
+    if (counter_fds[i] == -1) measurement.has_counters = false;
+  }
+#endif
+
+  auto start = std::chrono::steady_clock::now();
+  close(go[1]);
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) return measurement;
+  }
+  measurement.seconds = secondsSince(start);
+
+  for (int i = 0; i < COUNTERS_COUNT; ++i) {
+    if (counter_fds[i] == -1) continue;
+    uint64_t value = 0;
+    if (read(counter_fds[i], &value, sizeof(value)) != sizeof(value)) {
+      measurement.has_counters = false;
+    }
+    measurement.counters[i] = value;
+    close(counter_fds[i]);
+  }
+
+  if (WIFEXITED(status)) measurement.status = WEXITSTATUS(status);
+  return measurement;
+}
+
+std::vector<Config> buildConfigMatrix() {
+  std::vector<Config> configs;
+  for (const Setting& cpu : CPU_SETTINGS) {
+    for (const Setting& relocation : RELOCATION_SETTINGS) {
+      for (const Setting& pipeline : PIPELINE_SETTINGS) {
+        Config config;
+        config.name = std::string{cpu.name} + '-' + relocation.name + '-' + pipeline.name;
+        for (const Setting* setting : {&cpu, &relocation, &pipeline}) {
+          config.flags.insert(config.flags.end(), setting->flags.begin(), setting->flags.end());
+          config.inexact |= setting->inexact;
+        }
+        configs.push_back(std::move(config));
+      }
+    }
+  }
+  // Neither the CPU nor the relocation model matter to the interpreter.
+  Config interpret;
+  interpret.name = "interpret";
+  interpret.interpret = true;
+  configs.push_back(std::move(interpret));
+  // Probes cost the same whatever the CPU, and are only checked once.
+  Config usdt;
+  usdt.name = "usdt";
+  usdt.flags = {"--usdt"};
+  usdt.probes = true;
+  configs.push_back(std::move(usdt));
+  return configs;
+}
+
+Result benchmarkProgram(const RunbenchOptions& options, const std::string& work_dir,
+                        const Program& program, const Config& config) {
+  Result result;
+  result.program = program.name;
+  result.config = config.name;
+
+  std::string source = options.source_dir + '/' + program.source;
+  std::string golden_prefix = options.source_dir + "/bench/programs/" + program.name;
+  std::string executable = work_dir + '/' + program.name;
+  std::string log_filename = work_dir + "/log";
+  std::string output_filename = work_dir + "/output";
+
+  std::string input_filename = golden_prefix + ".in";
+  if (program.write_input) {
+    // Written once, and kept for the other configurations.
+    input_filename = work_dir + '/' + program.name + ".in";
+    if (!fileExists(input_filename)) {
+      std::ofstream input{input_filename, std::ios::binary};
+      program.write_input(input);
+      input.close();
+      if (!input) {
+        std::cerr << "Cannot write the input of " << program.name << ".\n";
+        exit(1);
+      }
+    }
+  } else if (!fileExists(input_filename)) {
+    input_filename.clear();
+  }
+
+  std::string golden;
+  if (!readFile(golden_prefix + ".out", golden)) {
+    std::cerr << "Cannot read the golden output of " << program.name << ".\n";
+    exit(1);
+  }
+
+  std::vector<const char*> run_args = {executable.c_str()};
+  if (config.interpret) {
+    run_args = {options.mcc.c_str(), "--interpret", source.c_str()};
+  } else {
+    // A configuration that mcc does not support on this machine is not an
+    // error, it just has no numbers.
+    std::vector<const char*> compile_args = {options.mcc.c_str(), source.c_str(), "-o",
+                                             executable.c_str()};
+    compile_args.insert(compile_args.end(), config.flags.begin(), config.flags.end());
+    unlink(executable.c_str());
+    Measurement compile = runProcess(compile_args, "", log_filename);
+    result.compile_seconds = compile.seconds;
+    if (compile.status != 0 || !fileExists(executable)) {
+      result.status = STATUS_UNSUPPORTED;
+      return result;
+    }
+  }
+
+  std::string golden_probes;
+  if (config.probes && readFile(golden_prefix + ".probes", golden_probes)) {
+    std::string notes;
+    Measurement readelf = runProcess({"readelf", "-n", executable.c_str()}, "", output_filename);
+    if (readelf.status != 0 || !readFile(output_filename, notes)) {
+      std::cerr << "Cannot list the probes of " << program.name << " with readelf.\n";
+      result.status = STATUS_UNSUPPORTED;
+      return result;
+    }
+    if (listProbes(notes) != golden_probes) {
+      std::cerr << "The probes of " << program.name << " are not those in " << golden_prefix
+                << ".probes:\n"
+                << listProbes(notes);
+      result.status = STATUS_MISMATCH;
+      return result;
+    }
+  }
+
+  std::vector<Measurement> runs;
+  for (int i = 0; i < options.repetitions; ++i) {
+    Measurement run = runProcess(run_args, input_filename, output_filename);
+    if (run.status != 0) {
+      result.status = STATUS_FAILED;
+      return result;
+    }
+    std::string output;
+    if (!readFile(output_filename, output)) {
+      result.status = STATUS_MISMATCH;
+      return result;
+    }
+    if (output != golden) {
+      // A relaxed float model is still timed, but its numbers are marked.
+      if (!config.inexact) {
+        result.status = STATUS_MISMATCH;
+        return result;
+      }
+      result.status = STATUS_INEXACT;
+    }
+    runs.push_back(run);
+  }
+
+  std::sort(runs.begin(), runs.end(), [](const Measurement& a, const Measurement& b) {
+    return a.seconds < b.seconds;
+  });
+  result.min_seconds = runs.front().seconds;
+  result.median_seconds = runs[runs.size() / 2].seconds;
+  // Counters are taken from the median run, so they describe a typical one.
+  const Measurement& median = runs[runs.size() / 2];
+  result.has_counters = median.has_counters;
+  std::copy(median.counters, median.counters + COUNTERS_COUNT, result.counters);
+
+  unlink(executable.c_str());
+  return result;
+}
+
+void writeJSONString(std::ostream& stream, const std::string& string) {
+  stream << '"';
+  for (char c : string) {
+    if (c == '"' || c == '\\') stream << '\\';
+    stream << c;
+  }
+  stream << '"';
+}
+
+// Every result is written on a line of its own, always in the same order, so
+// that the output of two runs can be compared with a plain diff.
+void writeResults(std::ostream& stream, const RunbenchOptions& options,
+                  const std::vector<Result>& results) {
+  stream << "{\n  \"mcc\": ";
+  writeJSONString(stream, options.mcc);
+  stream << ",\n  \"repetitions\": " << options.repetitions << ",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    stream << "    {\"program\": ";
+    writeJSONString(stream, result.program);
+    stream << ", \"config\": ";
+    writeJSONString(stream, result.config);
+    stream << ", \"status\": \"" << STATUS_NAMES[result.status] << '"';
+    if (result.status == STATUS_OK || result.status == STATUS_INEXACT) {
+      char buffer[128];
+      snprintf(buffer, sizeof(buffer),
+               ", \"compile_seconds\": %.6f, \"min_seconds\": %.6f, \"median_seconds\": %.6f",
+               result.compile_seconds, result.min_seconds, result.median_seconds);
+      stream << buffer;
+      if (result.has_counters) {
+        for (int c = 0; c < COUNTERS_COUNT; ++c) {
+          stream << ", \"" << COUNTER_NAMES[c] << "\": " << result.counters[c];
+        }
+      }
+    }
+    stream << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+  }
+  stream << "  ]\n}\n";
+}
+
+void printHelp(const char* program_name) {
+  std::cout << "Usage: " << program_name
+            << " --mcc path [options...]\n\n"
+               "Options:\n"
+               "  --mcc path          : The compiler to benchmark.\n"
+               "  --source-dir dir    : Root of the Monicelli sources (default: .).\n"
+               "  --output file       : Where to write the results (default: runbench.json).\n"
+               "  --repetitions n     : Runs of each program, at least 1 (default: 5).\n"
+               "  --filter name       : Only run program/config pairs which contain this.\n"
+               "  --help, -h          : Print this message.\n"
+               "\n";
+}
+
+RunbenchOptions parseCommandLine(int argc, char** argv) {
+  RunbenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i < argc - 1;
+    if (strcmp(argv[i], "--mcc") == 0 && has_value) {
+      options.mcc = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--source-dir") == 0 && has_value) {
+      options.source_dir = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--output") == 0 && has_value) {
+      options.output_filename = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+      options.repetitions = std::max(1, atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "--filter") == 0 && has_value) {
+      options.filter = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0) {
+      std::cerr << "Unknown option " << argv[i] << ".\n\n";
+      printHelp(argv[0]);
+      exit(1);
+    }
+    printHelp(argv[0]);
+    exit(0);
+  }
+  if (options.mcc.empty()) {
+    std::cerr << "The path of mcc must be given with --mcc.\n\n";
+    printHelp(argv[0]);
+    exit(1);
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  RunbenchOptions options = parseCommandLine(argc, argv);
+
+  const char* tmpdir = getenv("TMPDIR");
+  std::string work_dir_template = std::string{tmpdir ? tmpdir : "/tmp"} + "/mcc-runbench-XXXXXX";
+  if (!mkdtemp(&work_dir_template[0])) {
+    std::cerr << "Cannot create a temporary directory.\n";
+    return 1;
+  }
+  const std::string& work_dir = work_dir_template;
+
+  std::vector<Result> results;
+  bool passed = true;
+  for (const Program& program : PROGRAMS) {
+    for (const Config& config : buildConfigMatrix()) {
+      std::string name = std::string{program.name} + '/' + config.name;
+      if (!options.filter.empty() && name.find(options.filter) == std::string::npos) continue;
+
+      Result result = benchmarkProgram(options, work_dir, program, config);
+      std::cout << name << ": " << STATUS_NAMES[result.status];
+      if (result.status == STATUS_OK || result.status == STATUS_INEXACT) {
+        std::cout << ", " << result.median_seconds << " s";
+      }
+      std::cout << '\n';
+
+      if (result.status == STATUS_FAILED || result.status == STATUS_MISMATCH) passed = false;
+      results.push_back(std::move(result));
+    }
+  }
+
+  for (const Program& program : PROGRAMS) {
+    if (program.write_input) unlink((work_dir + '/' + program.name + ".in").c_str());
+  }
+  unlink((work_dir + "/log").c_str());
+  unlink((work_dir + "/output").c_str());
+  rmdir(work_dir.c_str());
+
+  std::ofstream output{options.output_filename};
+  if (!output) {
+    std::cerr << "Cannot open " << options.output_filename << " for output.\n";
+    return 1;
+  }
+  writeResults(output, options, results);
+
+  return passed ? 0 : 1;
+}
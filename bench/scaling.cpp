@@ -0,0 +1,331 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "asmgen.h"
+#include "codegen.h"
+#include "generator.h"
+#include "lexer.h"
+#include "parser.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/TargetParser/Host.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace monicelli;
+
+namespace {
+
+#define SCALING_PHASES(V) \
+  V(LEX, "lex") \
+  V(PARSE, "parse") \
+  V(IRGEN, "irgen") \
+  V(OPTIMIZE, "optimize") \
+  V(CODEGEN, "codegen") \
+  V(LINK, "link")
+
+enum Phase {
+#define DECLARE_PHASE(NAME, _) PHASE_##NAME,
+  SCALING_PHASES(DECLARE_PHASE)
+#undef DECLARE_PHASE
+  PHASES_COUNT
+};
+
+static const char* PHASE_NAMES[] = {
+#define PHASE_NAME(_, STRING) STRING,
+    SCALING_PHASES(PHASE_NAME)
+#undef PHASE_NAME
+};
+
+// A dimension of the generated programs, swept from min to max by doubling
+// while all the others stay at their base value.
+struct Dimension {
+  const char* name;
+  int GeneratorOptions::*knob;
+  int min;
+  int max;
+};
+
+struct Sample {
+  int value;
+  size_t bytes;
+  double seconds[PHASES_COUNT];
+};
+
+struct ScalingOptions {
+  uint64_t seed = 42;
+  int repetitions = 3;
+  double max_exponent = 1.3;
+  bool link = true;
+  std::string filter;
+  std::vector<std::pair<std::string, double>> bounds;
+};
+
+class PhaseRunner final {
+public:
+  PhaseRunner(const std::string& work_dir, llvm::TargetMachine* target_machine,
+              const std::string& triple, const std::string& runtime_library)
+      : work_dir_(work_dir), target_machine_(target_machine), triple_(triple),
+        runtime_library_(runtime_library) {}
+
+  // Runs every phase once, returning the time taken by each of them.
+  void run(const std::string& source, bool link, double* seconds);
+
+private:
+  template<typename Body> static double time(Body body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+  std::string work_dir_;
+  llvm::TargetMachine* target_machine_;
+  std::string triple_;
+  std::string runtime_library_;
+};
+
+void PhaseRunner::run(const std::string& source, bool link, double* seconds) {
+  seconds[PHASE_LEX] = time([&source] {
+    std::istringstream input{source};
+    Lexer lexer{input};
+    for (;;) {
+      auto type = lexer.getNextToken()->getType();
+      if (type == Token::TOKEN_END || type == Token::TOKEN_UNKNOWN) break;
+    }
+  });
+
+  std::unique_ptr<Module> ast;
+  seconds[PHASE_PARSE] = time([&source, &ast] {
+    std::istringstream input{source};
+    Parser parser{input, "scaling.mc"};
+    ast = parser.parse();
+  });
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> ir;
+  seconds[PHASE_IRGEN] = time([&context, &ast, &ir] { ir = generateIR(context, ast.get()); });
+  ir->setTargetTriple(triple_);
+  ir->setDataLayout(target_machine_->createDataLayout());
+
+  seconds[PHASE_OPTIMIZE] = time([&ir] { runFunctionOptimizer(ir.get()); });
+
+  llvm::SmallString<128> object_filename{work_dir_};
+  llvm::sys::path::append(object_filename, "scaling.o");
+  seconds[PHASE_CODEGEN] = time([this, &ir, &object_filename] {
+    writeAssembly(object_filename.str().str(), ir.get(), target_machine_);
+  });
+
+  seconds[PHASE_LINK] = 0;
+#ifdef MONICELLI_ENABLE_LINKER
+  if (link) {
+    llvm::SmallString<128> executable_filename{work_dir_};
+    llvm::sys::path::append(executable_filename, "scaling");
+    seconds[PHASE_LINK] = time([this, &object_filename, &executable_filename] {
+      linkAssembly(executable_filename.str().str(), {object_filename.str().str()},
+                   runtime_library_);
+    });
+    llvm::sys::fs::remove(executable_filename);
+    return;
+  }
+#endif
+  llvm::sys::fs::remove(object_filename);
+}
+
+// Least-squares fit of log(seconds) = k * log(bytes) + c, returning k.
+double fitExponent(const std::vector<Sample>& samples, int phase) {
+  double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+  int n = 0;
+  for (const Sample& sample : samples) {
+    if (sample.seconds[phase] <= 0) continue;
+    double x = std::log(static_cast<double>(sample.bytes));
+    double y = std::log(sample.seconds[phase]);
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    ++n;
+  }
+  double denominator = n * sum_xx - sum_x * sum_x;
+  if (n < 2 || denominator == 0) return 0;
+  return (n * sum_xy - sum_x * sum_y) / denominator;
+}
+
+double getBound(const ScalingOptions& options, const Dimension& dimension) {
+  double bound = options.max_exponent;
+  for (const auto& override : options.bounds) {
+    if (override.first == dimension.name) bound = override.second;
+  }
+  return bound;
+}
+
+bool sweep(const ScalingOptions& options, PhaseRunner& runner, const Dimension& dimension) {
+  GeneratorOptions base;
+  base.seed = options.seed;
+
+  std::cout << "== " << dimension.name << '\n'
+            << std::setw(8) << "value" << std::setw(12) << "bytes";
+  for (const char* name : PHASE_NAMES) std::cout << std::setw(12) << name;
+  std::cout << '\n';
+
+  std::vector<Sample> samples;
+  for (int value = dimension.min; value <= dimension.max; value *= 2) {
+    GeneratorOptions generator_options = base;
+    generator_options.*dimension.knob = value;
+    std::string source = generateProgram(generator_options);
+
+    Sample sample;
+    sample.value = value;
+    sample.bytes = source.size();
+    for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+      sample.seconds[phase] = HUGE_VAL;
+    }
+    // The minimum is the least noisy estimate of how long a phase takes.
+    for (int i = 0; i < options.repetitions; ++i) {
+      double seconds[PHASES_COUNT];
+      runner.run(source, options.link, seconds);
+      for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+        sample.seconds[phase] = std::min(sample.seconds[phase], seconds[phase]);
+      }
+    }
+
+    std::cout << std::setw(8) << sample.value << std::setw(12) << sample.bytes << std::fixed
+              << std::setprecision(4);
+    for (double seconds : sample.seconds) std::cout << std::setw(12) << seconds;
+    std::cout << '\n';
+
+    samples.push_back(sample);
+  }
+
+  double bound = getBound(options, dimension);
+  bool passed = true;
+  std::cout << std::setw(20) << "exponent" << std::setprecision(2);
+  for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+    double exponent = fitExponent(samples, phase);
+    std::cout << std::setw(12) << exponent;
+    if (exponent > bound) passed = false;
+  }
+  std::cout << '\n' << std::setw(20) << "bound" << std::setw(12) << bound << "  "
+            << (passed ? "PASS" : "FAIL") << "\n\n";
+  return passed;
+}
+
+void printHelp(const char* program_name) {
+  std::cout << "Usage: " << program_name
+            << " [options...]\n\n"
+               "Options:\n"
+               "  --seed n             : Seed of the program generator (default: 42).\n"
+               "  --repetitions n      : Runs per size, the fastest is kept (default: 3).\n"
+               "  --max-exponent k     : Highest growth exponent that passes (default: 1.3).\n"
+               "  --bound dimension=k  : Override the bound for a single dimension.\n"
+               "  --filter dimension   : Only sweep dimensions whose name contains this.\n"
+#ifdef MONICELLI_ENABLE_LINKER
+               "  --no-link            : Do not time the link step.\n"
+#endif
+               "  --help, -h           : Print this message.\n"
+               "\n";
+}
+
+ScalingOptions parseCommandLine(int argc, char** argv) {
+  ScalingOptions options;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i < argc - 1;
+    if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+      options.repetitions = std::max(1, atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "--max-exponent") == 0 && has_value) {
+      options.max_exponent = std::strtod(argv[++i], nullptr);
+      continue;
+    }
+    if (strcmp(argv[i], "--bound") == 0 && has_value) {
+      std::string bound = argv[++i];
+      auto equals = bound.find('=');
+      if (equals == std::string::npos) {
+        std::cerr << "--bound must be followed by dimension=exponent.\n";
+        exit(1);
+      }
+      options.bounds.emplace_back(bound.substr(0, equals),
+                                  std::strtod(bound.c_str() + equals + 1, nullptr));
+      continue;
+    }
+    if (strcmp(argv[i], "--filter") == 0 && has_value) {
+      options.filter = argv[++i];
+      continue;
+    }
+#ifdef MONICELLI_ENABLE_LINKER
+    if (strcmp(argv[i], "--no-link") == 0) {
+      options.link = false;
+      continue;
+    }
+#endif
+    if (strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0) {
+      std::cerr << "Unknown option " << argv[i] << ".\n\n";
+      printHelp(argv[0]);
+      exit(1);
+    }
+    printHelp(argv[0]);
+    exit(0);
+  }
+#ifndef MONICELLI_ENABLE_LINKER
+  options.link = false;
+#endif
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ScalingOptions options = parseCommandLine(argc, argv);
+
+  const Dimension dimensions[] = {
+      {"functions", &GeneratorOptions::functions, 16, 1024},
+      {"statements", &GeneratorOptions::statements_per_function, 16, 1024},
+      {"expression-length", &GeneratorOptions::expression_length, 8, 512},
+      {"branch-cases", &GeneratorOptions::branch_cases, 8, 512},
+      {"nesting-depth", &GeneratorOptions::nesting_depth, 4, 128},
+  };
+
+  registerTargets();
+  auto triple = llvm::sys::getDefaultTargetTriple();
+  auto target_machine = getTargetMachine(triple, "generic", "", true);
+
+  llvm::SmallString<128> work_dir;
+  if (auto error = llvm::sys::fs::createUniqueDirectory("mcc-scaling", work_dir)) {
+    std::cerr << "Cannot create a temporary directory: " << error.message() << '\n';
+    return 1;
+  }
+
+  std::string runtime_library;
+#ifdef MONICELLI_ENABLE_LINKER
+  runtime_library = getRuntimeLibrary(argv[0]);
+#endif
+
+  PhaseRunner runner{work_dir.str().str(), target_machine, triple, runtime_library};
+
+  bool passed = true;
+  for (const Dimension& dimension : dimensions) {
+    std::string name = dimension.name;
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) continue;
+    if (!sweep(options, runner, dimension)) passed = false;
+  }
+
+  llvm::sys::fs::remove_directories(work_dir);
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "runtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The registered buffers are an open addressing hash set of their addresses,
+// which is kept at most half full.
+#define MIN_BUFFERS_CAPACITY 1024
+
+static void** buffers = NULL;
+static size_t buffers_capacity = 0;
+static size_t buffers_count = 0;
+
+static void bufferError(const char* message) {
+  fflush(stdout);
+  fprintf(stderr, "%s\n", message);
+  abort();
+}
+
+// Buffers are at least 16 bytes apart, so the low bits say nothing.
+static size_t hashBuffer(const void* elements) {
+  uint64_t hash = (uint64_t)(uintptr_t)elements >> 4;
+  return (size_t)(hash * 0x9e3779b97f4a7c15u);
+}
+
+// Returns the slot of elements, or the empty one where it would go.
+static void** findBuffer(void** table, size_t capacity, const void* elements) {
+  size_t mask = capacity - 1;
+  size_t i = hashBuffer(elements) & mask;
+  while (table[i] && table[i] != elements) i = (i + 1) & mask;
+  return table + i;
+}
+
+static void growBuffers(void) {
+  size_t capacity = buffers_capacity ? buffers_capacity * 2 : MIN_BUFFERS_CAPACITY;
+  void** table = calloc(capacity, sizeof(*table));
+  if (!table) bufferError("Out of memory.");
+  for (size_t i = 0; i < buffers_capacity; ++i) {
+    if (buffers[i]) *findBuffer(table, capacity, buffers[i]) = buffers[i];
+  }
+  free(buffers);
+  buffers = table;
+  buffers_capacity = capacity;
+}
+
+void mc_register_buffer(void* elements) {
+  if (2 * (buffers_count + 1) > buffers_capacity) growBuffers();
+  void** slot = findBuffer(buffers, buffers_capacity, elements);
+  if (!*slot) ++buffers_count;
+  *slot = elements;
+}
+
+void mc_check_buffer(void* elements) {
+  if (!elements) return;
+  if (buffers && *findBuffer(buffers, buffers_capacity, elements)) return;
+  bufferError("With --bounds-check, every conte must come from sbiriguda.");
+}
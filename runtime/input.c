@@ -0,0 +1,276 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "runtime.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+// Numbers that do not fit the fast path are copied for strtod, here if they
+// are short enough, else on the heap.
+#define SHORT_NUMBER_SIZE 128
+
+// Input is read from stdin like scanf does, a character at a time and putting
+// back only the one after the number, so that it stays in order with what C
+// functions linked into the program read. What is saved over scanf is the
+// parsing of the format, and the locking of stdin for each character.
+static char input_buffer[INPUT_BUFFER_SIZE];
+
+// The powers of ten that are exact as a double and as a float.
+static const double DOUBLE_POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                              1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                              1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+static const float FLOAT_POWERS_OF_TEN[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                            1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+void mc_init_input(void) {
+  // A terminal is left line buffered, since reading from it flushes what
+  // C functions printed, like a prompt.
+  if (!isatty(STDIN_FILENO)) setvbuf(stdin, input_buffer, _IOFBF, INPUT_BUFFER_SIZE);
+}
+
+static inline int readChar(void) { return getc_unlocked(stdin); }
+
+// Puts back the character after what was read, like scanf does.
+static void unreadChar(int c) {
+  if (c != EOF) ungetc(c, stdin);
+}
+
+static int isDigit(int c) { return c >= '0' && c <= '9'; }
+
+// The same as isspace() in the C locale.
+static int isSpace(int c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+// Returns the first character that is not a space.
+static int skipSpaces(void) {
+  int c;
+  do {
+    c = readChar();
+  } while (isSpace(c));
+  return c;
+}
+
+int32_t mc_read_i32(int32_t current) {
+  mc_sync_output();
+  int c = skipSpaces();
+  int negative = c == '-';
+  if (c == '-' || c == '+') c = readChar();
+  if (!isDigit(c)) {
+    // Like scanf, a lone sign is consumed all the same.
+    unreadChar(c);
+    return current;
+  }
+  // glibc reads the number as a long with strtol, which saturates, and then
+  // truncates it to an int, so that for instance 2^63 is read as -1.
+  unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+  unsigned long value = 0;
+  do {
+    unsigned digit = c - '0';
+    value = value > (limit - digit) / 10 ? limit : value * 10 + digit;
+    c = readChar();
+  } while (isDigit(c));
+  unreadChar(c);
+  return (int32_t)(negative ? 0u - (uint32_t)value : (uint32_t)value);
+}
+
+int32_t mc_read_char(int32_t current) {
+  mc_sync_output();
+  int c = readChar();
+  return c == EOF ? current : c;
+}
+
+int32_t mc_read_bool(int32_t current) { return mc_read_i32(current) != 0; }
+
+// A number as scanf would consume it: the longest prefix of something that
+// could be a number, which is then given to strtod. When it is in plain
+// decimal notation with at most 19 significant digits, like 12.5e-3, it is
+// also split into an integer mantissa and a power of ten.
+struct Number {
+  char* text;
+  size_t length;
+  size_t capacity;
+  char short_text[SHORT_NUMBER_SIZE];
+  int decimal;
+  int negative;
+  uint64_t mantissa;
+  int digits;
+  int exponent;
+};
+
+// If there is no memory for a very long number, the rest of it is read but
+// dropped.
+static void appendChar(struct Number* number, int c) {
+  if (number->length + 1 == number->capacity) {
+    char* text = number->text == number->short_text ? NULL : number->text;
+    text = realloc(text, number->capacity * 2);
+    if (!text) return;
+    if (number->text == number->short_text) memcpy(text, number->short_text, number->length);
+    number->text = text;
+    number->capacity *= 2;
+  }
+  number->text[number->length++] = (char)c;
+}
+
+static void freeNumber(struct Number* number) {
+  if (number->text != number->short_text) free(number->text);
+}
+
+static void addDigit(struct Number* number, int c) {
+  if (number->digits == 0 && c == '0') return;
+  if (++number->digits > 19) number->decimal = 0;
+  number->mantissa = number->mantissa * 10 + (c - '0');
+}
+
+static int isHexDigit(int c) {
+  return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int toLower(int c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+static void readNumber(struct Number* number) {
+  number->text = number->short_text;
+  number->length = 0;
+  number->capacity = SHORT_NUMBER_SIZE;
+  number->decimal = 1;
+  number->mantissa = 0;
+  number->digits = 0;
+  number->exponent = 0;
+
+  mc_sync_output();
+  int c = skipSpaces();
+#define TAKE_CHAR() \
+  do { \
+    appendChar(number, c); \
+    c = readChar(); \
+  } while (0)
+  number->negative = c == '-';
+  size_t sign_length = 0;
+  if (c == '+' || c == '-') {
+    TAKE_CHAR();
+    sign_length = 1;
+  }
+  if (toLower(c) == 'i' || toLower(c) == 'n') {
+    number->decimal = 0;
+    // Like glibc, all of inf or nan must be there, and all of infinity once
+    // past inf. A character that does not match is dropped, not put back.
+    const char* word = toLower(c) == 'i' ? "infinity" : "nan";
+    for (size_t i = 0; word[i] && (i != 3 || toLower(c) == 'i'); ++i) {
+      if (toLower(c) != word[i]) {
+        number->length = 0;
+        number->text[0] = '\0';
+        return;
+      }
+      TAKE_CHAR();
+    }
+  } else {
+    int hex = 0;
+    int seen_digit = 0;
+    if (c == '0') {
+      TAKE_CHAR();
+      seen_digit = 1;
+      if (c == 'x' || c == 'X') {
+        TAKE_CHAR();
+        number->decimal = 0;
+        hex = 1;
+        seen_digit = 0;
+      }
+    }
+    for (; hex ? isHexDigit(c) : isDigit(c); seen_digit = 1) {
+      if (!hex) addDigit(number, c);
+      TAKE_CHAR();
+    }
+    if (c == '.') {
+      TAKE_CHAR();
+      for (; hex ? isHexDigit(c) : isDigit(c); seen_digit = 1) {
+        if (!hex) {
+          addDigit(number, c);
+          --number->exponent;
+        }
+        TAKE_CHAR();
+      }
+    }
+    if (!seen_digit) number->decimal = 0;
+    // glibc does not take 0x alone as 0.
+    if (hex && number->length == sign_length + 2) {
+      unreadChar(c);
+      number->length = 0;
+      number->text[0] = '\0';
+      return;
+    }
+    // There is no exponent without some digits before it. Without digits
+    // after it, glibc takes the e as part of the number anyway.
+    if (seen_digit && (hex ? toLower(c) == 'p' : toLower(c) == 'e')) {
+      TAKE_CHAR();
+      int negative_exponent = c == '-';
+      if (c == '+' || c == '-') TAKE_CHAR();
+      // A longer exponent is left to strtod, which handles any length.
+      int exponent = 0;
+      while (isDigit(c)) {
+        if (exponent < 10000) {
+          exponent = exponent * 10 + (c - '0');
+        } else {
+          number->decimal = 0;
+        }
+        TAKE_CHAR();
+      }
+      number->exponent += negative_exponent ? -exponent : exponent;
+    }
+  }
+#undef TAKE_CHAR
+  unreadChar(c);
+  // appendChar() always leaves room for this.
+  number->text[number->length] = '\0';
+}
+
+// Numbers with few digits and a small exponent are converted with a single
+// multiplication or division, which is exact since both operands are, like
+// strtod would do. The others are left to strtod.
+double mc_read_f64(double current) {
+  struct Number number;
+  readNumber(&number);
+  double value;
+  if (number.decimal && number.digits <= 15 && number.exponent >= -22 &&
+      number.exponent <= 22) {
+    value = (double)number.mantissa;
+    if (number.exponent < 0) {
+      value /= DOUBLE_POWERS_OF_TEN[-number.exponent];
+    } else {
+      value *= DOUBLE_POWERS_OF_TEN[number.exponent];
+    }
+    value = number.negative ? -value : value;
+  } else {
+    char* end;
+    value = strtod(number.text, &end);
+    if (end == number.text) value = current;
+  }
+  freeNumber(&number);
+  return value;
+}
+
+float mc_read_f32(float current) {
+  struct Number number;
+  readNumber(&number);
+  float value;
+  if (number.decimal && number.digits <= 7 && number.exponent >= -10 && number.exponent <= 10) {
+    value = (float)number.mantissa;
+    if (number.exponent < 0) {
+      value /= FLOAT_POWERS_OF_TEN[-number.exponent];
+    } else {
+      value *= FLOAT_POWERS_OF_TEN[number.exponent];
+    }
+    value = number.negative ? -value : value;
+  } else {
+    char* end;
+    value = strtof(number.text, &end);
+    if (end == number.text) value = current;
+  }
+  freeNumber(&number);
+  return value;
+}
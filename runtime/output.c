@@ -0,0 +1,194 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#define _POSIX_C_SOURCE 200809L
+// For fwrite_unlocked() on glibc.
+#define _DEFAULT_SOURCE
+
+#include "runtime.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// The longest %f of a double: sign, 309 digits, point, 6 decimals, newline.
+#define MAX_F64_SIZE 320
+
+// The integer part of a double, in base 10^9 from the least significant
+// limb, has at most 35 limbs.
+#define MAX_F64_LIMBS 36
+
+// Output goes through stdout, and so stays in order with what C functions
+// linked into the program print. What is saved over printf is the parsing of
+// the format, the formatting of numbers, and the locking of stdout for each
+// print, since a Monicelli program has a single thread.
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+// Like stdio, output to a terminal is written a line at a time.
+static int output_line_buffered = 0;
+
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+static void writeOutput(const char* data, size_t size) {
+#ifdef __GLIBC__
+  fwrite_unlocked(data, 1, size, stdout);
+#else
+  fwrite(data, 1, size, stdout);
+#endif
+}
+
+void mc_init_output(void) {
+  output_line_buffered = isatty(STDOUT_FILENO);
+  // A larger buffer than the default means fewer writes. This must come
+  // before anything is written to stdout.
+  if (!output_line_buffered) setvbuf(stdout, output_buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+}
+
+void mc_flush(void) { fflush(stdout); }
+
+void mc_sync_output(void) {
+  if (output_line_buffered) mc_flush();
+}
+
+// Writes the digits of value backwards from end, two at a time, and returns
+// the first one.
+static char* formatDigits(uint64_t value, char* end) {
+  while (value >= 100) {
+    const char* pair = DIGIT_PAIRS + value % 100 * 2;
+    value /= 100;
+    *--end = pair[1];
+    *--end = pair[0];
+  }
+  if (value >= 10) {
+    const char* pair = DIGIT_PAIRS + value * 2;
+    *--end = pair[1];
+    *--end = pair[0];
+  } else {
+    *--end = '0' + value;
+  }
+  return end;
+}
+
+void mc_print_i32(int32_t value) {
+  // Sign, 10 digits and newline.
+  char out[12];
+  uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+  char* first = formatDigits(magnitude, out + sizeof(out) - 1);
+  if (value < 0) *--first = '-';
+  out[sizeof(out) - 1] = '\n';
+  writeOutput(first, out + sizeof(out) - first);
+}
+
+void mc_print_char(int32_t value) { putchar_unlocked(value); }
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Writes the integer mantissa * 2^exponent at out, and returns its end. Only
+// numbers of 2^53 and more have an exponent, so this is rarely needed.
+static char* formatLargeInteger(uint64_t mantissa, int exponent, char* out) {
+  uint32_t limbs[MAX_F64_LIMBS];
+  int count = 0;
+  for (; mantissa; mantissa /= 1000000000) limbs[count++] = mantissa % 1000000000;
+  // Shifting by 29 bits at most keeps each limb and its carry in 64 bits.
+  while (exponent > 0) {
+    int shift = exponent < 29 ? exponent : 29;
+    uint64_t carry = 0;
+    for (int i = 0; i < count; ++i) {
+      uint64_t limb = ((uint64_t)limbs[i] << shift) + carry;
+      limbs[i] = limb % 1000000000;
+      carry = limb / 1000000000;
+    }
+    if (carry) limbs[count++] = (uint32_t)carry;
+    exponent -= shift;
+  }
+  char digits[9];
+  char* first = formatDigits(limbs[count - 1], digits + sizeof(digits));
+  memcpy(out, first, digits + sizeof(digits) - first);
+  out += digits + sizeof(digits) - first;
+  for (int i = count - 2; i >= 0; --i) {
+    memset(digits, '0', sizeof(digits));
+    formatDigits(limbs[i], digits + sizeof(digits));
+    memcpy(out, digits, sizeof(digits));
+    out += sizeof(digits);
+  }
+  return out;
+}
+
+// The same as snprintf with %f\n: the exact value of the double, rounded to 6
+// decimals, to nearest with ties to even. Returns the size.
+static size_t formatF64(double value, char* out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+  int biased_exponent = (bits >> 52) & 0x7ff;
+  char* end = out;
+  if (bits >> 63) *end++ = '-';
+  if (biased_exponent == 0x7ff) {
+    memcpy(end, mantissa ? "nan\n" : "inf\n", 4);
+    return end + 4 - out;
+  }
+  // The value is mantissa * 2^exponent.
+  if (biased_exponent) {
+    mantissa |= UINT64_C(1) << 52;
+  } else {
+    biased_exponent = 1;
+  }
+  int exponent = biased_exponent - 1075;
+
+  if (exponent >= 0) {
+    end = formatLargeInteger(mantissa, exponent, end);
+    memcpy(end, ".000000\n", 8);
+    return end + 8 - out;
+  }
+
+  int shift = -exponent;
+  uint64_t integer = shift < 64 ? mantissa >> shift : 0;
+  uint64_t fraction = shift < 64 ? mantissa & ((UINT64_C(1) << shift) - 1) : mantissa;
+  // The fraction times 10^6 is below 2^73, so past that shift it is less than
+  // half of 2^shift, and the decimals round to 0.
+  uint64_t decimals = 0;
+  if (shift <= 73) {
+    uint128_t scaled = (uint128_t)fraction * 1000000;
+    decimals = (uint64_t)(scaled >> shift);
+    uint128_t remainder = scaled - ((uint128_t)decimals << shift);
+    uint128_t half = (uint128_t)1 << (shift - 1);
+    if (remainder > half || (remainder == half && (decimals & 1))) ++decimals;
+    if (decimals == 1000000) {
+      decimals = 0;
+      ++integer;
+    }
+  }
+
+  char digits[20];
+  char* first = formatDigits(integer, digits + sizeof(digits));
+  memcpy(end, first, digits + sizeof(digits) - first);
+  end += digits + sizeof(digits) - first;
+  *end++ = '.';
+  memset(end, '0', 6);
+  formatDigits(decimals, end + 6);
+  end[6] = '\n';
+  return end + 7 - out;
+}
+#else
+// Without 128 bit integers, this is left to snprintf.
+static size_t formatF64(double value, char* out) {
+  int size = snprintf(out, MAX_F64_SIZE, "%f\n", value);
+  return size > 0 ? size : 0;
+}
+#endif
+
+void mc_print_f64(double value) {
+  char out[MAX_F64_SIZE];
+  writeOutput(out, formatF64(value, out));
+}
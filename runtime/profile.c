@@ -0,0 +1,213 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "runtime.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Deeper calls are still counted, but not timed.
+#define MAX_PROFILE_DEPTH 4096
+
+// Caller and callee pairs of the call graph. Past this many, new pairs are
+// dropped, and their number is reported.
+#define CALL_EDGES_SIZE 4096
+
+struct ProfileFrame {
+  struct mc_profile_site* site;
+  uint64_t start;
+  // Cycles spent in the supercazzole called from this one, which are not its
+  // own.
+  uint64_t children;
+};
+
+struct CallEdge {
+  struct mc_profile_site* caller;
+  struct mc_profile_site* callee;
+  uint64_t calls;
+  uint64_t cycles;
+};
+
+static struct mc_profile_site* profile_sites = NULL;
+static struct ProfileFrame profile_stack[MAX_PROFILE_DEPTH];
+static unsigned profile_depth = 0;
+static struct CallEdge call_edges[CALL_EDGES_SIZE];
+static uint64_t dropped_call_edges = 0;
+static int profile_json = 0;
+// Set by SIGUSR1. Writing the profile from the handler itself is not safe,
+// so it is left to the next call.
+static volatile sig_atomic_t profile_requested = 0;
+
+static uint64_t readCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+static struct CallEdge* findCallEdge(struct mc_profile_site* caller,
+                                     struct mc_profile_site* callee) {
+  size_t hash = ((uintptr_t)caller >> 4) * 31 + ((uintptr_t)callee >> 4);
+  for (size_t probe = 0; probe < CALL_EDGES_SIZE; ++probe) {
+    struct CallEdge* edge = &call_edges[(hash + probe) % CALL_EDGES_SIZE];
+    if (edge->callee == callee && edge->caller == caller) return edge;
+    if (!edge->callee) {
+      edge->caller = caller;
+      edge->callee = callee;
+      return edge;
+    }
+  }
+  return NULL;
+}
+
+static int compareExclusiveCycles(const void* a, const void* b) {
+  const struct mc_profile_site* left = *(struct mc_profile_site* const*)a;
+  const struct mc_profile_site* right = *(struct mc_profile_site* const*)b;
+  if (left->exclusive_cycles != right->exclusive_cycles) {
+    return left->exclusive_cycles < right->exclusive_cycles ? 1 : -1;
+  }
+  return 0;
+}
+
+static void writeTextProfile(FILE* file, struct mc_profile_site** sites, size_t sites_count) {
+  fprintf(file, "Flat profile, hottest first:\n\n%12s %20s %20s  %s\n", "calls", "inclusive",
+          "exclusive", "supercazzola");
+  for (size_t i = 0; i < sites_count; ++i) {
+    fprintf(file, "%12llu %20llu %20llu  %s\n", (unsigned long long)sites[i]->calls,
+            (unsigned long long)sites[i]->inclusive_cycles,
+            (unsigned long long)sites[i]->exclusive_cycles, sites[i]->name);
+  }
+  fprintf(file, "\nCall graph:\n\n%12s %20s  %s\n", "calls", "inclusive", "caller -> callee");
+  for (size_t i = 0; i < CALL_EDGES_SIZE; ++i) {
+    const struct CallEdge* edge = &call_edges[i];
+    if (!edge->callee) continue;
+    fprintf(file, "%12llu %20llu  %s -> %s\n", (unsigned long long)edge->calls,
+            (unsigned long long)edge->cycles, edge->caller->name, edge->callee->name);
+  }
+  if (dropped_call_edges > 0) {
+    fprintf(file, "\n%llu calls between other pairs were not recorded.\n",
+            (unsigned long long)dropped_call_edges);
+  }
+}
+
+static void writeJSONProfile(FILE* file, struct mc_profile_site** sites, size_t sites_count) {
+  fprintf(file, "{\n  \"functions\": [\n");
+  for (size_t i = 0; i < sites_count; ++i) {
+    fprintf(file,
+            "    {\"name\": \"%s\", \"calls\": %llu, \"inclusive_cycles\": %llu, "
+            "\"exclusive_cycles\": %llu}%s\n",
+            sites[i]->name, (unsigned long long)sites[i]->calls,
+            (unsigned long long)sites[i]->inclusive_cycles,
+            (unsigned long long)sites[i]->exclusive_cycles, i + 1 < sites_count ? "," : "");
+  }
+  fprintf(file, "  ],\n  \"calls\": [\n");
+  const char* separator = "";
+  for (size_t i = 0; i < CALL_EDGES_SIZE; ++i) {
+    const struct CallEdge* edge = &call_edges[i];
+    if (!edge->callee) continue;
+    fprintf(file, "%s    {\"caller\": \"%s\", \"callee\": \"%s\", \"calls\": %llu, "
+                  "\"inclusive_cycles\": %llu}",
+            separator, edge->caller->name, edge->callee->name, (unsigned long long)edge->calls,
+            (unsigned long long)edge->cycles);
+    separator = ",\n";
+  }
+  fprintf(file, "%s  ],\n  \"dropped_calls\": %llu\n}\n", *separator ? "\n" : "",
+          (unsigned long long)dropped_call_edges);
+}
+
+void mc_profile_write(void) {
+  const char* filename = getenv("MC_PROFILE_FILE");
+  if (!filename) filename = profile_json ? "profile.json" : "profile.txt";
+  FILE* file = fopen(filename, "w");
+  if (!file) return;
+
+  size_t sites_count = 0;
+  for (struct mc_profile_site* site = profile_sites; site; site = site->next) ++sites_count;
+  struct mc_profile_site** sites = malloc((sites_count + 1) * sizeof(*sites));
+  if (sites) {
+    size_t i = 0;
+    for (struct mc_profile_site* site = profile_sites; site; site = site->next) sites[i++] = site;
+    qsort(sites, sites_count, sizeof(*sites), compareExclusiveCycles);
+    if (profile_json) {
+      writeJSONProfile(file, sites, sites_count);
+    } else {
+      writeTextProfile(file, sites, sites_count);
+    }
+    free(sites);
+  }
+  fclose(file);
+}
+
+static void requestProfile(int signal_number) {
+  (void)signal_number;
+  profile_requested = 1;
+}
+
+void mc_profile_init(int32_t json) {
+  profile_json = json;
+  atexit(mc_profile_write);
+  struct sigaction action = {0};
+  action.sa_handler = requestProfile;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+void mc_profile_enter(struct mc_profile_site* site) {
+  if (profile_requested) {
+    profile_requested = 0;
+    mc_profile_write();
+  }
+  // Sites are linked the first time they are called, so that the compiler
+  // does not need to list them anywhere.
+  if (site->calls++ == 0) {
+    site->next = profile_sites;
+    profile_sites = site;
+  }
+  if (profile_depth > 0 && profile_depth <= MAX_PROFILE_DEPTH) {
+    struct CallEdge* edge = findCallEdge(profile_stack[profile_depth - 1].site, site);
+    if (edge) {
+      ++edge->calls;
+    } else {
+      ++dropped_call_edges;
+    }
+  }
+  ++site->active;
+  if (profile_depth < MAX_PROFILE_DEPTH) {
+    struct ProfileFrame* frame = &profile_stack[profile_depth];
+    frame->site = site;
+    frame->children = 0;
+    frame->start = readCycles();
+  }
+  ++profile_depth;
+}
+
+void mc_profile_exit(struct mc_profile_site* site) {
+  uint64_t end = readCycles();
+  --profile_depth;
+  --site->active;
+  if (profile_depth >= MAX_PROFILE_DEPTH) return;
+
+  struct ProfileFrame* frame = &profile_stack[profile_depth];
+  uint64_t cycles = end - frame->start;
+  site->exclusive_cycles += cycles - frame->children;
+  // Inside a recursion, the outermost call already accounts for the others.
+  if (site->active == 0) site->inclusive_cycles += cycles;
+  if (profile_depth > 0) {
+    struct ProfileFrame* caller = &profile_stack[profile_depth - 1];
+    caller->children += cycles;
+    struct CallEdge* edge = findCallEdge(caller->site, site);
+    if (edge) edge->cycles += cycles;
+  }
+}
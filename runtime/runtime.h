@@ -0,0 +1,79 @@
+#ifndef MONICELLI_RUNTIME_H
+#define MONICELLI_RUNTIME_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+// The runtime library linked into every Monicelli program, unless mcc is
+// given --libc-io without --instrument-functions or --bounds-check. The
+// compiler declares these functions on its own, see declareBuiltins() in
+// codegen.cpp, so the two must be kept in sync.
+
+#include <stdint.h>
+
+// Called by the entry point before anything is printed, to give stdout a
+// larger buffer unless it is a terminal.
+void mc_init_output(void);
+
+// Print statements. The output is the same that printf would give with the
+// formats in types.def, and goes through stdout like it.
+void mc_print_i32(int32_t value);
+void mc_print_char(int32_t value);
+void mc_print_f64(double value);
+
+// Writes out everything printed so far, like fflush(stdout). This also
+// happens at exit.
+void mc_flush(void);
+
+// Called before reading input. Like stdio, output to a terminal is flushed,
+// so that prompts show up before the program waits.
+void mc_sync_output(void);
+
+// Called by the entry point before anything is read, to give stdin a larger
+// buffer unless it is a terminal.
+void mc_init_input(void);
+
+// Input statements. Each one returns the value read from stdin, or current
+// if there is none, accepting the same input as scanf with the formats in
+// types.def. Like scanf, they go through stdin, and so stay in order with C
+// functions that read from it too. A bool is read as an int, and is true unless it is 0. Narrow
+// types are passed and returned as an int, as in C.
+int32_t mc_read_i32(int32_t current);
+int32_t mc_read_char(int32_t current);
+int32_t mc_read_bool(int32_t current);
+float mc_read_f32(float current);
+double mc_read_f64(double current);
+
+// With --bounds-check, each buffer from sbiriguda is registered when it is
+// made. A conte that a supercazzola gets from elsewhere, as a parameter or
+// from a call, is checked once to be null or a registered buffer, since only
+// those have a number of elements before the first one.
+void mc_register_buffer(void* elements);
+void mc_check_buffer(void* elements);
+
+// With --instrument-functions, each supercazzola has one of these, and calls
+// mc_profile_enter() when it starts and mc_profile_exit() right before it
+// returns, which is why no call is a tail call then. Cycles are counted with
+// rdtsc where there is one, and in nanoseconds elsewhere. The layout must
+// match getProfileSite() in codegen.cpp.
+struct mc_profile_site {
+  const char* name;
+  struct mc_profile_site* next;
+  uint64_t calls;
+  uint64_t inclusive_cycles;
+  uint64_t exclusive_cycles;
+  // How many calls to the site are in progress, for recursion.
+  uint32_t active;
+};
+
+void mc_profile_enter(struct mc_profile_site* site);
+void mc_profile_exit(struct mc_profile_site* site);
+
+// Called by the entry point before anything else. The profile is written at
+// exit, and on SIGUSR1 at the next call of an instrumented supercazzola, to
+// $MC_PROFILE_FILE or else profile.txt or profile.json in the current
+// directory.
+void mc_profile_init(int32_t json);
+void mc_profile_write(void);
+
+#endif
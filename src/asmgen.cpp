@@ -3,17 +3,30 @@
 
 #include "asmgen.h"
 #include "errors.h"
+#include "timing.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/CodeGen/ParallelCG.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Support/CodeGen.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #ifdef MONICELLI_ENABLE_LINKER
@@ -31,12 +44,17 @@ void registerTargets() {
 }
 
 llvm::TargetMachine* getTargetMachine(const std::string& triple, const std::string& cpu,
-                                      const std::string& features, bool emit_pic) {
-  std::string error;
-  auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+                                      const std::string& features, bool emit_pic,
+                                      std::string* error) {
+  std::string lookup_error;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, lookup_error);
 
   if (!target) {
-    std::cerr << "While determining target: " << error << '\n';
+    if (error) {
+      *error = "While determining target: " + lookup_error;
+      return nullptr;
+    }
+    std::cerr << "While determining target: " << lookup_error << '\n';
     exit(1);
   }
 
@@ -45,59 +63,164 @@ llvm::TargetMachine* getTargetMachine(const std::string& triple, const std::stri
   return target->createTargetMachine(triple, cpu, features, opt, reloc_model);
 }
 
-void writeAssembly(const std::string& to_filename, llvm::Module* module,
-                   llvm::TargetMachine* target_machine) {
+static std::unique_ptr<llvm::raw_fd_ostream> openOutput(const std::string& to_filename) {
   std::error_code error_code;
-  llvm::raw_fd_ostream output{to_filename, error_code, llvm::sys::fs::OF_None};
+  std::unique_ptr<llvm::raw_fd_ostream> output{
+      new llvm::raw_fd_ostream{to_filename, error_code, llvm::sys::fs::OF_None}};
 
   if (error_code) {
     std::cerr << "Could not open '" << to_filename << "' for output: " << error_code.message()
               << '\n';
     exit(1);
   }
+  return output;
+}
+
+void writeAssembly(const std::string& to_filename, llvm::Module* module,
+                   llvm::TargetMachine* target_machine, bool textual) {
+  auto output = openOutput(to_filename);
+  if (!emitAssembly(*output, module, target_machine, textual)) {
+    std::cerr << "Cannot emit " << (textual ? "assembly" : "an object file")
+              << " for this target\n";
+    exit(1);
+  }
+  output->flush();
+}
 
+bool emitAssembly(llvm::raw_pwrite_stream& output, llvm::Module* module,
+                  llvm::TargetMachine* target_machine, bool textual) {
   llvm::legacy::PassManager asm_generator;
-  auto file_type = llvm::CodeGenFileType::ObjectFile;
+  auto file_type =
+      textual ? llvm::CodeGenFileType::AssemblyFile : llvm::CodeGenFileType::ObjectFile;
 
   if (target_machine->addPassesToEmitFile(asm_generator, output, nullptr, file_type)) {
-    std::cerr << "Cannot emit an object file of this type\n";
-    exit(1);
+    return false;
   }
 
   asm_generator.run(*module);
-  output.flush();
+  return true;
 }
 
-#ifdef MONICELLI_ENABLE_LINKER
+void writeBitcode(const std::string& to_filename, llvm::Module* module) {
+  auto output = openOutput(to_filename);
+  llvm::WriteBitcodeToFile(*module, *output);
+  output->flush();
+}
 
-static const char* C_COMPILER = "c99";
+void writeIR(const std::string& to_filename, llvm::Module* module) {
+  auto output = openOutput(to_filename);
+  module->print(*output, nullptr);
+  output->flush();
+}
 
-void linkAssembly(const std::string& output_name, const std::vector<std::string>& object_files,
-                  bool keep_object_files) {
-  // Linking a C object file with certain modern libc's is so complicated that
-  // we just let a C compiler do it for us. This function assumes POSIX, and
-  // most recent POSIX-compliant systems will also adopt the recommendation
-  // to have a C compiler installed and called c99. Very old systems will have
-  // c89 instead. cc exists as well, but it's not specified by POSIX.
+bool linkBitcodeFiles(llvm::Module* module, const std::vector<std::string>& bitcode_filenames,
+                      std::string* error) {
+  auto internalize = [](llvm::Module& module, const llvm::StringSet<>& linked_names) {
+    llvm::internalizeModule(module, [&linked_names](const llvm::GlobalValue& value) {
+      return !value.hasName() || !linked_names.count(value.getName());
+    });
+  };
 
-  int cc_argc = object_files.size() + 1 + 2 + 1;
-  std::unique_ptr<const char* []> cc_args { new const char*[cc_argc] };
-  int i = 0;
-  cc_args[i++] = C_COMPILER;
-  if (!output_name.empty()) {
-    cc_args[i++] = "-o";
-    cc_args[i++] = output_name.c_str();
+  for (const auto& bitcode_filename : bitcode_filenames) {
+    // Function bodies are only read if they are linked in.
+    llvm::SMDiagnostic read_error;
+    auto library = llvm::getLazyIRFileModule(bitcode_filename, read_error, module->getContext());
+    std::string message;
+    if (!library) {
+      message = "Cannot read " + bitcode_filename + ": " + read_error.getMessage().str();
+    } else if (llvm::Linker::linkModules(*module, std::move(library),
+                                         llvm::Linker::LinkOnlyNeeded, internalize)) {
+      message = "Cannot link " + bitcode_filename + ".";
+    }
+    if (message.empty()) continue;
+    if (error) {
+      *error = std::move(message);
+      return false;
+    }
+    std::cerr << message << '\n';
+    exit(1);
   }
-  for (const auto& object_file : object_files) {
-    assert(object_file[0] != '-' && "The option parser allowed a filename starting with -");
-    cc_args[i++] = object_file.c_str();
+  return true;
+}
+
+// splitCodeGen() turns the locals that partitions share into hidden globals,
+// which keep their names. The same names come up in every file, such as those
+// of the format strings, so they are made unique to the module first, or the
+// object files of two modules could not be linked together.
+static void renameLocals(llvm::Module* module, const std::string& to_filename,
+                         llvm::StringMap<std::string>* original_names) {
+  std::string suffix = llvm::getUniqueModuleId(module);
+  if (suffix.empty()) {
+    llvm::MD5 hash;
+    hash.update(to_filename);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    suffix = "." + result.digest().str().str();
+  }
+  for (llvm::GlobalValue& value : module->global_values()) {
+    if (!value.hasLocalLinkage()) continue;
+    std::string name = value.getName().str();
+    value.setName((value.hasName() ? value.getName() : "local") + suffix);
+    if (original_names && !name.empty()) (*original_names)[value.getName()] = std::move(name);
   }
-  cc_args[i] = nullptr;
+}
+
+std::vector<std::string>
+writeAssemblyPartitions(const std::string& to_filename, llvm::Module* module, unsigned partitions,
+                        const TargetMachineFactory& make_target_machine,
+                        llvm::StringMap<std::string>* original_names) {
+  std::vector<std::string> filenames;
+  std::vector<std::unique_ptr<llvm::raw_fd_ostream>> outputs;
+  std::vector<llvm::raw_pwrite_stream*> streams;
+  for (unsigned i = 0; i < partitions; ++i) {
+    llvm::SmallString<256> filename{to_filename};
+    llvm::sys::path::replace_extension(filename, std::to_string(i) + ".o");
+    filenames.emplace_back(filename);
+    outputs.push_back(openOutput(filenames.back()));
+    streams.push_back(outputs.back().get());
+  }
+
+  // Each partition is handed to its thread as bitcode, and read back in a
+  // context of its own, so that the threads share nothing. How the module is
+  // split depends only on what is in it, which keeps the output reproducible.
+  // The target machine of each partition is made on the thread that generates
+  // it, which joins the trace there until splitCodeGen() ends its threads.
+  auto make_traced_target_machine = [&make_target_machine]() {
+    thread_local TimeTraceThread trace_thread;
+    return make_target_machine();
+  };
+  renameLocals(module, to_filename, original_names);
+  llvm::splitCodeGen(*module, streams, {}, make_traced_target_machine);
+
+  for (auto& output : outputs) output->flush();
+  return filenames;
+}
+
+#ifdef MONICELLI_ENABLE_LINKER
+
+static const char* C_COMPILER = "c99";
+
+std::string getRuntimeLibrary(const char* argv0) {
+  // Any function in mcc would do, it is just to find the executable.
+  void* address = reinterpret_cast<void*>(&getRuntimeLibrary);
+  std::string executable = llvm::sys::fs::getMainExecutable(argv0, address);
+  // Either bin/ and lib/monicelli/ once installed, or src/ and the same in
+  // the build tree.
+  llvm::SmallString<256> path{llvm::sys::path::parent_path(executable)};
+  llvm::sys::path::remove_filename(path);
+  llvm::sys::path::append(path, "lib", "monicelli", "libmonicelli-rt.a");
+  return std::string{path};
+}
+
+// Runs the C compiler with these arguments, and waits for it to finish.
+static void runCCompiler(std::vector<const char*> cc_args) {
+  cc_args.insert(cc_args.begin(), C_COMPILER);
+  cc_args.push_back(nullptr);
 
   pid_t pid = fork();
 
   if (pid == 0) {
-    if (execvp(C_COMPILER, const_cast<char* const*>(cc_args.get())) == -1) {
+    if (execvp(C_COMPILER, const_cast<char* const*>(cc_args.data())) == -1) {
       std::cerr << "Failed to launch the linker. Check that '" << C_COMPILER << "' is installed.\n";
       exit(1);
     }
@@ -110,6 +233,29 @@ void linkAssembly(const std::string& output_name, const std::vector<std::string>
   }
 
   waitpid(pid, nullptr, 0);
+}
+
+void linkAssembly(const std::string& output_name, const std::vector<std::string>& object_files,
+                  const std::string& runtime_library, bool keep_object_files) {
+  // Linking a C object file with certain modern libc's is so complicated that
+  // we just let a C compiler do it for us. This function assumes POSIX, and
+  // most recent POSIX-compliant systems will also adopt the recommendation
+  // to have a C compiler installed and called c99. Very old systems will have
+  // c89 instead. cc exists as well, but it's not specified by POSIX.
+
+  std::vector<const char*> cc_args;
+  if (!output_name.empty()) {
+    cc_args.push_back("-o");
+    cc_args.push_back(output_name.c_str());
+  }
+  for (const auto& object_file : object_files) {
+    assert(object_file[0] != '-' && "The option parser allowed a filename starting with -");
+    cc_args.push_back(object_file.c_str());
+  }
+  if (!runtime_library.empty()) {
+    cc_args.push_back(runtime_library.c_str());
+  }
+  runCCompiler(std::move(cc_args));
 
   if (keep_object_files) return;
 
@@ -118,6 +264,20 @@ void linkAssembly(const std::string& output_name, const std::vector<std::string>
   }
 }
 
+void combineObjectFiles(const std::string& output_name,
+                        const std::vector<std::string>& object_files) {
+  // -r is not POSIX, but every C compiler that drives a linker has it.
+  std::vector<const char*> cc_args = {"-r", "-o", output_name.c_str()};
+  for (const auto& object_file : object_files) {
+    cc_args.push_back(object_file.c_str());
+  }
+  runCCompiler(std::move(cc_args));
+
+  for (const auto& object_file : object_files) {
+    unlink(object_file.c_str());
+  }
+}
+
 #endif
 
 } // namespace monicelli
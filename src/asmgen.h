@@ -4,9 +4,12 @@
 // Copyright 2017 the Monicelli project authors. All rights reserved.
 // Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Target/TargetMachine.h"
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -14,15 +17,56 @@ namespace monicelli {
 
 void registerTargets();
 
+// Without an error string, a target that cannot be found ends the program.
 llvm::TargetMachine* getTargetMachine(const std::string& triple, const std::string& cpu,
-                                      const std::string& features, bool emit_pic);
+                                      const std::string& features, bool emit_pic,
+                                      std::string* error = nullptr);
 
+// Writes an object file, or assembly if textual.
 void writeAssembly(const std::string& to_filename, llvm::Module* module,
-                   llvm::TargetMachine* target_machine);
+                   llvm::TargetMachine* target_machine, bool textual = false);
+
+// Same as writeAssembly(), to a stream. Returns false if the target cannot
+// emit the file.
+bool emitAssembly(llvm::raw_pwrite_stream& output, llvm::Module* module,
+                  llvm::TargetMachine* target_machine, bool textual = false);
+
+void writeBitcode(const std::string& to_filename, llvm::Module* module);
+void writeIR(const std::string& to_filename, llvm::Module* module);
+
+// Links into the module whatever it uses from each bitcode file in turn, like
+// a static library. What is linked in becomes internal to the module, so that
+// each module that uses a function gets its own copy to optimize. Without an
+// error string, a file that cannot be read or linked ends the program.
+bool linkBitcodeFiles(llvm::Module* module, const std::vector<std::string>& bitcode_filenames,
+                      std::string* error = nullptr);
+
+typedef std::function<std::unique_ptr<llvm::TargetMachine>()> TargetMachineFactory;
+
+// Splits the module in partitions, and writes the object file of each on a
+// thread of its own, with a target machine of its own. Returns the names of
+// the object files, which are those of to_filename with the number of the
+// partition before the extension. The same module split in the same number
+// of partitions always gives the same object files. Local functions and
+// variables are renamed on the way, and original_names, if given, maps each
+// new name to the old one.
+std::vector<std::string>
+writeAssemblyPartitions(const std::string& to_filename, llvm::Module* module, unsigned partitions,
+                        const TargetMachineFactory& make_target_machine,
+                        llvm::StringMap<std::string>* original_names = nullptr);
 
 #ifdef MONICELLI_ENABLE_LINKER
+// Returns the path of the runtime library for the mcc that is running, which
+// was found with argv0.
+std::string getRuntimeLibrary(const char* argv0);
+
+// The runtime library is linked in after the object files, unless it is empty.
 void linkAssembly(const std::string& output_name, const std::vector<std::string>& object_files,
-                  bool keep_object_files = false);
+                  const std::string& runtime_library, bool keep_object_files = false);
+
+// Combines the object files into a single relocatable one, and removes them.
+void combineObjectFiles(const std::string& output_name,
+                        const std::vector<std::string>& object_files);
 #endif
 
 } // namespace monicelli
@@ -0,0 +1,641 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "ast-cache.h"
+#include "ast-visitor.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The cache is laid out as follows:
+//
+//   Header
+//   StringEntry[strings_count]
+//   string data
+//   nodes
+//
+// Strings are interned, and nodes refer to them by their index in the table.
+// Nodes are written in pre-order, each statement and expression starting with
+// its AstNode::ClassType, and each list with the number of its elements.
+// All integers are in the byte order of the machine which wrote the cache,
+// which is fine since the cache is not meant to be moved around.
+
+namespace monicelli {
+
+// Bump whenever the layout or the AST built by the parser changes.
+static const uint32_t AST_CACHE_VERSION = 2;
+static const char AST_CACHE_MAGIC[8] = {'M', 'C', 'C', 'A', 'S', 'T', '\n', '\0'};
+static const uint32_t AST_CACHE_BYTE_ORDER = 0x01020304;
+
+namespace {
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint32_t strings_count;
+  uint32_t strings_size;
+  uint64_t nodes_size;
+};
+
+struct StringEntry {
+  // From the start of the string data.
+  uint32_t offset;
+  uint32_t size;
+};
+
+enum {
+#define COUNT_OPERATOR(_1, NAME, _2, _3) OPERATOR_##NAME,
+  AST_BINARY_OPERATORS(COUNT_OPERATOR)
+#undef COUNT_OPERATOR
+  BINARY_OPERATORS_COUNT
+};
+
+enum {
+#define COUNT_TYPE(NAME, _1, _2, _3, _4, _5) BASE_TYPE_##NAME,
+  BUILTIN_TYPES(COUNT_TYPE)
+#undef COUNT_TYPE
+  BASE_TYPES_COUNT
+};
+
+// Thrown when the cache does not make sense, which is treated as a miss.
+class CorruptCache final {};
+
+template<typename Range> uint32_t countElements(const Range& range) {
+  uint32_t count = 0;
+  for (auto i = range.begin(), end = range.end(); i != end; ++i) ++count;
+  return count;
+}
+
+class AstCacheWriter final : public ConstAstVisitor<AstCacheWriter, void> {
+public:
+  // Returns false if the module is too large for the format.
+  bool write(llvm::raw_ostream& stream, const SourceDigest& digest, const Module* ast);
+
+  void visitModule(const Module* m);
+  void visitFunction(const Function* f);
+  void visitAssertStatement(const AssertStatement* s) {
+    writeTag(s);
+    visit(s->getExpression());
+  }
+  void visitExpressionStatement(const ExpressionStatement* s) {
+    writeTag(s);
+    visit(s->getExpression());
+  }
+  void visitInputStatement(const InputStatement* s) {
+    writeTag(s);
+    writeVariable(s->getVariable());
+  }
+  void visitAbortStatement(const AbortStatement* s) { writeTag(s); }
+  void visitBranchStatement(const BranchStatement* s);
+  void visitVardeclStatement(const VardeclStatement* s);
+  void visitLoopStatement(const LoopStatement* s) {
+    writeTag(s);
+    writeBody(s->body());
+    visit(s->getCondition());
+  }
+  void visitReturnStatement(const ReturnStatement* s) {
+    writeTag(s);
+    writeInt<uint8_t>(s->hasExpression());
+    if (s->hasExpression()) visit(s->getExpression());
+  }
+  void visitPrintStatement(const PrintStatement* s) {
+    writeTag(s);
+    visit(s->getExpression());
+  }
+  void visitAssignStatement(const AssignStatement* s) {
+    writeTag(s);
+    writeVariable(s->getVariable());
+    visit(s->getExpression());
+  }
+  void visitElementAssignStatement(const ElementAssignStatement* s) {
+    writeTag(s);
+    visit(s->getTarget());
+    visit(s->getExpression());
+  }
+  void visitFunctionCallExpression(const FunctionCallExpression* e);
+  void visitBinaryExpression(const BinaryExpression* e);
+  void visitAtomicExpression(const AtomicExpression* e);
+  void visitIndexExpression(const IndexExpression* e) {
+    writeTag(e);
+    writeLocations(*e);
+    visit(e->getPointer());
+    visit(e->getIndex());
+  }
+  void visitAllocExpression(const AllocExpression* e) {
+    writeTag(e);
+    writeLocations(*e);
+    writeInt<uint8_t>(e->getElementType());
+    visit(e->getCount());
+  }
+
+private:
+  template<typename T> void writeInt(T value) {
+    nodes_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void writeTag(const AstNode* node) { writeInt<uint8_t>(node->getClassType()); }
+  void writeString(const std::string& string);
+  void writeLocations(const LocationMixin& node);
+  void writeVariable(const Variable& variable) {
+    writeString(variable.getName());
+    writeLocations(variable);
+  }
+  void writeType(const VarType& type) {
+    writeInt<uint8_t>(type.getBaseType());
+    writeInt<uint8_t>(type.isPointer());
+  }
+  template<typename Range> void writeBody(const Range& body) {
+    writeInt<uint32_t>(countElements(body));
+    for (const Statement* s : body) visit(s);
+  }
+
+  llvm::StringMap<uint32_t> string_ids_;
+  std::vector<StringEntry> string_entries_;
+  std::string string_data_;
+  std::string nodes_;
+};
+
+} // namespace
+
+// Needs to be outside of the anonymous namespace, to be a friend of the AST.
+class AstCacheReader final {
+public:
+  AstCacheReader(llvm::StringRef nodes, std::vector<llvm::StringRef> strings)
+      : cursor_(nodes.begin()), end_(nodes.end()), strings_(std::move(strings)) {}
+
+  std::unique_ptr<Module> readModule(const std::string& source_filename);
+
+  bool isAtEnd() const { return cursor_ == end_; }
+
+private:
+  template<typename T> T readInt() {
+    if (static_cast<size_t>(end_ - cursor_) < sizeof(T)) throw CorruptCache{};
+    T value;
+    memcpy(&value, cursor_, sizeof(value));
+    cursor_ += sizeof(value);
+    return value;
+  }
+
+  // Every element takes at least a byte, which bounds how many there can be.
+  uint32_t readCount() {
+    auto count = readInt<uint32_t>();
+    if (count > static_cast<size_t>(end_ - cursor_)) throw CorruptCache{};
+    return count;
+  }
+
+  bool readBool() { return readInt<uint8_t>() != 0; }
+  AstNode::ClassType readTag() { return static_cast<AstNode::ClassType>(readInt<uint8_t>()); }
+
+  std::string readString() {
+    auto id = readInt<uint32_t>();
+    if (id >= strings_.size()) throw CorruptCache{};
+    return strings_[id].str();
+  }
+
+  Location readLocation() {
+    int line = readInt<int32_t>();
+    int column = readInt<int32_t>();
+    return {line, column};
+  }
+
+  template<typename Locatable> void readLocations(Locatable* node) {
+    node->first_location_ = readLocation();
+    node->last_location_ = readLocation();
+  }
+
+  Variable readVariable() {
+    Variable variable;
+    variable.name_ = readString();
+    readLocations(&variable);
+    return variable;
+  }
+
+  VarType readType() {
+    VarType type;
+    auto base_type = readInt<uint8_t>();
+    if (base_type >= BASE_TYPES_COUNT) throw CorruptCache{};
+    type.base_type_ = static_cast<VarType::BaseType>(base_type);
+    type.pointer_ = readBool();
+    return type;
+  }
+
+  std::unique_ptr<Function> readFunction();
+  std::vector<std::unique_ptr<Statement>> readBody();
+  std::unique_ptr<Statement> readStatement();
+  std::unique_ptr<BranchStatement> readBranchStatement();
+  // The lead expression is the left side of the semi-expressions of the
+  // branch being read, shared among all its cases as in the parser.
+  std::unique_ptr<Expression> readExpression(const std::shared_ptr<Expression>& lead = nullptr);
+
+  const char* cursor_;
+  const char* end_;
+  std::vector<llvm::StringRef> strings_;
+};
+
+bool AstCacheWriter::write(llvm::raw_ostream& stream, const SourceDigest& digest,
+                           const Module* ast) {
+  visit(ast);
+  if (string_data_.size() > UINT32_MAX) return false;
+
+  Header header;
+  memcpy(header.magic, AST_CACHE_MAGIC, sizeof(header.magic));
+  header.version = AST_CACHE_VERSION;
+  header.byte_order = AST_CACHE_BYTE_ORDER;
+  header.source_hash = digest.hash;
+  header.source_size = digest.size;
+  header.strings_count = string_entries_.size();
+  header.strings_size = string_data_.size();
+  header.nodes_size = nodes_.size();
+
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(reinterpret_cast<const char*>(string_entries_.data()),
+               string_entries_.size() * sizeof(StringEntry));
+  stream << string_data_ << nodes_;
+  return true;
+}
+
+void AstCacheWriter::writeString(const std::string& string) {
+  auto inserted = string_ids_.insert({string, string_entries_.size()});
+  if (inserted.second) {
+    string_entries_.push_back(
+        {static_cast<uint32_t>(string_data_.size()), static_cast<uint32_t>(string.size())});
+    string_data_ += string;
+  }
+  writeInt<uint32_t>(inserted.first->second);
+}
+
+void AstCacheWriter::writeLocations(const LocationMixin& node) {
+  writeInt<int32_t>(node.getFirstLocation().getLine());
+  writeInt<int32_t>(node.getFirstLocation().getColumn());
+  writeInt<int32_t>(node.getLastLocation().getLine());
+  writeInt<int32_t>(node.getLastLocation().getColumn());
+}
+
+void AstCacheWriter::visitModule(const Module* m) {
+  writeInt<uint32_t>(countElements(m->functions()));
+  for (const Function* f : m->functions()) visit(f);
+  writeInt<uint8_t>(m->hasEntryPoint());
+  if (m->hasEntryPoint()) visit(m->getEntryPoint());
+}
+
+void AstCacheWriter::visitFunction(const Function* f) {
+  writeString(f->getName());
+  writeLocations(*f);
+  writeType(f->getReturnType());
+  writeInt<uint32_t>(f->params_size());
+  for (const FunctionParam& param : f->params()) {
+    writeVariable(param.getArg());
+    writeType(param.getType());
+  }
+  writeBody(f->body());
+}
+
+void AstCacheWriter::visitBranchStatement(const BranchStatement* s) {
+  writeTag(s);
+  writeVariable(s->getLeadVariable());
+  writeInt<uint32_t>(countElements(s->cases()));
+  for (const BranchCase& c : s->cases()) {
+    visit(c.getExpression());
+    writeBody(c.body());
+  }
+  writeInt<uint8_t>(s->hasBranchElse());
+  if (s->hasBranchElse()) writeBody(s->getBranchElse()->body());
+}
+
+void AstCacheWriter::visitVardeclStatement(const VardeclStatement* s) {
+  writeTag(s);
+  writeVariable(s->getVariable());
+  writeType(s->getType());
+  writeInt<uint8_t>(s->hasInitializer());
+  if (s->hasInitializer()) visit(s->getInitializer());
+}
+
+void AstCacheWriter::visitFunctionCallExpression(const FunctionCallExpression* e) {
+  writeTag(e);
+  writeLocations(*e);
+  writeString(e->getFunctionName());
+  writeInt<uint32_t>(countElements(e->args()));
+  for (const Expression* arg : e->args()) visit(arg);
+}
+
+void AstCacheWriter::visitBinaryExpression(const BinaryExpression* e) {
+  writeTag(e);
+  writeLocations(*e);
+  writeInt<uint8_t>(e->getType());
+  writeInt<uint8_t>(e->isSemiExpression());
+  // The left side of a semi-expression is the lead variable of the branch.
+  if (!e->isSemiExpression()) visit(e->getLeft());
+  visit(e->getRight());
+}
+
+void AstCacheWriter::visitAtomicExpression(const AtomicExpression* e) {
+  writeTag(e);
+  writeLocations(*e);
+  writeInt<uint8_t>(e->getType());
+  switch (e->getType()) {
+  case AtomicExpression::INTEGER:
+    writeInt<uint64_t>(e->getIntValue());
+    break;
+  case AtomicExpression::FLOAT:
+    writeInt<double>(e->getFloatValue());
+    break;
+  case AtomicExpression::IDENTIFIER:
+    writeVariable(e->getIdentifierValue());
+    break;
+  }
+}
+
+std::unique_ptr<Module> AstCacheReader::readModule(const std::string& source_filename) {
+  std::unique_ptr<Module> module{new Module};
+  for (uint32_t i = 0, count = readCount(); i < count; ++i) {
+    module->functions_.emplace_back(readFunction());
+  }
+  if (readBool()) module->maybe_entry_point_ = readFunction();
+  module->source_filename_ = source_filename;
+  return module;
+}
+
+std::unique_ptr<Function> AstCacheReader::readFunction() {
+  std::unique_ptr<Function> function{new Function};
+  function->name_ = readString();
+  readLocations(function.get());
+  function->return_type_ = readType();
+  for (uint32_t i = 0, count = readCount(); i < count; ++i) {
+    auto variable = readVariable();
+    auto type = readType();
+    function->params_.emplace_back(variable, type);
+  }
+  function->body_ = readBody();
+  return function;
+}
+
+std::vector<std::unique_ptr<Statement>> AstCacheReader::readBody() {
+  std::vector<std::unique_ptr<Statement>> body;
+  uint32_t count = readCount();
+  body.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) body.emplace_back(readStatement());
+  return body;
+}
+
+std::unique_ptr<Statement> AstCacheReader::readStatement() {
+  switch (readTag()) {
+  case AstNode::TYPE_AssertStatement: {
+    std::unique_ptr<AssertStatement> statement{new AssertStatement};
+    statement->expression_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_ExpressionStatement: {
+    std::unique_ptr<ExpressionStatement> statement{new ExpressionStatement};
+    statement->expression_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_InputStatement: {
+    std::unique_ptr<InputStatement> statement{new InputStatement};
+    statement->variable_ = readVariable();
+    return statement;
+  }
+  case AstNode::TYPE_AbortStatement:
+    return std::unique_ptr<AbortStatement>{new AbortStatement};
+  case AstNode::TYPE_BranchStatement:
+    return readBranchStatement();
+  case AstNode::TYPE_VardeclStatement: {
+    std::unique_ptr<VardeclStatement> statement{new VardeclStatement};
+    statement->variable_ = readVariable();
+    statement->type_ = readType();
+    if (readBool()) statement->maybe_init_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_LoopStatement: {
+    std::unique_ptr<LoopStatement> statement{new LoopStatement};
+    statement->body_ = readBody();
+    statement->condition_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_ReturnStatement: {
+    std::unique_ptr<ReturnStatement> statement{new ReturnStatement};
+    if (readBool()) statement->maybe_expression_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_PrintStatement: {
+    std::unique_ptr<PrintStatement> statement{new PrintStatement};
+    statement->expression_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_AssignStatement: {
+    std::unique_ptr<AssignStatement> statement{new AssignStatement};
+    statement->variable_ = readVariable();
+    statement->expression_ = readExpression();
+    return statement;
+  }
+  case AstNode::TYPE_ElementAssignStatement: {
+    std::unique_ptr<ElementAssignStatement> statement{new ElementAssignStatement};
+    auto target = readExpression();
+    if (target->getClassType() != AstNode::TYPE_IndexExpression) throw CorruptCache{};
+    statement->target_.reset(static_cast<IndexExpression*>(target.release()));
+    statement->expression_ = readExpression();
+    return statement;
+  }
+  default:
+    throw CorruptCache{};
+  }
+}
+
+std::unique_ptr<BranchStatement> AstCacheReader::readBranchStatement() {
+  std::unique_ptr<BranchStatement> statement{new BranchStatement};
+  statement->lead_var_ = readVariable();
+  std::shared_ptr<Expression> lead{
+      AtomicExpression::fromIdentifier(statement->lead_var_).release()};
+  uint32_t count = readCount();
+  statement->cases_.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    BranchCase branch_case;
+    branch_case.expression_ = readExpression(lead);
+    branch_case.body_ = readBody();
+    statement->cases_.emplace_back(std::move(branch_case));
+  }
+  if (readBool()) {
+    statement->maybe_else_case_.reset(new BranchElse);
+    statement->maybe_else_case_->body_ = readBody();
+  }
+  return statement;
+}
+
+std::unique_ptr<Expression> AstCacheReader::readExpression(
+    const std::shared_ptr<Expression>& lead) {
+  auto tag = readTag();
+  Location first_location = readLocation();
+  Location last_location = readLocation();
+
+  std::unique_ptr<Expression> expression;
+  switch (tag) {
+  case AstNode::TYPE_FunctionCallExpression: {
+    std::unique_ptr<FunctionCallExpression> call{new FunctionCallExpression};
+    call->function_name_ = readString();
+    for (uint32_t i = 0, count = readCount(); i < count; ++i) {
+      call->function_args_.emplace_back(readExpression());
+    }
+    expression = std::move(call);
+    break;
+  }
+  case AstNode::TYPE_BinaryExpression: {
+    auto type = readInt<uint8_t>();
+    if (type >= BINARY_OPERATORS_COUNT) throw CorruptCache{};
+    bool is_semi = readBool();
+    // Semi-expressions only appear as the condition of a branch case.
+    if (is_semi && !lead) throw CorruptCache{};
+    std::shared_ptr<Expression> left =
+        is_semi ? lead : std::shared_ptr<Expression>{readExpression()};
+    auto right = readExpression();
+    expression.reset(new BinaryExpression{static_cast<BinaryExpression::Type>(type), left,
+                                          right.release(), is_semi});
+    break;
+  }
+  case AstNode::TYPE_AtomicExpression:
+    switch (readInt<uint8_t>()) {
+    case AtomicExpression::INTEGER:
+      expression = AtomicExpression::fromInt(readInt<uint64_t>());
+      break;
+    case AtomicExpression::FLOAT:
+      expression = AtomicExpression::fromFloat(readInt<double>());
+      break;
+    case AtomicExpression::IDENTIFIER:
+      expression = AtomicExpression::fromIdentifier(readVariable());
+      break;
+    default:
+      throw CorruptCache{};
+    }
+    break;
+  case AstNode::TYPE_IndexExpression: {
+    std::unique_ptr<IndexExpression> index{new IndexExpression};
+    index->pointer_ = readExpression();
+    index->index_ = readExpression();
+    expression = std::move(index);
+    break;
+  }
+  case AstNode::TYPE_AllocExpression: {
+    std::unique_ptr<AllocExpression> alloc{new AllocExpression};
+    auto element_type = readInt<uint8_t>();
+    if (element_type == BASE_TYPE_VOID || element_type >= BASE_TYPES_COUNT) throw CorruptCache{};
+    alloc->element_type_ = static_cast<VarType::BaseType>(element_type);
+    alloc->count_ = readExpression();
+    expression = std::move(alloc);
+    break;
+  }
+  default:
+    throw CorruptCache{};
+  }
+
+  expression->first_location_ = first_location;
+  expression->last_location_ = last_location;
+  return expression;
+}
+
+bool computeSourceDigest(const std::string& source_filename, SourceDigest* digest) {
+  auto buffer = llvm::MemoryBuffer::getFile(source_filename, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!buffer) return false;
+  digest->hash = llvm::xxHash64((*buffer)->getBuffer());
+  digest->size = (*buffer)->getBufferSize();
+  return true;
+}
+
+std::string getAstCacheFilename(const std::string& source_filename, const std::string& cache_dir) {
+  if (cache_dir.empty()) return source_filename + ".ast";
+  // Sources with the same name in different directories must not collide.
+  llvm::SmallString<256> absolute_filename{source_filename};
+  llvm::sys::fs::make_absolute(absolute_filename);
+  llvm::SmallString<256> cache_filename{cache_dir};
+  llvm::sys::path::append(cache_filename, llvm::sys::path::filename(source_filename) + "-" +
+                                              llvm::utohexstr(llvm::xxHash64(absolute_filename)) +
+                                              ".ast");
+  return cache_filename.str().str();
+}
+
+std::unique_ptr<Module> loadAstCache(const std::string& cache_filename,
+                                     const std::string& source_filename,
+                                     const SourceDigest& digest) {
+  // Large files are mapped rather than read.
+  auto buffer = llvm::MemoryBuffer::getFile(cache_filename, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!buffer) return nullptr;
+  llvm::StringRef data = (*buffer)->getBuffer();
+
+  Header header;
+  if (data.size() < sizeof(header)) return nullptr;
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, AST_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != AST_CACHE_VERSION || header.byte_order != AST_CACHE_BYTE_ORDER) {
+    return nullptr;
+  }
+  if (header.source_hash != digest.hash || header.source_size != digest.size) return nullptr;
+
+  uint64_t entries_size = uint64_t{header.strings_count} * sizeof(StringEntry);
+  if (data.size() - sizeof(header) != entries_size + header.strings_size + header.nodes_size) {
+    return nullptr;
+  }
+  const char* entries = data.data() + sizeof(header);
+  llvm::StringRef string_data = data.substr(sizeof(header) + entries_size, header.strings_size);
+  llvm::StringRef nodes = data.substr(sizeof(header) + entries_size + header.strings_size);
+
+  // Strings point into the cache, and are only copied when building the AST.
+  std::vector<llvm::StringRef> strings;
+  strings.reserve(header.strings_count);
+  for (uint32_t i = 0; i < header.strings_count; ++i) {
+    StringEntry entry;
+    memcpy(&entry, entries + i * sizeof(StringEntry), sizeof(entry));
+    if (uint64_t{entry.offset} + entry.size > string_data.size()) return nullptr;
+    strings.push_back(string_data.substr(entry.offset, entry.size));
+  }
+
+  AstCacheReader reader{nodes, std::move(strings)};
+  try {
+    auto module = reader.readModule(source_filename);
+    if (!reader.isAtEnd()) return nullptr;
+    return module;
+  } catch (const CorruptCache&) {
+    return nullptr;
+  }
+}
+
+void saveAstCache(const std::string& cache_filename, const SourceDigest& digest,
+                  const Module* ast) {
+  llvm::StringRef cache_dir = llvm::sys::path::parent_path(cache_filename);
+  if (!cache_dir.empty() && llvm::sys::fs::create_directories(cache_dir)) return;
+
+  // Written aside and then moved in place, so that a concurrent compilation
+  // never sees half of it.
+  int fd;
+  llvm::SmallString<256> temporary_filename;
+  if (llvm::sys::fs::createUniqueFile(cache_filename + "-%%%%%%.tmp", fd, temporary_filename)) {
+    return;
+  }
+  bool written;
+  {
+    llvm::raw_fd_ostream stream{fd, /*shouldClose=*/true};
+    AstCacheWriter writer;
+    written = writer.write(stream, digest, ast);
+    stream.close();
+    if (stream.has_error()) {
+      stream.clear_error();
+      written = false;
+    }
+  }
+  if (!written || llvm::sys::fs::rename(temporary_filename, cache_filename)) {
+    llvm::sys::fs::remove(temporary_filename);
+  }
+}
+
+} // namespace monicelli
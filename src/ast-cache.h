@@ -0,0 +1,40 @@
+#ifndef MONICELLI_AST_CACHE_H
+#define MONICELLI_AST_CACHE_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace monicelli {
+
+class Module;
+
+// Identifies the contents of a source file.
+struct SourceDigest {
+  uint64_t hash;
+  uint64_t size;
+};
+
+// Returns false if the source file cannot be read.
+bool computeSourceDigest(const std::string& source_filename, SourceDigest* digest);
+
+// The cache goes next to the source file, unless a directory is given.
+std::string getAstCacheFilename(const std::string& source_filename, const std::string& cache_dir);
+
+// Returns nullptr if there is no cache, or if it was made by another version
+// of the compiler or for another version of the source. Otherwise, the AST is
+// the same that the parser would have built.
+std::unique_ptr<Module> loadAstCache(const std::string& cache_filename,
+                                     const std::string& source_filename,
+                                     const SourceDigest& digest);
+
+// Failing to write the cache is not an error, it will just miss next time.
+void saveAstCache(const std::string& cache_filename, const SourceDigest& digest,
+                  const Module* ast);
+
+} // namespace monicelli
+
+#endif
@@ -166,6 +166,29 @@ public:
     visit(s->getExpression());
   }
 
+  void visitElementAssignStatement(const ElementAssignStatement* s) {
+    ExpressionNestingGuard guard{this};
+    stream();
+    visit(s->getTarget());
+    stream(false) << " = ";
+    visit(s->getExpression());
+  }
+
+  void visitIndexExpression(const IndexExpression* s) {
+    ExpressionNestingGuard guard{this};
+    visit(s->getPointer());
+    stream(false) << '[';
+    visit(s->getIndex());
+    stream(false) << ']';
+  }
+
+  void visitAllocExpression(const AllocExpression* s) {
+    ExpressionNestingGuard guard{this};
+    stream(false) << "new " << baseTypeToString(s->getElementType()) << '[';
+    visit(s->getCount());
+    stream(false) << ']';
+  }
+
   void visitAtomicExpression(const AtomicExpression* s) {
     ExpressionNestingGuard guard{this};
     switch (s->getType()) {
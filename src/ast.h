@@ -23,6 +23,8 @@ private:
   std::string name_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class VarType final {
@@ -44,6 +46,8 @@ private:
   bool pointer_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class FunctionParam final {
@@ -58,6 +62,8 @@ private:
   VarType type_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class AstNode {
@@ -113,6 +119,8 @@ private:
   std::unique_ptr<Expression> right_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class AtomicExpression final : public Expression {
@@ -174,6 +182,44 @@ private:
   };
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
+};
+
+// The element at an index of the buffer that a conte points to, counting from
+// 0. The index binds tighter than any operator, and can itself be indexed.
+class IndexExpression final : public Expression {
+public:
+  IndexExpression() : Expression(Expression::TYPE_IndexExpression) {}
+
+  const Expression* getPointer() const { return pointer_.get(); }
+  const Expression* getIndex() const { return index_.get(); }
+
+private:
+  std::unique_ptr<Expression> pointer_;
+  std::unique_ptr<Expression> index_;
+
+  friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
+};
+
+// A new buffer of a number of elements of a builtin type, all zero, and a
+// conte of that type pointing to its first element.
+class AllocExpression final : public Expression {
+public:
+  AllocExpression() : Expression(Expression::TYPE_AllocExpression) {}
+
+  VarType::BaseType getElementType() const { return element_type_; }
+  const Expression* getCount() const { return count_.get(); }
+
+private:
+  VarType::BaseType element_type_;
+  std::unique_ptr<Expression> count_;
+
+  friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class Statement : public AstNode {
@@ -193,6 +239,8 @@ private:
   std::unique_ptr<Expression> expression_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class FunctionCallExpression final : public Expression {
@@ -205,12 +253,15 @@ public:
   FunctionArgsConstIter args_begin() const { return function_args_.cbegin(); }
   FunctionArgsConstIter args_end() const { return function_args_.cend(); }
   ConstRangeWrapper<FunctionArgsConstIter> args() const { return {args_begin(), args_end()}; }
+  int args_size() const { return function_args_.size(); }
 
 private:
   std::string function_name_;
   std::vector<std::unique_ptr<Expression>> function_args_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class ExpressionStatement final : public Statement {
@@ -223,6 +274,8 @@ private:
   std::unique_ptr<Expression> expression_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class InputStatement final : public Statement {
@@ -235,6 +288,8 @@ private:
   Variable variable_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class AbortStatement final : public Statement {
@@ -243,6 +298,8 @@ public:
 
 private:
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class BranchCase final {
@@ -259,6 +316,8 @@ private:
   std::vector<std::unique_ptr<Statement>> body_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class BranchElse final {
@@ -273,6 +332,8 @@ private:
   std::vector<std::unique_ptr<Statement>> body_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class BranchStatement final : public Statement {
@@ -299,6 +360,8 @@ private:
   std::unique_ptr<BranchElse> maybe_else_case_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class VardeclStatement final : public Statement {
@@ -320,6 +383,8 @@ private:
   std::unique_ptr<Expression> maybe_init_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class LoopStatement final : public Statement {
@@ -339,6 +404,8 @@ private:
   std::unique_ptr<Expression> condition_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class ReturnStatement final : public Statement {
@@ -355,6 +422,8 @@ private:
   std::unique_ptr<Expression> maybe_expression_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class PrintStatement final : public Statement {
@@ -367,6 +436,8 @@ private:
   std::unique_ptr<Expression> expression_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class AssignStatement final : public Statement {
@@ -381,9 +452,29 @@ private:
   Variable variable_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
+};
+
+class ElementAssignStatement final : public Statement {
+public:
+  ElementAssignStatement() : Statement(Statement::TYPE_ElementAssignStatement) {}
+
+  const IndexExpression* getTarget() const { return target_.get(); }
+  const Expression* getExpression() const { return expression_.get(); }
+
+private:
+  std::unique_ptr<IndexExpression> target_;
+  std::unique_ptr<Expression> expression_;
+
+  friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
-class Function final : public AstNode {
+// The location of a function is that of its name, or of the entry point
+// declaration for the entry point.
+class Function final : public AstNode, public LocationMixin {
 public:
   Function() : AstNode(Statement::TYPE_Function) {}
 
@@ -413,6 +504,8 @@ private:
   std::vector<std::unique_ptr<Statement>> body_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 class Module final : public AstNode {
@@ -441,6 +534,8 @@ private:
   std::string source_filename_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 } // namespace monicelli
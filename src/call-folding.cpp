@@ -0,0 +1,672 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "call-folding.h"
+#include "ast.h"
+#include "errors.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Calls are evaluated as the IR built for them by the IR generator would run,
+// down to the width of integers and the rounding of floats. Wherever that IR
+// would have undefined behavior, such as a division by zero or a read of a
+// variable that was never assigned, evaluation gives up and the call is left
+// to run as usual.
+
+namespace monicelli {
+
+namespace {
+
+// Evaluating a call gives up after this many statements and expressions, and
+// evaluating all the calls of a module after the second limit.
+const int64_t MAX_STEPS_PER_CALL = 1000000;
+const int64_t MAX_STEPS_PER_MODULE = 20000000;
+// Each nested call takes some native stack.
+const int MAX_CALL_DEPTH = 256;
+
+// Thrown when a call cannot be evaluated at compile time.
+class CannotEvaluate final {};
+
+bool isInteger(VarType::BaseType type) {
+  return type == VarType::INTEGER || type == VarType::CHAR || type == VarType::BOOL;
+}
+
+int getIntegerWidth(VarType::BaseType type) {
+  switch (type) {
+  case VarType::INTEGER:
+    return 32;
+  case VarType::CHAR:
+    return 8;
+  case VarType::BOOL:
+    return 1;
+  default:
+    UNREACHABLE("Not an integer type");
+  }
+}
+
+// Wraps an integer around to the given width, sign extending it.
+int64_t wrapInteger(uint64_t value, int width) {
+  uint64_t sign = uint64_t{1} << (width - 1);
+  uint64_t mask = (sign << 1) - 1;
+  return static_cast<int64_t>(((value & mask) ^ sign) - sign);
+}
+
+// A value of one of the builtin types. Integers are sign extended from their
+// width, as the IR generator extends them, and Perozzi values are kept rounded
+// to float.
+struct Value {
+  VarType::BaseType type;
+  int64_t integer;
+  double real;
+};
+
+Value makeInteger(VarType::BaseType type, uint64_t value) {
+  return {type, wrapInteger(value, getIntegerWidth(type)), 0};
+}
+
+Value makeReal(VarType::BaseType type, double value) {
+  return {type, 0, type == VarType::FLOAT ? static_cast<float>(value) : value};
+}
+
+// Comparisons give an i1, which is -1 when true once sign extended.
+Value makeBool(bool value) { return makeInteger(VarType::BOOL, value); }
+
+// The same conversions as ensureType() in the IR generator.
+Value convert(const Value& value, VarType::BaseType type) {
+  if (value.type == VarType::VOID || type == VarType::VOID) throw CannotEvaluate{};
+  if (isInteger(type)) {
+    if (isInteger(value.type)) return makeInteger(type, value.integer);
+    // Out of range values, NaN included, would be poison.
+    double truncated = std::trunc(value.real);
+    double min = -std::ldexp(1.0, getIntegerWidth(type) - 1);
+    if (!(truncated >= min && truncated < -min)) throw CannotEvaluate{};
+    return makeInteger(type, static_cast<int64_t>(truncated));
+  }
+  if (!isInteger(value.type)) return makeReal(type, value.real);
+  if (type == VarType::FLOAT) return makeReal(type, static_cast<float>(value.integer));
+  return makeReal(type, static_cast<double>(value.integer));
+}
+
+// The same as ResultTypeCalculator in the IR generator.
+VarType::BaseType getResultType(VarType::BaseType left, VarType::BaseType right) {
+  if (left == right) return left;
+  if (!isInteger(left) || !isInteger(right)) return VarType::DOUBLE;
+  return getIntegerWidth(left) > getIntegerWidth(right) ? left : right;
+}
+
+Value evalIntegerOperation(BinaryExpression::Type op, VarType::BaseType type, int64_t left,
+                           int64_t right) {
+  int width = getIntegerWidth(type);
+  uint64_t unsigned_left = left;
+  uint64_t unsigned_right = right;
+  switch (op) {
+  case BinaryExpression::PLUS:
+    return makeInteger(type, unsigned_left + unsigned_right);
+  case BinaryExpression::MINUS:
+    return makeInteger(type, unsigned_left - unsigned_right);
+  case BinaryExpression::TIMES:
+    return makeInteger(type, unsigned_left * unsigned_right);
+  case BinaryExpression::DIV:
+    // Both of these are undefined behavior for sdiv.
+    if (right == 0 || (right == -1 && left == wrapInteger(uint64_t{1} << (width - 1), width))) {
+      throw CannotEvaluate{};
+    }
+    return makeInteger(type, left / right);
+  case BinaryExpression::SHL:
+  case BinaryExpression::SHR: {
+    // Shifting by the width or more gives poison.
+    uint64_t amount = unsigned_right & ((uint64_t{1} << width) - 1);
+    if (amount >= static_cast<uint64_t>(width)) throw CannotEvaluate{};
+    if (op == BinaryExpression::SHL) return makeInteger(type, unsigned_left << amount);
+    return makeInteger(type, left >> amount);
+  }
+  case BinaryExpression::EQ:
+    return makeBool(left == right);
+  case BinaryExpression::GE:
+    return makeBool(left >= right);
+  case BinaryExpression::GT:
+    return makeBool(left > right);
+  case BinaryExpression::LE:
+    return makeBool(left <= right);
+  case BinaryExpression::LT:
+    return makeBool(left < right);
+  }
+  throw CannotEvaluate{};
+}
+
+// Perozzi operations are done in float, as the IR does them.
+template<typename T>
+Value evalRealOperation(BinaryExpression::Type op, VarType::BaseType type, T left, T right) {
+  switch (op) {
+  case BinaryExpression::PLUS:
+    return makeReal(type, left + right);
+  case BinaryExpression::MINUS:
+    return makeReal(type, left - right);
+  case BinaryExpression::TIMES:
+    return makeReal(type, left * right);
+  case BinaryExpression::DIV:
+    return makeReal(type, left / right);
+  // Ordered comparisons, false if either side is NaN.
+  case BinaryExpression::EQ:
+    return makeBool(left == right);
+  case BinaryExpression::GE:
+    return makeBool(left >= right);
+  case BinaryExpression::GT:
+    return makeBool(left > right);
+  case BinaryExpression::LE:
+    return makeBool(left <= right);
+  case BinaryExpression::LT:
+    return makeBool(left < right);
+  default:
+    // Shifts are an error on floating point.
+    throw CannotEvaluate{};
+  }
+}
+
+Value evalBinaryOperation(BinaryExpression::Type op, const Value& left, const Value& right) {
+  if (left.type == VarType::VOID || right.type == VarType::VOID) throw CannotEvaluate{};
+  VarType::BaseType type = getResultType(left.type, right.type);
+  Value converted_left = convert(left, type);
+  Value converted_right = convert(right, type);
+  if (isInteger(type)) {
+    return evalIntegerOperation(op, type, converted_left.integer, converted_right.integer);
+  }
+  if (type == VarType::FLOAT) {
+    return evalRealOperation<float>(op, type, converted_left.real, converted_right.real);
+  }
+  return evalRealOperation<double>(op, type, converted_left.real, converted_right.real);
+}
+
+bool hasPlainTypes(const Function* f) {
+  if (f->getReturnType().isPointer()) return false;
+  for (const FunctionParam& param : f->params()) {
+    if (param.getType().isPointer() || param.getType().isVoid()) return false;
+  }
+  return true;
+}
+
+// Returns false if the expression or statement cannot be part of a pure
+// supercazzola. Otherwise, adds the supercazzole that it calls to callees.
+bool collectCallees(const Expression* e, llvm::StringSet<>* callees) {
+  switch (e->getClassType()) {
+  case AstNode::TYPE_AtomicExpression:
+    return true;
+  case AstNode::TYPE_BinaryExpression: {
+    auto b = static_cast<const BinaryExpression*>(e);
+    return collectCallees(b->getLeft(), callees) && collectCallees(b->getRight(), callees);
+  }
+  case AstNode::TYPE_FunctionCallExpression: {
+    auto call = static_cast<const FunctionCallExpression*>(e);
+    callees->insert(call->getFunctionName());
+    for (const Expression* arg : call->args()) {
+      if (!collectCallees(arg, callees)) return false;
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+template<typename Range> bool collectBodyCallees(const Range& body, llvm::StringSet<>* callees);
+
+bool collectCallees(const Statement* s, llvm::StringSet<>* callees) {
+  switch (s->getClassType()) {
+  case AstNode::TYPE_ExpressionStatement:
+    return collectCallees(static_cast<const ExpressionStatement*>(s)->getExpression(), callees);
+  case AstNode::TYPE_AssignStatement:
+    return collectCallees(static_cast<const AssignStatement*>(s)->getExpression(), callees);
+  case AstNode::TYPE_VardeclStatement: {
+    auto d = static_cast<const VardeclStatement*>(s);
+    if (d->getType().isPointer() || d->getType().isVoid()) return false;
+    return !d->hasInitializer() || collectCallees(d->getInitializer(), callees);
+  }
+  case AstNode::TYPE_ReturnStatement: {
+    auto r = static_cast<const ReturnStatement*>(s);
+    return !r->hasExpression() || collectCallees(r->getExpression(), callees);
+  }
+  case AstNode::TYPE_LoopStatement: {
+    auto l = static_cast<const LoopStatement*>(s);
+    return collectBodyCallees(l->body(), callees) && collectCallees(l->getCondition(), callees);
+  }
+  case AstNode::TYPE_BranchStatement: {
+    auto b = static_cast<const BranchStatement*>(s);
+    for (const BranchCase& branch_case : b->cases()) {
+      if (!collectCallees(branch_case.getExpression(), callees) ||
+          !collectBodyCallees(branch_case.body(), callees)) {
+        return false;
+      }
+    }
+    return !b->hasBranchElse() || collectBodyCallees(b->getBranchElse()->body(), callees);
+  }
+  default:
+    // Input, output, asserts, aborts and writes to buffers.
+    return false;
+  }
+}
+
+template<typename Range> bool collectBodyCallees(const Range& body, llvm::StringSet<>* callees) {
+  for (const Statement* s : body) {
+    if (!collectCallees(s, callees)) return false;
+  }
+  return true;
+}
+
+llvm::StringMap<const Function*> findPureFunctions(const Module* m) {
+  // Calls go to the first supercazzola with a name, as in the IR generator.
+  llvm::StringMap<const Function*> functions;
+  for (const Function* f : m->functions()) functions.insert({f->getName(), f});
+
+  llvm::StringMap<const Function*> pure_functions;
+  llvm::StringMap<llvm::StringSet<>> callees;
+  for (const auto& entry : functions) {
+    const Function* f = entry.second;
+    llvm::StringSet<> f_callees;
+    if (f->body_empty() || !hasPlainTypes(f) || !collectBodyCallees(f->body(), &f_callees)) {
+      continue;
+    }
+    pure_functions.insert({entry.getKey(), f});
+    callees.insert({entry.getKey(), std::move(f_callees)});
+  }
+
+  // Calling an impure supercazzola makes the caller impure too.
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto& entry : callees) {
+      if (!pure_functions.count(entry.getKey())) continue;
+      for (const auto& callee : entry.second) {
+        if (!pure_functions.count(callee.getKey())) {
+          pure_functions.erase(entry.getKey());
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  return pure_functions;
+}
+
+class Interpreter final {
+public:
+  Interpreter(const llvm::StringMap<const Function*>& pure_functions, int64_t* module_steps)
+      : pure_functions_(pure_functions), module_steps_(module_steps), steps_(0), depth_(0) {}
+
+  // Throws CannotEvaluate if the call cannot be evaluated.
+  Value call(const Function* f, const std::vector<Value>& args);
+
+private:
+  // A variable, without a value until it is assigned.
+  struct Slot {
+    VarType::BaseType type;
+    std::optional<Value> value;
+  };
+
+  typedef llvm::StringMap<Slot> Scope;
+
+  // Whether the statements that follow run, or the supercazzola returned.
+  enum class Flow { NEXT, RETURN };
+
+  template<typename Range> Flow executeBody(const Range& body);
+  Flow execute(const Statement* s);
+  template<typename Range> void declareSkipped(const Range& body);
+  void declare(const Variable& variable, VarType::BaseType type);
+  Value evaluate(const Expression* e);
+  bool evaluateCondition(const Expression* e);
+  Slot* lookup(const std::string& name);
+
+  void step() {
+    if (++steps_ > MAX_STEPS_PER_CALL || ++*module_steps_ > MAX_STEPS_PER_MODULE) {
+      throw CannotEvaluate{};
+    }
+  }
+
+  const llvm::StringMap<const Function*>& pure_functions_;
+  int64_t* module_steps_;
+  int64_t steps_;
+  int depth_;
+  // Those of the supercazzola being evaluated.
+  std::vector<Scope> scopes_;
+  std::optional<Value> result_;
+};
+
+Value Interpreter::call(const Function* f, const std::vector<Value>& args) {
+  if (static_cast<size_t>(f->params_size()) != args.size() || depth_ == MAX_CALL_DEPTH) {
+    throw CannotEvaluate{};
+  }
+  ++depth_;
+  std::vector<Scope> caller_scopes = std::move(scopes_);
+  std::optional<Value> caller_result = std::move(result_);
+  scopes_.clear();
+  scopes_.emplace_back();
+  result_.reset();
+
+  auto arg = args.begin();
+  for (const FunctionParam& param : f->params()) {
+    declare(param.getArg(), param.getType().getBaseType());
+    lookup(param.getArg().getName())->value = convert(*arg++, param.getType().getBaseType());
+  }
+  executeBody(f->body());
+
+  Value result{VarType::VOID, 0, 0};
+  if (!f->getReturnType().isVoid()) {
+    // Without a return, the result would be undefined.
+    if (!result_) throw CannotEvaluate{};
+    result = *result_;
+  }
+
+  scopes_ = std::move(caller_scopes);
+  result_ = std::move(caller_result);
+  --depth_;
+  return result;
+}
+
+template<typename Range> Interpreter::Flow Interpreter::executeBody(const Range& body) {
+  for (const Statement* s : body) {
+    if (execute(s) == Flow::RETURN) return Flow::RETURN;
+  }
+  return Flow::NEXT;
+}
+
+Interpreter::Flow Interpreter::execute(const Statement* s) {
+  step();
+  switch (s->getClassType()) {
+  case AstNode::TYPE_ExpressionStatement:
+    evaluate(static_cast<const ExpressionStatement*>(s)->getExpression());
+    return Flow::NEXT;
+  case AstNode::TYPE_VardeclStatement: {
+    auto d = static_cast<const VardeclStatement*>(s);
+    // As in the IR, the variable is in scope in its own initializer.
+    declare(d->getVariable(), d->getType().getBaseType());
+    if (d->hasInitializer()) {
+      Value value = convert(evaluate(d->getInitializer()), d->getType().getBaseType());
+      lookup(d->getVariable().getName())->value = value;
+    }
+    return Flow::NEXT;
+  }
+  case AstNode::TYPE_AssignStatement: {
+    auto a = static_cast<const AssignStatement*>(s);
+    Value value = evaluate(a->getExpression());
+    Slot* slot = lookup(a->getVariable().getName());
+    if (!slot) throw CannotEvaluate{};
+    slot->value = convert(value, slot->type);
+    return Flow::NEXT;
+  }
+  case AstNode::TYPE_ReturnStatement: {
+    auto r = static_cast<const ReturnStatement*>(s);
+    if (r->hasExpression()) result_ = evaluate(r->getExpression());
+    return Flow::RETURN;
+  }
+  case AstNode::TYPE_LoopStatement: {
+    auto l = static_cast<const LoopStatement*>(s);
+    do {
+      scopes_.emplace_back();
+      Flow flow = executeBody(l->body());
+      scopes_.pop_back();
+      if (flow == Flow::RETURN) return flow;
+    } while (evaluateCondition(l->getCondition()));
+    return Flow::NEXT;
+  }
+  case AstNode::TYPE_BranchStatement: {
+    auto b = static_cast<const BranchStatement*>(s);
+    auto taken = b->end_cases();
+    for (auto branch_case = b->begin_cases(); branch_case != b->end_cases(); ++branch_case) {
+      if (evaluateCondition(branch_case->getExpression())) {
+        taken = branch_case;
+        break;
+      }
+    }
+    // The variables declared in any case are in scope after the branch, with
+    // no value if their case was not taken.
+    for (auto branch_case = b->begin_cases(); branch_case != b->end_cases(); ++branch_case) {
+      if (branch_case != taken) declareSkipped(branch_case->body());
+    }
+    if (taken != b->end_cases()) return executeBody(taken->body());
+    if (!b->hasBranchElse()) return Flow::NEXT;
+    scopes_.emplace_back();
+    Flow flow = executeBody(b->getBranchElse()->body());
+    scopes_.pop_back();
+    return flow;
+  }
+  default:
+    throw CannotEvaluate{};
+  }
+}
+
+template<typename Range> void Interpreter::declareSkipped(const Range& body) {
+  for (const Statement* s : body) {
+    if (s->getClassType() == AstNode::TYPE_VardeclStatement) {
+      auto d = static_cast<const VardeclStatement*>(s);
+      declare(d->getVariable(), d->getType().getBaseType());
+    } else if (s->getClassType() == AstNode::TYPE_BranchStatement) {
+      for (const BranchCase& branch_case : static_cast<const BranchStatement*>(s)->cases()) {
+        declareSkipped(branch_case.body());
+      }
+    }
+  }
+}
+
+void Interpreter::declare(const Variable& variable, VarType::BaseType type) {
+  // Redefining a variable is an error.
+  if (!scopes_.back().insert({variable.getName(), Slot{type, std::nullopt}}).second) {
+    throw CannotEvaluate{};
+  }
+}
+
+Value Interpreter::evaluate(const Expression* e) {
+  step();
+  switch (e->getClassType()) {
+  case AstNode::TYPE_AtomicExpression: {
+    auto atom = static_cast<const AtomicExpression*>(e);
+    switch (atom->getType()) {
+    case AtomicExpression::INTEGER:
+      return makeInteger(VarType::INTEGER, atom->getIntValue());
+    case AtomicExpression::FLOAT:
+      return makeReal(VarType::DOUBLE, atom->getFloatValue());
+    case AtomicExpression::IDENTIFIER: {
+      Slot* slot = lookup(atom->getIdentifierValue().getName());
+      if (!slot || !slot->value) throw CannotEvaluate{};
+      return *slot->value;
+    }
+    }
+    break;
+  }
+  case AstNode::TYPE_BinaryExpression: {
+    auto b = static_cast<const BinaryExpression*>(e);
+    Value left = evaluate(b->getLeft());
+    Value right = evaluate(b->getRight());
+    return evalBinaryOperation(b->getType(), left, right);
+  }
+  case AstNode::TYPE_FunctionCallExpression: {
+    auto call_expression = static_cast<const FunctionCallExpression*>(e);
+    const Function* callee = pure_functions_.lookup(call_expression->getFunctionName());
+    if (!callee) throw CannotEvaluate{};
+    std::vector<Value> args;
+    for (const Expression* arg : call_expression->args()) args.push_back(evaluate(arg));
+    return call(callee, args);
+  }
+  default:
+    break;
+  }
+  throw CannotEvaluate{};
+}
+
+// The IR generator only takes integers as conditions.
+bool Interpreter::evaluateCondition(const Expression* e) {
+  Value value = evaluate(e);
+  if (!isInteger(value.type)) throw CannotEvaluate{};
+  return value.integer != 0;
+}
+
+Interpreter::Slot* Interpreter::lookup(const std::string& name) {
+  for (auto scope = scopes_.rbegin(), end = scopes_.rend(); scope != end; ++scope) {
+    auto slot = scope->find(name);
+    if (slot != scope->end()) return &slot->second;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+// Needs to be outside of the anonymous namespace, to be a friend of the AST.
+class CallFolder final {
+public:
+  explicit CallFolder(const Module* m) : pure_functions_(findPureFunctions(m)) {}
+
+  void foldModule(Module* m);
+  int getFoldedCount() const { return folded_count_; }
+
+private:
+  void foldBody(std::vector<std::unique_ptr<Statement>>& body);
+  void foldStatement(Statement* s);
+  template<typename Pointer> void foldExpression(Pointer& e);
+  std::unique_ptr<AtomicExpression> evaluateCall(const FunctionCallExpression* call);
+
+  llvm::StringMap<const Function*> pure_functions_;
+  int64_t module_steps_ = 0;
+  int folded_count_ = 0;
+};
+
+void CallFolder::foldModule(Module* m) {
+  if (pure_functions_.empty()) return;
+  for (auto& f : m->functions_) foldBody(f->body_);
+  if (m->maybe_entry_point_) foldBody(m->maybe_entry_point_->body_);
+}
+
+void CallFolder::foldBody(std::vector<std::unique_ptr<Statement>>& body) {
+  for (auto& s : body) foldStatement(s.get());
+}
+
+void CallFolder::foldStatement(Statement* s) {
+  switch (s->getClassType()) {
+  case AstNode::TYPE_AssertStatement:
+    foldExpression(static_cast<AssertStatement*>(s)->expression_);
+    break;
+  case AstNode::TYPE_ExpressionStatement:
+    foldExpression(static_cast<ExpressionStatement*>(s)->expression_);
+    break;
+  case AstNode::TYPE_PrintStatement:
+    foldExpression(static_cast<PrintStatement*>(s)->expression_);
+    break;
+  case AstNode::TYPE_AssignStatement:
+    foldExpression(static_cast<AssignStatement*>(s)->expression_);
+    break;
+  case AstNode::TYPE_ElementAssignStatement: {
+    auto a = static_cast<ElementAssignStatement*>(s);
+    foldExpression(a->target_->pointer_);
+    foldExpression(a->target_->index_);
+    foldExpression(a->expression_);
+    break;
+  }
+  case AstNode::TYPE_VardeclStatement: {
+    auto d = static_cast<VardeclStatement*>(s);
+    if (d->maybe_init_) foldExpression(d->maybe_init_);
+    break;
+  }
+  case AstNode::TYPE_ReturnStatement: {
+    auto r = static_cast<ReturnStatement*>(s);
+    if (r->maybe_expression_) foldExpression(r->maybe_expression_);
+    break;
+  }
+  case AstNode::TYPE_LoopStatement: {
+    auto l = static_cast<LoopStatement*>(s);
+    foldBody(l->body_);
+    foldExpression(l->condition_);
+    break;
+  }
+  case AstNode::TYPE_BranchStatement: {
+    auto b = static_cast<BranchStatement*>(s);
+    for (BranchCase& branch_case : b->cases_) {
+      foldExpression(branch_case.expression_);
+      foldBody(branch_case.body_);
+    }
+    if (b->maybe_else_case_) foldBody(b->maybe_else_case_->body_);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Arguments are folded first, so that nested calls fold from the inside out.
+template<typename Pointer> void CallFolder::foldExpression(Pointer& e) {
+  switch (e->getClassType()) {
+  case AstNode::TYPE_BinaryExpression: {
+    auto b = static_cast<BinaryExpression*>(e.get());
+    foldExpression(b->left_);
+    foldExpression(b->right_);
+    break;
+  }
+  case AstNode::TYPE_FunctionCallExpression: {
+    auto call = static_cast<FunctionCallExpression*>(e.get());
+    for (auto& arg : call->function_args_) foldExpression(arg);
+    if (auto folded = evaluateCall(call)) e = std::move(folded);
+    break;
+  }
+  case AstNode::TYPE_IndexExpression: {
+    auto index = static_cast<IndexExpression*>(e.get());
+    foldExpression(index->pointer_);
+    foldExpression(index->index_);
+    break;
+  }
+  case AstNode::TYPE_AllocExpression:
+    foldExpression(static_cast<AllocExpression*>(e.get())->count_);
+    break;
+  default:
+    break;
+  }
+}
+
+std::unique_ptr<AtomicExpression> CallFolder::evaluateCall(const FunctionCallExpression* call) {
+  const Function* callee = pure_functions_.lookup(call->getFunctionName());
+  if (!callee) return nullptr;
+  // Any other type would change the meaning of the expression around the call.
+  VarType::BaseType type = callee->getReturnType().getBaseType();
+  if (type != VarType::INTEGER && type != VarType::DOUBLE) return nullptr;
+
+  std::vector<Value> args;
+  for (const Expression* arg : call->args()) {
+    if (arg->getClassType() != AstNode::TYPE_AtomicExpression) return nullptr;
+    auto atom = static_cast<const AtomicExpression*>(arg);
+    if (atom->getType() == AtomicExpression::INTEGER) {
+      args.push_back(makeInteger(VarType::INTEGER, atom->getIntValue()));
+    } else if (atom->getType() == AtomicExpression::FLOAT) {
+      args.push_back(makeReal(VarType::DOUBLE, atom->getFloatValue()));
+    } else {
+      return nullptr;
+    }
+  }
+
+  Value result;
+  try {
+    Interpreter interpreter{pure_functions_, &module_steps_};
+    result = interpreter.call(callee, args);
+  } catch (const CannotEvaluate&) {
+    return nullptr;
+  }
+
+  std::unique_ptr<AtomicExpression> folded;
+  if (type == VarType::INTEGER) {
+    folded = AtomicExpression::fromInt(static_cast<uint64_t>(result.integer));
+  } else {
+    folded = AtomicExpression::fromFloat(result.real);
+  }
+  folded->first_location_ = call->getFirstLocation();
+  folded->last_location_ = call->getLastLocation();
+  ++folded_count_;
+  return folded;
+}
+
+int foldConstantCalls(Module* ast) {
+  CallFolder folder{ast};
+  folder.foldModule(ast);
+  return folder.getFoldedCount();
+}
+
+} // namespace monicelli
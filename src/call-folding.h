@@ -0,0 +1,22 @@
+#ifndef MONICELLI_CALL_FOLDING_H
+#define MONICELLI_CALL_FOLDING_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+namespace monicelli {
+
+class Module;
+
+// Replaces the calls to pure supercazzole with constant arguments by their
+// results, worked out by interpreting the supercazzole. A supercazzola is pure
+// if it has no input, output, assert or abort, no pointers, and only calls
+// other pure supercazzole. Only calls that return a Necchi or a Sassaroli are
+// replaced, since those are the types of literals. Calls that take too long to
+// evaluate, or whose behavior would be undefined, are left as they are.
+// Returns how many calls were replaced.
+int foldConstantCalls(Module* ast);
+
+} // namespace monicelli
+
+#endif
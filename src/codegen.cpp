@@ -1,29 +1,59 @@
 // Copyright 2017 the Monicelli project authors. All rights reserved.
 // Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
 
+#include "codegen.h"
 #include "codegen.def"
 #include "ast-visitor.h"
 #include "parser.h"
+#include "timing.h"
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/Pass.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_os_ostream.h"
+#include "llvm/Transforms/IPO/ArgumentPromotion.h"
+#include "llvm/Transforms/IPO/FunctionAttrs.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Inliner.h"
+#include "llvm/Transforms/IPO/SCCP.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
+#include <thread>
 #include <vector>
 
 using namespace monicelli;
@@ -42,7 +72,7 @@ public:
     NestedScopes& context_;
   };
 
-  NestedScopes() {}
+  NestedScopes(llvm::IRBuilder<>& builder) : builder_(builder) {}
 
   NestedScopes(NestedScopes&) = delete;
   NestedScopes& operator=(NestedScopes&) = delete;
@@ -51,22 +81,40 @@ public:
 
   bool define(const std::string& name, llvm::AllocaInst* def) {
     assert(!scopes_.empty() && "Trying to define outside any scope");
-    auto result = scopes_.back().insert({name, def});
+    auto result = scopes_.back().variables.insert({name, def});
     return result.second;
   }
 
+  // Like define(), but the variable is only alive from here to the end of the
+  // scope, so that its stack slot can be shared with those of other scopes.
+  bool defineLocal(const std::string& name, llvm::AllocaInst* def) {
+    if (!define(name, def)) return false;
+    builder_.CreateLifetimeStart(def);
+    scopes_.back().locals.push_back(def);
+    return true;
+  }
+
   void enterScope() { scopes_.emplace_back(); }
 
-  void leaveScope() {
-    assert(!scopes_.empty() && "Trying to leave a scope, but there is none");
-    scopes_.pop_back();
-  }
+  void leaveScope();
+
+  // Whether the code being generated is past a return, and cannot be reached,
+  // so that leaving a scope there ends no lifetimes.
+  bool isTerminated() const { return terminated_; }
+  void setTerminated(bool terminated) { terminated_ = terminated; }
 
   void reset() { scopes_.clear(); }
   bool empty() const { return scopes_.empty(); }
 
 private:
-  std::vector<llvm::StringMap<llvm::AllocaInst*>> scopes_;
+  struct Scope {
+    llvm::StringMap<llvm::AllocaInst*> variables;
+    llvm::SmallVector<llvm::AllocaInst*, 4> locals;
+  };
+
+  llvm::IRBuilder<>& builder_;
+  std::vector<Scope> scopes_;
+  bool terminated_ = false;
 };
 
 class IRGenerator;
@@ -74,12 +122,15 @@ class IRGenerator;
 class ResultTypeCalculator : public ConstAstVisitor<ResultTypeCalculator, llvm::Type*>,
                              public ErrorReportingMixin {
 public:
-  ResultTypeCalculator(IRGenerator* codegen, const std::string& source_filename)
-      : ErrorReportingMixin(source_filename), codegen_(codegen) {}
+  ResultTypeCalculator(IRGenerator* codegen, const std::string& source_filename,
+                       DiagnosticSink* sink)
+      : ErrorReportingMixin(source_filename, sink), codegen_(codegen) {}
 
   llvm::Type* visitBinaryExpression(const BinaryExpression* e);
   llvm::Type* visitAtomicExpression(const AtomicExpression* e);
   llvm::Type* visitFunctionCallExpression(const FunctionCallExpression* e);
+  llvm::Type* visitIndexExpression(const IndexExpression* e);
+  llvm::Type* visitAllocExpression(const AllocExpression* e);
 
 private:
   IRGenerator* codegen_;
@@ -88,18 +139,26 @@ private:
 class IRGenerator final : public ConstAstVisitor<IRGenerator, llvm::Value*>,
                           public ErrorReportingMixin {
 public:
-  IRGenerator(llvm::LLVMContext& context, const std::string& source_filename)
-      : ErrorReportingMixin(source_filename), context_(context), builder_(context),
-        exit_block_(nullptr), return_var_(nullptr), type_calculator_(this, source_filename) {}
+  IRGenerator(llvm::LLVMContext& context, const std::string& source_filename,
+              DiagnosticSink* sink, const CodegenOptions& options)
+      : ErrorReportingMixin(source_filename, sink), context_(context), builder_(context),
+        options_(options), prototypes_(nullptr), var_scopes_(builder_), exit_block_(nullptr),
+        return_var_(nullptr), profile_site_(nullptr), tbaa_root_(nullptr),
+        type_calculator_(this, source_filename, sink) {}
 
   std::unique_ptr<llvm::Module> releaseModule() { return std::move(module_); }
   llvm::Module* getModule() { return module_.get(); }
 
   llvm::Value* visitModule(const Module* m);
+  bool checkUniqueNames(const Module* m);
+  void checkFunctions(const Module* m, const llvm::StringMap<const Function*>* prototypes);
+  void visitFunctions(llvm::ArrayRef<const Function*> functions,
+                      const llvm::StringMap<const Function*>* prototypes);
   llvm::Value* visitFunction(const Function* f);
   llvm::Value* visitVardeclStatement(const VardeclStatement* s);
   llvm::Value* visitReturnStatement(const ReturnStatement* r);
   llvm::Value* visitAssignStatement(const AssignStatement* a);
+  llvm::Value* visitElementAssignStatement(const ElementAssignStatement* a);
   llvm::Value* visitBranchStatement(const BranchStatement* b);
   llvm::Value* visitLoopStatement(const LoopStatement* l);
   llvm::Value* visitInputStatement(const InputStatement* s);
@@ -113,14 +172,23 @@ public:
   llvm::Value* visitBinaryExpression(const BinaryExpression* e);
   llvm::Value* visitAtomicExpression(const AtomicExpression* e);
   llvm::Value* visitFunctionCallExpression(const FunctionCallExpression* f);
+  llvm::Value* visitIndexExpression(const IndexExpression* e);
+  llvm::Value* visitAllocExpression(const AllocExpression* e);
 
 private:
+  template<typename Range> void visitStatements(const Range& body);
+
   llvm::Function* declareFunction(const Function* f);
+  llvm::Function* getFunction(const std::string& name);
+  void addFPModelAttributes(llvm::Function* f);
+  llvm::GlobalVariable* getProfileSite(llvm::Function* f);
+  void emitProbe(const std::string& name, llvm::ArrayRef<llvm::Value*> args = {});
   std::string getFunctionName(const Function* f) {
     return f->isEntryPoint() ? "main" : f->getName();
   }
 
   void declareBuiltins();
+  llvm::Value* callRuntime(const char* name, llvm::ArrayRef<llvm::Value*> args = {});
 
   template<bool output> const char* getFormatSpecifier(llvm::Type* type);
   template<bool output> llvm::Value* getFormatString(llvm::Type* type);
@@ -139,21 +207,52 @@ private:
   const char* getSourceBaseType(llvm::Type* type);
   std::string getSourceType(llvm::Type* type);
 
+  std::optional<VarType::BaseType> getPointeeType(const Expression* e);
+  void checkPointeeType(const Expression* e, const llvm::Value* target);
+  llvm::Value* getElementAddress(const IndexExpression* e, llvm::Type** element_type);
+  void checkBounds(llvm::Value* pointer, llvm::Value* index);
+  void checkBuffer(llvm::Value* pointer);
+  void abortUnless(llvm::Value* condition, const char* name);
+  template<typename Access> Access* annotateElementAccess(Access* access, llvm::Type* type);
+  llvm::MDNode* getTBAATag(llvm::Type* type);
+
+  BranchStatement::BranchCaseConstIter findSwitchCasesEnd(const BranchStatement* b);
+
+  bool emitTailCall(const Expression* e, llvm::Value* call_value, llvm::Value* return_value);
+
   llvm::Value* evalBooleanCondition(const Expression* condition_expression);
   llvm::Value* evalTruthiness(llvm::Value* val);
 
   llvm::Function* current_function() { return builder_.GetInsertBlock()->getParent(); }
 
+  // Every alloca goes in the entry block, wherever the variable is declared,
+  // so that the stack frame has a fixed size and mem2reg can promote it.
+  llvm::AllocaInst* createEntryBlockAlloca(llvm::Type* type, const llvm::Twine& name = "") {
+    llvm::BasicBlock& entry = current_function()->getEntryBlock();
+    llvm::IRBuilder<> entry_builder{&entry, entry.getFirstNonPHIOrDbgOrAlloca()};
+    return entry_builder.CreateAlloca(type, nullptr, name);
+  }
+
   llvm::LLVMContext& context_;
 
   llvm::IRBuilder<> builder_;
   std::unique_ptr<llvm::Module> module_;
+  CodegenOptions options_;
+  // The supercazzole of the whole module, when generating only some of them.
+  const llvm::StringMap<const Function*>* prototypes_;
 
   NestedScopes var_scopes_;
   llvm::DenseMap<llvm::Type*, llvm::Value*> input_format_strings_cache_;
   llvm::DenseMap<llvm::Type*, llvm::Value*> output_format_strings_cache_;
   llvm::BasicBlock* exit_block_;
   llvm::AllocaInst* return_var_;
+  // The profile counters of the current function, with --instrument-functions.
+  llvm::GlobalVariable* profile_site_;
+  // Pointers are opaque in the IR, so the type that a conte points to is
+  // kept here for each variable, parameter and supercazzola that has one.
+  llvm::DenseMap<const llvm::Value*, VarType::BaseType> pointee_types_;
+  llvm::MDNode* tbaa_root_;
+  llvm::DenseMap<llvm::Type*, llvm::MDNode*> tbaa_tags_;
 
   ResultTypeCalculator type_calculator_;
 
@@ -164,12 +263,25 @@ private:
 
 llvm::AllocaInst* NestedScopes::lookup(const std::string& name) {
   for (auto c = scopes_.crbegin(), end = scopes_.crend(); c != end; ++c) {
-    auto result = c->find(name);
-    if (result != c->end()) return result->second;
+    auto result = c->variables.find(name);
+    if (result != c->variables.end()) return result->second;
   }
   return nullptr;
 }
 
+void NestedScopes::leaveScope() {
+  assert(!scopes_.empty() && "Trying to leave a scope, but there is none");
+  // Past a return, and once the function has returned, there is nothing to
+  // end, and the markers would only fill blocks that are never reached.
+  llvm::BasicBlock* current = builder_.GetInsertBlock();
+  if (current && !current->getTerminator() && !terminated_) {
+    for (llvm::AllocaInst* local : llvm::reverse(scopes_.back().locals)) {
+      builder_.CreateLifetimeEnd(local);
+    }
+  }
+  scopes_.pop_back();
+}
+
 void IRGenerator::declareBuiltins() {
   llvm::FunctionType* abort_type = llvm::FunctionType::get(builder_.getVoidTy(), false);
   auto no_return = llvm::AttributeList().addFnAttribute(context_, llvm::Attribute::NoReturn);
@@ -181,9 +293,78 @@ void IRGenerator::declareBuiltins() {
 
   module_->getOrInsertFunction("printf", printf_type, no_alias);
   module_->getOrInsertFunction("scanf", printf_type, no_alias);
+
+  // Each buffer from sbiriguda is a new object, which aliases nothing else.
+  llvm::FunctionType* calloc_type = llvm::FunctionType::get(
+      builder_.getPtrTy(), {builder_.getInt64Ty(), builder_.getInt64Ty()}, false);
+  auto no_alias_result = llvm::AttributeList().addRetAttribute(context_, llvm::Attribute::NoAlias);
+  module_->getOrInsertFunction("calloc", calloc_type, no_alias_result);
+
+  // See runtime/runtime.h.
+  auto no_unwind = llvm::AttributeList().addFnAttribute(context_, llvm::Attribute::NoUnwind);
+  llvm::Type* void_type = builder_.getVoidTy();
+  if (options_.instrument_functions) {
+    module_->getOrInsertFunction("mc_profile_init", no_unwind, void_type, builder_.getInt32Ty());
+    module_->getOrInsertFunction("mc_profile_enter", no_unwind, void_type, builder_.getPtrTy());
+    module_->getOrInsertFunction("mc_profile_exit", no_unwind, void_type, builder_.getPtrTy());
+  }
+  if (options_.bounds_check && options_.track_buffers) {
+    module_->getOrInsertFunction("mc_register_buffer", no_unwind, void_type, builder_.getPtrTy());
+    module_->getOrInsertFunction("mc_check_buffer", no_unwind, void_type, builder_.getPtrTy());
+  }
+
+  if (!options_.use_runtime_io) return;
+
+  module_->getOrInsertFunction("mc_init_output", no_unwind, void_type);
+  module_->getOrInsertFunction("mc_init_input", no_unwind, void_type);
+  module_->getOrInsertFunction("mc_print_i32", no_unwind, void_type, builder_.getInt32Ty());
+  module_->getOrInsertFunction("mc_print_char", no_unwind, void_type, builder_.getInt32Ty());
+  module_->getOrInsertFunction("mc_print_f64", no_unwind, void_type, builder_.getDoubleTy());
+  module_->getOrInsertFunction("mc_flush", no_unwind, void_type);
+  llvm::Type* int_type = builder_.getInt32Ty();
+  module_->getOrInsertFunction("mc_read_i32", no_unwind, int_type, int_type);
+  module_->getOrInsertFunction("mc_read_char", no_unwind, int_type, int_type);
+  module_->getOrInsertFunction("mc_read_bool", no_unwind, int_type, int_type);
+  module_->getOrInsertFunction("mc_read_f32", no_unwind, builder_.getFloatTy(),
+                               builder_.getFloatTy());
+  module_->getOrInsertFunction("mc_read_f64", no_unwind, builder_.getDoubleTy(),
+                               builder_.getDoubleTy());
+}
+
+llvm::Value* IRGenerator::callRuntime(const char* name, llvm::ArrayRef<llvm::Value*> args) {
+  auto builtin = module_->getFunction(name);
+  assert(builtin && "Runtime function was not declared");
+  return builder_.CreateCall(builtin, args);
+}
+
+// Statements are the unit of error recovery. After an error, the IR of the
+// statement is left half built, which is fine since it will never be used.
+template<typename Range> void IRGenerator::visitStatements(const Range& body) {
+  for (const Statement* s : body) {
+    try {
+      visit(s);
+    } catch (const RecoverableError&) {
+    }
+  }
 }
 
+namespace {
+
+// In a whole program, nothing but the entry point is called from outside, so
+// the other functions that it defines can be changed or dropped at will.
+void internalizeWholeProgram(llvm::Module* module) {
+  for (llvm::Function& f : module->functions()) {
+    if (!f.isDeclaration() && f.getName() != "main") {
+      f.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+}
+
+} // namespace
+
 llvm::Value* IRGenerator::visitModule(const Module* m) {
+  if (!checkUniqueNames(m)) return nullptr;
+
   module_ = std::make_unique<llvm::Module>("antani", context_);
 
   declareBuiltins();
@@ -198,11 +379,85 @@ llvm::Value* IRGenerator::visitModule(const Module* m) {
   }
   if (m->hasEntryPoint()) visit(m->getEntryPoint());
 
+  if (options_.whole_program && m->hasEntryPoint()) internalizeWholeProgram(module_.get());
+
   llvm::verifyModule(*module_);
 
   return nullptr;
 }
 
+// Calls could only ever reach the first of two supercazzole with the same
+// name, so each one after it is an error. Prototypes only declare a name, and
+// can be given any number of times. Returns false if there were any errors.
+bool IRGenerator::checkUniqueNames(const Module* m) {
+  bool unique = true;
+  llvm::StringSet<> names;
+  for (const Function* f : m->functions()) {
+    if (f->body_empty() || names.insert(getFunctionName(f)).second) continue;
+    unique = false;
+    try {
+      error(f, "supercazzola", f->getName(), "is defined more than once");
+    } catch (const RecoverableError&) {
+    }
+  }
+  if (m->hasEntryPoint() && names.count("main")) {
+    unique = false;
+    try {
+      error(m->getEntryPoint(), "the entry point clashes with supercazzola main");
+    } catch (const RecoverableError&) {
+    }
+  }
+  return unique;
+}
+
+void IRGenerator::checkFunctions(const Module* m,
+                                 const llvm::StringMap<const Function*>* prototypes) {
+  module_ = std::make_unique<llvm::Module>("antani", context_);
+  prototypes_ = prototypes;
+
+  declareBuiltins();
+
+  // The functions being checked come first, so that a stale prototype with
+  // the same name does not shadow them. The others are declared as they are
+  // called, see getFunction().
+  for (const Function* f : m->functions()) {
+    if (!module_->getFunction(getFunctionName(f))) declareFunction(f);
+  }
+  if (m->hasEntryPoint()) declareFunction(m->getEntryPoint());
+
+  for (const Function* f : m->functions()) {
+    // Only the first definition of a name got a prototype.
+    if (module_->getFunction(getFunctionName(f))->empty()) visit(f);
+  }
+  if (m->hasEntryPoint()) visit(m->getEntryPoint());
+}
+
+void IRGenerator::visitFunctions(llvm::ArrayRef<const Function*> functions,
+                                 const llvm::StringMap<const Function*>* prototypes) {
+  module_ = std::make_unique<llvm::Module>("antani", context_);
+  prototypes_ = prototypes;
+
+  declareBuiltins();
+
+  // As in visitModule(), a supercazzola takes the signature of the first
+  // prototype or definition of its name.
+  for (const Function* f : functions) {
+    getFunction(getFunctionName(f));
+  }
+  for (const Function* f : functions) {
+    visit(f);
+  }
+}
+
+// Out of the functions being generated, only those that are called get
+// declared, which keeps each module small.
+llvm::Function* IRGenerator::getFunction(const std::string& name) {
+  if (llvm::Function* f = module_->getFunction(name)) return f;
+  if (!prototypes_) return nullptr;
+  auto prototype = prototypes_->find(name);
+  return prototype != prototypes_->end() ? declareFunction(prototype->second) : nullptr;
+}
+
 llvm::Function* IRGenerator::declareFunction(const Function* ast_f) {
   std::vector<llvm::Type*> param_types;
   param_types.reserve(ast_f->params_size());
@@ -217,25 +472,145 @@ llvm::Function* IRGenerator::declareFunction(const Function* ast_f) {
   auto ast_arg = ast_f->begin_params();
   for (auto& arg : f->args()) {
     arg.setName(ast_arg->getArg().getName());
+    if (ast_arg->getType().isPointer()) pointee_types_[&arg] = ast_arg->getType().getBaseType();
     ++ast_arg;
   }
   assert(ast_arg == ast_f->end_params());
+  if (ast_f->getReturnType().isPointer()) {
+    pointee_types_[f] = ast_f->getReturnType().getBaseType();
+  }
 
   return f;
 }
 
+// The flags on each instruction are enough for the optimizer, but the backend
+// decides what it may do with a whole function from its attributes. Contracted
+// operations are fused by the backend from their flags alone.
+void IRGenerator::addFPModelAttributes(llvm::Function* f) {
+  if (options_.fp_model != FPModel::FAST) return;
+  for (const char* attribute : {"unsafe-fp-math", "no-infs-fp-math", "no-nans-fp-math",
+                                "no-signed-zeros-fp-math", "approx-func-fp-math"}) {
+    f->addFnAttr(attribute, "true");
+  }
+}
+
+// A struct mc_profile_site of runtime/runtime.h, private to the module.
+llvm::GlobalVariable* IRGenerator::getProfileSite(llvm::Function* f) {
+  auto site_type = llvm::StructType::get(
+      context_, {builder_.getPtrTy(), builder_.getPtrTy(), builder_.getInt64Ty(),
+                 builder_.getInt64Ty(), builder_.getInt64Ty(), builder_.getInt32Ty()});
+  auto name = builder_.CreateGlobalStringPtr(f->getName(), "profile.name");
+  auto null = llvm::ConstantPointerNull::get(builder_.getPtrTy());
+  auto zero = builder_.getInt64(0);
+  auto initializer =
+      llvm::ConstantStruct::get(site_type, {name, null, zero, zero, zero, builder_.getInt32(0)});
+  return new llvm::GlobalVariable(*module_, site_type, false, llvm::GlobalValue::PrivateLinkage,
+                                  initializer, "profile.site");
+}
+
+namespace {
+
+// Tracers do not read more than this.
+const size_t MAX_PROBE_ARGS = 12;
+
+// The note of a probe, as written by STAP_PROBE of sys/sdt.h. The note holds
+// the address of the nop, that of .stapsdt.base to find out how far the
+// binary was moved, no semaphore, the provider, the name and the arguments.
+const char* PROBE_NOTE_BEGIN = "990: nop\n"
+                               ".pushsection .note.stapsdt,\"\",\"note\"\n"
+                               ".balign 4\n"
+                               ".4byte 992f-991f, 994f-993f, 3\n"
+                               "991: .asciz \"stapsdt\"\n"
+                               "992: .balign 4\n"
+                               "993: .8byte 990b\n"
+                               ".8byte _.stapsdt.base\n"
+                               ".8byte 0\n"
+                               ".asciz \"monicelli\"\n";
+const char* PROBE_NOTE_END = "994: .balign 4\n"
+                             ".popsection\n"
+                             ".ifndef _.stapsdt.base\n"
+                             ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"
+                             ".weak _.stapsdt.base\n"
+                             ".hidden _.stapsdt.base\n"
+                             "_.stapsdt.base: .space 1\n"
+                             ".size _.stapsdt.base, 1\n"
+                             ".popsection\n"
+                             ".endif\n";
+
+} // namespace
+
+// Each argument is described as its size, negative if signed, and where it
+// is. Keeping arguments in registers is all it costs until a tracer turns
+// the nop into a trap. Floats are passed as their bits, since tracers only
+// read integers.
+void IRGenerator::emitProbe(const std::string& name, llvm::ArrayRef<llvm::Value*> args) {
+  std::string arguments;
+  std::string constraints;
+  llvm::SmallVector<llvm::Value*, MAX_PROBE_ARGS> operands;
+  llvm::SmallVector<llvm::Type*, MAX_PROBE_ARGS> operand_types;
+  for (llvm::Value* arg : args.take_front(MAX_PROBE_ARGS)) {
+    llvm::Type* type = arg->getType();
+    bool is_signed = type->isIntegerTy() && !type->isIntegerTy(1);
+    if (type->isIntegerTy(1)) {
+      arg = builder_.CreateZExt(arg, builder_.getInt8Ty());
+    } else if (type->isFloatingPointTy()) {
+      arg = builder_.CreateBitCast(arg, builder_.getIntNTy(type->getPrimitiveSizeInBits()));
+    }
+    uint64_t size = type->isPointerTy() ? 8 : arg->getType()->getPrimitiveSizeInBits() / 8;
+    std::string index = std::to_string(operands.size());
+    if (!operands.empty()) {
+      arguments += ' ';
+      constraints += ',';
+    }
+    arguments += (is_signed ? "-" : "") + std::to_string(size) + "@${" + index + "}";
+    constraints += 'r';
+    operands.push_back(arg);
+    operand_types.push_back(arg->getType());
+  }
+
+  std::string note = PROBE_NOTE_BEGIN;
+  note += ".asciz \"" + name + "\"\n.asciz \"" + arguments + "\"\n";
+  note += PROBE_NOTE_END;
+  auto type = llvm::FunctionType::get(builder_.getVoidTy(), operand_types, false);
+  builder_.CreateCall(llvm::InlineAsm::get(type, note, constraints, /*hasSideEffects=*/true),
+                      operands);
+}
+
 llvm::Value* IRGenerator::visitFunction(const Function* ast_f) {
   llvm::Function* f = module_->getFunction(getFunctionName(ast_f));
   assert(f && "This function should have had a prototype defined");
 
   if (ast_f->body_empty()) return f;
 
+  llvm::TimeTraceScope trace_scope{"IRGenFunction", f->getName()};
+
+  addFPModelAttributes(f);
+
   NestedScopes::Guard scopes_guard{var_scopes_};
+  var_scopes_.setTerminated(false);
   llvm::BasicBlock* entry = llvm::BasicBlock::Create(context_, "entry", f);
   builder_.SetInsertPoint(entry);
 
+  profile_site_ = nullptr;
+  if (options_.instrument_functions) {
+    if (ast_f->isEntryPoint()) {
+      callRuntime("mc_profile_init", {builder_.getInt32(options_.profile_json)});
+    }
+    profile_site_ = getProfileSite(f);
+    callRuntime("mc_profile_enter", {profile_site_});
+  }
+  if (options_.use_runtime_io && ast_f->isEntryPoint()) {
+    callRuntime("mc_init_output");
+    callRuntime("mc_init_input");
+  }
+  if (options_.usdt) {
+    llvm::SmallVector<llvm::Value*, 8> args;
+    for (auto& arg : f->args()) args.push_back(&arg);
+    emitProbe(f->getName().str() + "__entry", args);
+  }
+
   if (!f->getReturnType()->isVoidTy()) {
-    return_var_ = builder_.CreateAlloca(f->getReturnType(), nullptr, "result");
+    return_var_ = createEntryBlockAlloca(f->getReturnType(), "result");
     if (ast_f->isEntryPoint()) {
       assert(f->getReturnType()->isIntegerTy());
       builder_.CreateStore(ensureType(builder_.getInt64(0), f->getReturnType()), return_var_);
@@ -245,24 +620,37 @@ llvm::Value* IRGenerator::visitFunction(const Function* ast_f) {
   }
 
   for (auto& arg : f->args()) {
-    auto arg_ptr = builder_.CreateAlloca(arg.getType(), nullptr, arg.getName());
+    auto arg_ptr = createEntryBlockAlloca(arg.getType(), arg.getName());
+    checkBuffer(&arg);
     builder_.CreateStore(&arg, arg_ptr);
+    auto pointee_type = pointee_types_.find(&arg);
+    if (pointee_type != pointee_types_.end()) pointee_types_[arg_ptr] = pointee_type->second;
     var_scopes_.define(arg.getName().str(), arg_ptr);
   }
 
   exit_block_ = llvm::BasicBlock::Create(context_, "exit");
 
-  for (const Statement* s : ast_f->body()) {
-    visit(s);
-  }
+  visitStatements(ast_f->body());
 
   builder_.CreateBr(exit_block_);
 
   f->insert(f->end(), exit_block_);
   builder_.SetInsertPoint(exit_block_);
 
-  if (return_var_) {
-    builder_.CreateRet(builder_.CreateLoad(f->getReturnType(), return_var_));
+  if (profile_site_) callRuntime("mc_profile_exit", {profile_site_});
+
+  llvm::Value* return_value = nullptr;
+  if (return_var_) return_value = builder_.CreateLoad(f->getReturnType(), return_var_);
+  if (options_.usdt) {
+    std::string probe = f->getName().str() + "__return";
+    if (return_value) {
+      emitProbe(probe, {return_value});
+    } else {
+      emitProbe(probe);
+    }
+  }
+  if (return_value) {
+    builder_.CreateRet(return_value);
   } else {
     builder_.CreateRetVoid();
   }
@@ -271,16 +659,18 @@ llvm::Value* IRGenerator::visitFunction(const Function* ast_f) {
 
   exit_block_ = nullptr;
   return_var_ = nullptr;
+  profile_site_ = nullptr;
 
   return f;
 }
 
 llvm::Value* IRGenerator::visitVardeclStatement(const VardeclStatement* s) {
   const auto& name = s->getVariable().getName();
-  llvm::AllocaInst* var = builder_.CreateAlloca(getIRType(s->getType()), nullptr, name);
-  if (!var_scopes_.define(name, var)) {
+  llvm::AllocaInst* var = createEntryBlockAlloca(getIRType(s->getType()), name);
+  if (!var_scopes_.defineLocal(name, var)) {
     error(&s->getVariable(), "redefining an existing variable");
   }
+  if (s->getType().isPointer()) pointee_types_[var] = s->getType().getBaseType();
   if (s->hasInitializer()) {
     llvm::Value* init = visit(s->getInitializer());
     auto original_init_type = init->getType();
@@ -290,33 +680,96 @@ llvm::Value* IRGenerator::visitVardeclStatement(const VardeclStatement* s) {
       error(s->getInitializer(), "cannot initialize variable of type", getSourceType(target_type),
             "with expression of type", getSourceType(original_init_type));
     }
+    checkPointeeType(s->getInitializer(), var);
     builder_.CreateStore(init, var);
+  } else if (options_.bounds_check && s->getType().isPointer()) {
+    // So that indexing it aborts, rather than reading through garbage.
+    builder_.CreateStore(llvm::ConstantPointerNull::get(builder_.getPtrTy()), var);
   }
   return var;
 }
 
 llvm::Value* IRGenerator::visitReturnStatement(const ReturnStatement* r) {
   if (r->hasExpression()) {
-    auto return_value = visit(r->getExpression());
-    auto original_return_type = return_value->getType();
+    auto value = visit(r->getExpression());
+    auto original_return_type = value->getType();
     auto return_type = return_var_->getAllocatedType();
-    return_value = ensureType(return_value, return_type);
+    auto return_value = ensureType(value, return_type);
     if (!return_value) {
       error(r->getExpression(), "cannot return expression of type", original_return_type,
             "from function of type", return_type);
     }
-    builder_.CreateStore(return_value, return_var_);
+    checkPointeeType(r->getExpression(), current_function());
+    // A tail call returns straight away, rather than through the exit block.
+    bool is_tail_call = r->getExpression()->isFunctionCall() &&
+                        emitTailCall(r->getExpression(), value, return_value);
+    if (!is_tail_call) {
+      builder_.CreateStore(return_value, return_var_);
+      builder_.CreateBr(exit_block_);
+    }
+  } else {
+    builder_.CreateBr(exit_block_);
   }
-  builder_.CreateBr(exit_block_);
-  // Code after the return will end up in this unreachable BB and DCE will
-  // take care of it.
+  // Code after the return goes in this block, which nothing branches to, and
+  // DCE drops it. The block is left open for that code, which ends it like
+  // any other, so that the IR is valid before it is optimized too, but it
+  // gets no lifetime markers.
   llvm::BasicBlock* after = llvm::BasicBlock::Create(context_, "return.after", current_function());
   builder_.SetInsertPoint(after);
-  // This one is not necessary, but will help catch codegen errors.
-  builder_.CreateUnreachable();
+  var_scopes_.setTerminated(true);
   return nullptr;
 }
 
+// A call whose result is returned as it is can reuse the stack frame of the
+// caller, so that recursion in tail position runs in constant stack space.
+// This is guaranteed with musttail when the callee has the same signature as
+// the caller, otherwise it is up to the backend. Nothing in the language can
+// take the address of a local, so the callee never sees the frame it replaces.
+bool IRGenerator::emitTailCall(const Expression* e, llvm::Value* call_value,
+                               llvm::Value* return_value) {
+  auto call = llvm::cast<llvm::CallInst>(call_value);
+  // The callee must return here for the profile to end, or it would be
+  // counted as called by the caller of this function.
+  if (profile_site_) {
+    if (options_.warn_tail_calls) {
+      warning(e, "not a tail call, functions are instrumented");
+    }
+    return false;
+  }
+  if (return_value != call) {
+    if (options_.warn_tail_calls) {
+      warning(e, "not a tail call, the result must be converted from",
+              getSourceType(call->getType()), "to", getSourceType(return_value->getType()));
+    }
+    return false;
+  }
+  if (call->getNextNode()) {
+    if (options_.warn_tail_calls) {
+      warning(e, "not a tail call, --bounds-check checks the conte it returns");
+    }
+    return false;
+  }
+  if (call->getFunctionType() == current_function()->getFunctionType()) {
+    call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  } else {
+    call->setTailCallKind(llvm::CallInst::TCK_Tail);
+    if (options_.warn_tail_calls) {
+      warning(e, "tail call not guaranteed, the parameters of",
+              call->getCalledFunction()->getName().str(), "differ from those of",
+              current_function()->getName().str());
+    }
+  }
+  // This takes the place of the return probe, which the tail call skips. The
+  // result is not known yet, so it has no arguments.
+  if (options_.usdt) {
+    llvm::IRBuilderBase::InsertPointGuard insert_point_guard{builder_};
+    builder_.SetInsertPoint(call);
+    emitProbe(current_function()->getName().str() + "__tailcall");
+  }
+  builder_.CreateRet(call);
+  return true;
+}
+
 llvm::Value* IRGenerator::visitAssignStatement(const AssignStatement* a) {
   auto val = visit(a->getExpression());
   assert(val && "unhandled error while building expression");
@@ -331,10 +784,25 @@ llvm::Value* IRGenerator::visitAssignStatement(const AssignStatement* a) {
     error(a->getExpression(), "cannot assign expression of type", getSourceType(original_val_type),
           "to variable of type", getSourceType(target_type));
   }
+  checkPointeeType(a->getExpression(), var);
   builder_.CreateStore(val, var);
   return nullptr;
 }
 
+llvm::Value* IRGenerator::visitElementAssignStatement(const ElementAssignStatement* a) {
+  llvm::Type* element_type;
+  llvm::Value* address = getElementAddress(a->getTarget(), &element_type);
+  auto val = visit(a->getExpression());
+  auto original_val_type = val->getType();
+  val = ensureType(val, element_type);
+  if (!val) {
+    error(a->getExpression(), "cannot assign expression of type", getSourceType(original_val_type),
+          "to element of type", getSourceType(element_type));
+  }
+  annotateElementAccess(builder_.CreateStore(val, address), element_type);
+  return nullptr;
+}
+
 llvm::Value* IRGenerator::evalBooleanCondition(const Expression* condition_expression) {
   llvm::Value* condition = visit(condition_expression);
   auto condition_type = condition->getType();
@@ -356,6 +824,47 @@ llvm::Value* IRGenerator::evalTruthiness(llvm::Value* val) {
   return builder_.CreateICmpNE(val, zero, "cond");
 }
 
+namespace {
+
+// Returns the constant of a case like `1:`, which compares the lead variable
+// for equality with an integer, or nullptr for any other case.
+const AtomicExpression* getSwitchCaseConstant(const BranchCase& branch_case) {
+  const Expression* condition = branch_case.getExpression();
+  if (condition->getClassType() != Expression::TYPE_BinaryExpression) return nullptr;
+  auto comparison = static_cast<const BinaryExpression*>(condition);
+  if (!comparison->isSemiExpression() || comparison->getType() != BinaryExpression::EQ) {
+    return nullptr;
+  }
+  const Expression* value = comparison->getRight();
+  if (value->getClassType() != Expression::TYPE_AtomicExpression) return nullptr;
+  auto constant = static_cast<const AtomicExpression*>(value);
+  return constant->getType() == AtomicExpression::INTEGER ? constant : nullptr;
+}
+
+// Below this, a switch is no better than the compares.
+const int MIN_SWITCH_CASES = 3;
+
+} // namespace
+
+// Returns the end of the leading cases that can go in a switch. These cases
+// have no side effects, so testing them all at once keeps the first match.
+BranchStatement::BranchCaseConstIter IRGenerator::findSwitchCasesEnd(const BranchStatement* b) {
+  auto lead_var = var_scopes_.lookup(b->getLeadVariable().getName());
+  if (!options_.lower_switches || !lead_var || !lead_var->getAllocatedType()->isIntegerTy()) {
+    return b->begin_cases();
+  }
+  llvm::SmallDenseSet<uint32_t, 16> values;
+  auto end = b->begin_cases();
+  for (; end != b->end_cases(); ++end) {
+    const AtomicExpression* constant = getSwitchCaseConstant(*end);
+    // Literals are 32 bits wide, and the compare would truncate them too.
+    if (!constant || !values.insert(static_cast<uint32_t>(constant->getIntValue())).second) {
+      break;
+    }
+  }
+  return end;
+}
+
 llvm::Value* IRGenerator::visitBranchStatement(const BranchStatement* b) {
   llvm::BasicBlock* entry_bb =
       llvm::BasicBlock::Create(context_, "branch.head", current_function());
@@ -364,13 +873,40 @@ llvm::Value* IRGenerator::visitBranchStatement(const BranchStatement* b) {
   builder_.CreateBr(entry_bb);
   builder_.SetInsertPoint(entry_bb);
 
-  llvm::BasicBlock* case_cond_bb =
-      llvm::BasicBlock::Create(context_, "branch.case.cond", current_function());
-
-  builder_.CreateBr(case_cond_bb);
+  // Every case is reached if the branch is, and the branch ends up after it
+  // if any case does not return.
+  bool terminated = var_scopes_.isTerminated();
+  bool exit_terminated = true;
+
+  llvm::BasicBlock* case_cond_bb = llvm::BasicBlock::Create(context_, "branch.case.cond");
+
+  auto next_case = b->begin_cases();
+  auto switch_end = findSwitchCasesEnd(b);
+  if (switch_end - next_case >= MIN_SWITCH_CASES) {
+    // As in the compares, the lead variable is widened to the type of literals.
+    auto lead = static_cast<const BinaryExpression*>(next_case->getExpression())->getLeft();
+    llvm::Value* lead_value = ensureType(visit(lead), builder_.getInt32Ty());
+    llvm::SwitchInst* dispatch =
+        builder_.CreateSwitch(lead_value, case_cond_bb, switch_end - next_case);
+    for (; next_case != switch_end; ++next_case) {
+      llvm::BasicBlock* case_body_bb =
+          llvm::BasicBlock::Create(context_, "branch.case.body", current_function());
+      dispatch->addCase(builder_.getInt32(getSwitchCaseConstant(*next_case)->getIntValue()),
+                        case_body_bb);
+      builder_.SetInsertPoint(case_body_bb);
+      var_scopes_.setTerminated(terminated);
+      visitStatements(next_case->body());
+      exit_terminated &= var_scopes_.isTerminated();
+      builder_.CreateBr(exit_bb);
+    }
+  } else {
+    builder_.CreateBr(case_cond_bb);
+  }
+  current_function()->insert(current_function()->end(), case_cond_bb);
   builder_.SetInsertPoint(case_cond_bb);
 
-  for (const BranchCase& branch_case : b->cases()) {
+  for (; next_case != b->end_cases(); ++next_case) {
+    const BranchCase& branch_case = *next_case;
     llvm::Value* condition = evalBooleanCondition(branch_case.getExpression());
 
     case_cond_bb = llvm::BasicBlock::Create(context_, "branch.case.cond");
@@ -379,28 +915,29 @@ llvm::Value* IRGenerator::visitBranchStatement(const BranchStatement* b) {
 
     builder_.CreateCondBr(condition, case_body_bb, case_cond_bb);
     builder_.SetInsertPoint(case_body_bb);
-    for (const Statement* s : branch_case.body()) {
-      visit(s);
-    }
+    var_scopes_.setTerminated(terminated);
+    visitStatements(branch_case.body());
+    exit_terminated &= var_scopes_.isTerminated();
     builder_.CreateBr(exit_bb);
     current_function()->insert(current_function()->end(), case_cond_bb);
     builder_.SetInsertPoint(case_cond_bb);
   }
 
+  var_scopes_.setTerminated(terminated);
   if (b->hasBranchElse()) {
     NestedScopes::Guard scope_guard{var_scopes_};
     llvm::BasicBlock* else_bb =
         llvm::BasicBlock::Create(context_, "branch.else", current_function());
     builder_.CreateBr(else_bb);
     builder_.SetInsertPoint(else_bb);
-    for (const Statement* s : b->getBranchElse()->body()) {
-      visit(s);
-    }
+    visitStatements(b->getBranchElse()->body());
   }
+  exit_terminated &= var_scopes_.isTerminated();
 
   builder_.CreateBr(exit_bb);
   current_function()->insert(current_function()->end(), exit_bb);
   builder_.SetInsertPoint(exit_bb);
+  var_scopes_.setTerminated(exit_terminated);
 
   return nullptr;
 }
@@ -412,11 +949,11 @@ llvm::Value* IRGenerator::visitLoopStatement(const LoopStatement* l) {
 
   {
     NestedScopes::Guard scope_guard{var_scopes_};
-    for (const Statement* s : l->body()) {
-      visit(s);
-    }
+    visitStatements(l->body());
   }
 
+  // If the body always returns, neither the condition nor what follows the
+  // loop are reached, and the generator stays terminated.
   llvm::BasicBlock* condition_bb =
       llvm::BasicBlock::Create(context_, "loop.condition", current_function());
   llvm::BasicBlock* after_bb = llvm::BasicBlock::Create(context_, "loop.after");
@@ -508,16 +1045,44 @@ llvm::Value* IRGenerator::visitInputStatement(const InputStatement* s) {
     error(&s->getVariable(), "can only read integers and floating point");
   }
 
+  if (options_.use_runtime_io) {
+    // The runtime returns what was read, or the current value if there was
+    // nothing to read, so that the variable does not escape.
+    llvm::Value* value = builder_.CreateLoad(target_type, var);
+    if (target_type->isFloatingPointTy()) {
+      bool is_float = target_type == builder_.getFloatTy();
+      value = callRuntime(is_float ? "mc_read_f32" : "mc_read_f64", value);
+    } else {
+      const char* reader = "mc_read_i32";
+      if (reading_bool) {
+        reader = "mc_read_bool";
+      } else if (target_type == builder_.getInt8Ty()) {
+        reader = "mc_read_char";
+      }
+      value = callRuntime(reader, builder_.CreateZExtOrTrunc(value, builder_.getInt32Ty()));
+      value = reading_bool ? evalTruthiness(value) : builder_.CreateTrunc(value, target_type);
+    }
+    builder_.CreateStore(value, var);
+    if (options_.usdt) emitProbe("input", {value});
+    return nullptr;
+  }
+
+  // A bool is read as an int, which is then converted.
   if (reading_bool) {
-    target = builder_.CreateAlloca(builder_.getInt32Ty());
+    target = createEntryBlockAlloca(builder_.getInt32Ty(), "input");
+    builder_.CreateLifetimeStart(target);
   }
 
   callIOBuiltin<false>(target_type, target);
 
   if (reading_bool) {
-    builder_.CreateStore(evalTruthiness(builder_.CreateLoad(target_type, target)), var);
+    auto input = builder_.CreateLoad(builder_.getInt32Ty(), target);
+    builder_.CreateLifetimeEnd(target);
+    builder_.CreateStore(evalTruthiness(input), var);
   }
 
+  if (options_.usdt) emitProbe("input", {builder_.CreateLoad(target_type, var)});
+
   return nullptr;
 }
 
@@ -527,6 +1092,7 @@ llvm::Value* IRGenerator::visitPrintStatement(const PrintStatement* p) {
   if (!type->isIntegerTy() && !type->isFloatingPointTy()) {
     error(p->getExpression(), "only integer and float valued expressions may be printed");
   }
+  if (options_.usdt) emitProbe("print", {value});
   // Integer promotion for variadic call.
   if (type->isIntegerTy() && type->getIntegerBitWidth() < 32) {
     value = builder_.CreateZExt(value, builder_.getInt32Ty());
@@ -535,7 +1101,13 @@ llvm::Value* IRGenerator::visitPrintStatement(const PrintStatement* p) {
   if (type == builder_.getFloatTy()) {
     value = builder_.CreateFPCast(value, builder_.getDoubleTy());
   }
-  callIOBuiltin<true>(type, value);
+  if (!options_.use_runtime_io) {
+    callIOBuiltin<true>(type, value);
+  } else if (type->isFloatingPointTy()) {
+    callRuntime("mc_print_f64", value);
+  } else {
+    callRuntime(type == builder_.getInt8Ty() ? "mc_print_char" : "mc_print_i32", value);
+  }
   return nullptr;
 }
 
@@ -553,6 +1125,10 @@ llvm::Value* IRGenerator::visitAssertStatement(const AssertStatement* a) {
   builder_.CreateCondBr(condition, success_bb, fail_bb);
 
   builder_.SetInsertPoint(fail_bb);
+  if (options_.usdt) {
+    int line = a->getExpression()->getFirstLocation().getLine();
+    emitProbe("assert__fail", {builder_.getInt32(line)});
+  }
   visitAbortStatement(nullptr);  // Assert is just a conditional abort.
   builder_.CreateBr(success_bb); // We will never get here, but LLVM does not know.
 
@@ -563,10 +1139,31 @@ llvm::Value* IRGenerator::visitAssertStatement(const AssertStatement* a) {
 llvm::Value* IRGenerator::visitAbortStatement(const AbortStatement*) {
   auto abort_builtin = module_->getFunction("abort");
   assert(abort_builtin && "Builtin abort was not declared");
+  // Exit handlers do not run on abort, so this is the last chance for output.
+  if (options_.use_runtime_io) callRuntime("mc_flush");
   builder_.CreateCall(abort_builtin);
   return nullptr;
 }
 
+namespace {
+
+llvm::FastMathFlags getFastMathFlags(FPModel model) {
+  llvm::FastMathFlags flags;
+  switch (model) {
+  case FPModel::STRICT:
+    break;
+  case FPModel::CONTRACT:
+    flags.setAllowContract();
+    break;
+  case FPModel::FAST:
+    flags.setFast();
+    break;
+  }
+  return flags;
+}
+
+} // namespace
+
 llvm::Value* IRGenerator::visitBinaryExpression(const BinaryExpression* e) {
   auto lhs = visit(e->getLeft());
   auto rhs = visit(e->getRight());
@@ -607,6 +1204,8 @@ llvm::Value* IRGenerator::visitBinaryExpression(const BinaryExpression* e) {
   }
 
   if (result_type->isFloatingPointTy()) {
+    llvm::IRBuilderBase::FastMathFlagGuard fast_math_guard{builder_};
+    builder_.setFastMathFlags(getFastMathFlags(options_.fp_model));
     switch (e->getType()) {
 #define RETURN_FLOAT_BINOP(NAME, OP) \
   case BinaryExpression::NAME: \
@@ -647,7 +1246,7 @@ llvm::Value* IRGenerator::visitAtomicExpression(const AtomicExpression* e) {
 }
 
 llvm::Value* IRGenerator::visitFunctionCallExpression(const FunctionCallExpression* ast_f) {
-  llvm::Function* f = module_->getFunction(ast_f->getFunctionName());
+  llvm::Function* f = getFunction(ast_f->getFunctionName());
   if (!f) {
     error(ast_f, "call to undefined function", ast_f->getFunctionName());
   }
@@ -662,11 +1261,182 @@ llvm::Value* IRGenerator::visitFunctionCallExpression(const FunctionCallExpressi
             "as argument of type", getSourceType(ir_arg->getType()), "in call to",
             ast_f->getFunctionName());
     }
+    checkPointeeType(ast_arg, &*ir_arg);
     call_args.push_back(arg);
     ++ir_arg;
   }
   assert(ir_arg == f->arg_end());
-  return builder_.CreateCall(f, call_args);
+  llvm::CallInst* call = builder_.CreateCall(f, call_args);
+  checkBuffer(call);
+  return call;
+}
+
+namespace {
+
+// Buffers from sbiriguda start with a header, which holds their number of
+// elements right before the first one, for --bounds-check to find. It is as
+// large as the alignment of calloc(), so that the elements keep it.
+const int BUFFER_HEADER_SIZE = 16;
+
+// The size of the builtin types, which is also their alignment.
+uint64_t getElementSize(llvm::Type* type) {
+  return std::max<uint64_t>(1, type->getPrimitiveSizeInBits() / 8);
+}
+
+} // namespace
+
+llvm::Value* IRGenerator::visitIndexExpression(const IndexExpression* e) {
+  llvm::Type* element_type;
+  llvm::Value* address = getElementAddress(e, &element_type);
+  return annotateElementAccess(builder_.CreateLoad(element_type, address), element_type);
+}
+
+llvm::Value* IRGenerator::visitAllocExpression(const AllocExpression* e) {
+  llvm::Value* count = visit(e->getCount());
+  if (!count->getType()->isIntegerTy()) {
+    error(e->getCount(), "the number of elements must be an integer, not",
+          getSourceType(count->getType()));
+  }
+  llvm::Type* element_type = getIRBaseType(e->getElementType());
+  uint64_t element_size = getElementSize(element_type);
+  count = builder_.CreateSExt(count, builder_.getInt64Ty(), "count");
+  // A negative count is as large as an unsigned number, so a single compare
+  // catches it along with the sizes that do not fit.
+  uint64_t max_count = (INT64_MAX - BUFFER_HEADER_SIZE) / element_size;
+  abortUnless(builder_.CreateICmpULE(count, builder_.getInt64(max_count), "count.valid"),
+              "alloc.count");
+  llvm::Value* size = builder_.CreateAdd(
+      builder_.CreateMul(count, builder_.getInt64(element_size), "", /*HasNUW=*/true,
+                         /*HasNSW=*/true),
+      builder_.getInt64(BUFFER_HEADER_SIZE), "size", /*HasNUW=*/true, /*HasNSW=*/true);
+  llvm::Value* buffer = callRuntime("calloc", {builder_.getInt64(1), size});
+  abortUnless(builder_.CreateIsNotNull(buffer, "buffer.valid"), "alloc.memory");
+  llvm::Value* elements =
+      builder_.CreateConstInBoundsGEP1_64(builder_.getInt8Ty(), buffer, BUFFER_HEADER_SIZE);
+  llvm::Value* length_address =
+      builder_.CreateConstInBoundsGEP1_64(builder_.getInt8Ty(), buffer, BUFFER_HEADER_SIZE - 8);
+  builder_.CreateAlignedStore(count, length_address, llvm::Align(8));
+  if (options_.bounds_check && options_.track_buffers) {
+    callRuntime("mc_register_buffer", {elements});
+  }
+  return elements;
+}
+
+// The buffer of a conte is as long as the program says it is, so the address
+// of an element is inbounds, which lets the optimizer reason about it.
+llvm::Value* IRGenerator::getElementAddress(const IndexExpression* e, llvm::Type** element_type) {
+  llvm::Value* pointer = visit(e->getPointer());
+  if (!pointer->getType()->isPointerTy()) {
+    error(e->getPointer(), "cannot index expression of type", getSourceType(pointer->getType()));
+  }
+  llvm::Value* index = visit(e->getIndex());
+  if (!index->getType()->isIntegerTy()) {
+    error(e->getIndex(), "index must be an integer, not", getSourceType(index->getType()));
+  }
+  index = builder_.CreateSExt(index, builder_.getInt64Ty(), "index");
+  if (options_.bounds_check) checkBounds(pointer, index);
+
+  auto pointee_type = getPointeeType(e->getPointer());
+  assert(pointee_type && "Every conte has a known pointee type");
+  *element_type = getIRBaseType(*pointee_type);
+  return builder_.CreateInBoundsGEP(*element_type, pointer, index, "element");
+}
+
+// A negative index is as large as an unsigned number, so a single compare
+// catches both ends. The number of elements is only read once the conte is
+// known not to be null. Whether it came from sbiriguda at all is up to
+// checkBuffer().
+void IRGenerator::checkBounds(llvm::Value* pointer, llvm::Value* index) {
+  abortUnless(builder_.CreateIsNotNull(pointer, "not.null"), "bounds.null");
+  llvm::Value* length_address =
+      builder_.CreateConstInBoundsGEP1_64(builder_.getInt8Ty(), pointer, -8);
+  llvm::Value* length =
+      builder_.CreateAlignedLoad(builder_.getInt64Ty(), length_address, llvm::Align(8), "length");
+  abortUnless(builder_.CreateICmpULT(index, length, "in.bounds"), "bounds");
+}
+
+// A conte that a supercazzola did not make itself could have come from C
+// code, so it is checked as it comes in, once rather than at every access.
+void IRGenerator::checkBuffer(llvm::Value* pointer) {
+  if (!options_.bounds_check || !options_.track_buffers || !pointer->getType()->isPointerTy()) {
+    return;
+  }
+  callRuntime("mc_check_buffer", {pointer});
+}
+
+void IRGenerator::abortUnless(llvm::Value* condition, const char* name) {
+  std::string prefix = name;
+  llvm::BasicBlock* fail_bb =
+      llvm::BasicBlock::Create(context_, prefix + ".fail", current_function());
+  llvm::BasicBlock* success_bb =
+      llvm::BasicBlock::Create(context_, prefix + ".success", current_function());
+  builder_.CreateCondBr(condition, success_bb, fail_bb);
+
+  builder_.SetInsertPoint(fail_bb);
+  visitAbortStatement(nullptr);
+  builder_.CreateUnreachable();
+
+  builder_.SetInsertPoint(success_bb);
+}
+
+template<typename Access>
+Access* IRGenerator::annotateElementAccess(Access* access, llvm::Type* type) {
+  access->setAlignment(llvm::Align(getElementSize(type)));
+  access->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(type));
+  return access;
+}
+
+// Nothing in the language can look at an element as another type, so
+// elements of different types never alias. C code has a type tree of its own,
+// which the optimizer assumes may alias this one.
+llvm::MDNode* IRGenerator::getTBAATag(llvm::Type* type) {
+  auto hit = tbaa_tags_.find(type);
+  if (hit != tbaa_tags_.end()) return hit->second;
+  llvm::MDBuilder md_builder{context_};
+  if (!tbaa_root_) tbaa_root_ = md_builder.createTBAARoot("Monicelli TBAA");
+  llvm::MDNode* type_node = md_builder.createTBAAScalarTypeNode(getSourceBaseType(type),
+                                                                tbaa_root_);
+  llvm::MDNode* tag = md_builder.createTBAAStructTagNode(type_node, type_node, 0);
+  tbaa_tags_.insert({type, tag});
+  return tag;
+}
+
+// Returns the type that a conte expression points to, or nullopt if the
+// expression is not a conte.
+std::optional<VarType::BaseType> IRGenerator::getPointeeType(const Expression* e) {
+  const llvm::Value* source = nullptr;
+  switch (e->getClassType()) {
+  case Expression::TYPE_AllocExpression:
+    return static_cast<const AllocExpression*>(e)->getElementType();
+  case Expression::TYPE_AtomicExpression: {
+    auto atom = static_cast<const AtomicExpression*>(e);
+    if (atom->getType() == AtomicExpression::IDENTIFIER) {
+      source = var_scopes_.lookup(atom->getIdentifierValue().getName());
+    }
+    break;
+  }
+  case Expression::TYPE_FunctionCallExpression:
+    source = getFunction(static_cast<const FunctionCallExpression*>(e)->getFunctionName());
+    break;
+  default:
+    break;
+  }
+  if (!source) return std::nullopt;
+  auto pointee_type = pointee_types_.find(source);
+  if (pointee_type == pointee_types_.end()) return std::nullopt;
+  return pointee_type->second;
+}
+
+// Every conte converts to any other as far as the IR is concerned, so the
+// types they point to are compared here.
+void IRGenerator::checkPointeeType(const Expression* e, const llvm::Value* target) {
+  auto target_type = pointee_types_.find(target);
+  if (target_type == pointee_types_.end()) return;
+  auto type = getPointeeType(e);
+  if (type && *type != target_type->second) {
+    error(e, "cannot convert conte", getSourceBaseType(getIRBaseType(*type)), "to conte",
+          getSourceBaseType(getIRBaseType(target_type->second)));
+  }
 }
 
 llvm::Type* IRGenerator::getIRBaseType(VarType::BaseType type) {
@@ -753,20 +1523,189 @@ llvm::Type* ResultTypeCalculator::visitAtomicExpression(const AtomicExpression*
 }
 
 llvm::Type* ResultTypeCalculator::visitFunctionCallExpression(const FunctionCallExpression* e) {
-  auto f = codegen_->module_->getFunction(e->getFunctionName());
+  auto f = codegen_->getFunction(e->getFunctionName());
   assert(f);
   return f->getReturnType();
 }
 
+llvm::Type* ResultTypeCalculator::visitIndexExpression(const IndexExpression* e) {
+  auto pointee_type = codegen_->getPointeeType(e->getPointer());
+  assert(pointee_type);
+  return codegen_->getIRBaseType(*pointee_type);
+}
+
+llvm::Type* ResultTypeCalculator::visitAllocExpression(const AllocExpression*) {
+  return codegen_->builder_.getPtrTy();
+}
+
 namespace monicelli {
 
-std::unique_ptr<llvm::Module> generateIR(llvm::LLVMContext& context, Module* ast) {
-  IRGenerator codegen{context, ast->getSourceFilename()};
-  codegen.visit(ast);
+std::unique_ptr<llvm::Module> generateIR(llvm::LLVMContext& context, Module* ast,
+                                         DiagnosticSink* sink, const CodegenOptions& options) {
+  int errors_before = sink ? sink->getErrorsCount() : 0;
+  IRGenerator codegen{context, ast->getSourceFilename(), sink, options};
+  try {
+    codegen.visit(ast);
+  } catch (const FatalError&) {
+    return nullptr;
+  }
+  if (sink && sink->getErrorsCount() > errors_before) return nullptr;
   return codegen.releaseModule();
 }
 
+namespace {
+
+// Supercazzole are generated in groups of this many consecutive ones, each in a
+// context of its own. Larger groups make less to link, smaller ones balance
+// better. They do not depend on the number of threads, so neither does the IR.
+const size_t FUNCTIONS_PER_CONTEXT = 64;
+
+double getSecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The output of a worker, as bitcode since it cannot leave its context.
+struct FunctionGroup {
+  llvm::ArrayRef<const Function*> functions;
+  DiagnosticSink sink{0};
+  llvm::SmallVector<char, 0> bitcode;
+  std::vector<std::pair<std::string, FunctionSize>> unoptimized_sizes;
+  double seconds = 0;
+  double optimizer_seconds = 0;
+};
+
+void generateFunctionGroup(FunctionGroup* group, const std::string& source_filename,
+                           const llvm::StringMap<const Function*>& prototypes,
+                           const CodegenOptions& options) {
+  auto start = std::chrono::steady_clock::now();
+  llvm::LLVMContext context;
+  IRGenerator codegen{context, source_filename, &group->sink, options};
+  try {
+    codegen.visitFunctions(group->functions, &prototypes);
+  } catch (const FatalError&) {
+    return;
+  }
+  if (group->sink.hasErrors()) return;
+
+  std::unique_ptr<llvm::Module> module = codegen.releaseModule();
+  for (const llvm::Function& f : *module) {
+    if (f.isDeclaration()) continue;
+    FunctionSize size{f.getInstructionCount(), static_cast<unsigned>(f.size())};
+    group->unoptimized_sizes.emplace_back(f.getName().str(), size);
+  }
+  auto optimizer_start = std::chrono::steady_clock::now();
+  {
+    // Untimed, the phase only shows up in the time trace of the worker.
+    PhaseTimer timer{PHASE_OPTIMIZE, nullptr};
+    runFunctionOptimizer(module.get());
+  }
+  group->optimizer_seconds = getSecondsSince(optimizer_start);
+
+  llvm::raw_svector_ostream output{group->bitcode};
+  llvm::WriteBitcodeToFile(*module, output);
+  group->seconds = getSecondsSince(start);
+}
+
+} // namespace
+
+std::unique_ptr<llvm::Module> generateIRInParallel(llvm::LLVMContext& context, Module* ast,
+                                                   DiagnosticSink* sink,
+                                                   const CodegenOptions& options,
+                                                   unsigned threads, ParallelIRReport* report) {
+  assert(sink && "Errors cannot end the program from a worker thread");
+
+  // Names are checked before the supercazzole are split among contexts, so
+  // that the groups link without clashes.
+  try {
+    IRGenerator checker{context, ast->getSourceFilename(), sink, options};
+    if (!checker.checkUniqueNames(ast)) return nullptr;
+  } catch (const FatalError&) {
+    return nullptr;
+  }
+
+  std::vector<const Function*> functions;
+  for (const Function* f : ast->functions()) functions.push_back(f);
+  if (ast->hasEntryPoint()) functions.push_back(ast->getEntryPoint());
+  llvm::StringMap<const Function*> prototypes;
+  for (const Function* f : functions) {
+    prototypes.try_emplace(f->isEntryPoint() ? "main" : f->getName(), f);
+  }
+
+  std::vector<FunctionGroup> groups((functions.size() + FUNCTIONS_PER_CONTEXT - 1) /
+                                    FUNCTIONS_PER_CONTEXT);
+  for (size_t i = 0; i < groups.size(); ++i) {
+    groups[i].functions = llvm::ArrayRef<const Function*>(functions)
+                              .slice(i * FUNCTIONS_PER_CONTEXT)
+                              .take_front(FUNCTIONS_PER_CONTEXT);
+  }
+
+  std::atomic<size_t> next_group{0};
+  auto worker = [&]() {
+    // Each worker shows up in the time trace on a track of its own.
+    TimeTraceThread trace_thread;
+    for (size_t i = next_group++; i < groups.size(); i = next_group++) {
+      generateFunctionGroup(&groups[i], ast->getSourceFilename(), prototypes, options);
+    }
+  };
+  // The calling thread is one of the workers.
+  std::vector<std::thread> workers;
+  size_t workers_count = std::min<size_t>(threads, groups.size());
+  for (size_t i = 1; i < workers_count; ++i) workers.emplace_back(worker);
+  worker();
+  for (std::thread& thread : workers) thread.join();
+
+  // Diagnostics come in the order of the source, whichever thread found them.
+  int errors_before = sink->getErrorsCount();
+  for (const FunctionGroup& group : groups) {
+    for (const Diagnostic& diagnostic : group.sink) {
+      if (!sink->report(diagnostic)) return nullptr;
+    }
+  }
+  if (sink->getErrorsCount() > errors_before) return nullptr;
+
+  if (report) {
+    for (FunctionGroup& group : groups) {
+      report->worker_seconds += group.seconds;
+      report->optimizer_seconds += group.optimizer_seconds;
+      for (auto& size : group.unoptimized_sizes) {
+        report->unoptimized_sizes.try_emplace(size.first, size.second);
+      }
+    }
+  }
+
+  auto module = std::make_unique<llvm::Module>("antani", context);
+  llvm::Linker linker{*module};
+  for (const FunctionGroup& group : groups) {
+    llvm::StringRef bitcode{group.bitcode.data(), group.bitcode.size()};
+    auto group_module = llvm::parseBitcodeFile(llvm::MemoryBufferRef{bitcode, "antani"}, context);
+    if (!group_module) UNREACHABLE(llvm::toString(group_module.takeError()));
+    if (linker.linkInModule(std::move(*group_module))) {
+      UNREACHABLE("Supercazzole with unique names cannot clash");
+    }
+  }
+
+  if (options.whole_program && ast->hasEntryPoint()) internalizeWholeProgram(module.get());
+  llvm::verifyModule(*module);
+  return module;
+}
+
+void checkFunctions(llvm::LLVMContext& context, const Module* ast,
+                    const llvm::StringMap<const Function*>& prototypes, DiagnosticSink* sink) {
+  IRGenerator codegen{context, ast->getSourceFilename(), sink, CodegenOptions{}};
+  try {
+    codegen.checkFunctions(ast, &prototypes);
+  } catch (const FatalError&) {
+  }
+}
+
 void runFunctionOptimizer(llvm::Module* module) {
+  std::vector<llvm::Function*> functions;
+  for (llvm::Function& f : module->functions()) functions.push_back(&f);
+  runFunctionOptimizer(module, functions);
+}
+
+void runFunctionOptimizer(llvm::Module* module, llvm::ArrayRef<llvm::Function*> functions) {
+  if (functions.empty()) return;
   llvm::legacy::FunctionPassManager pass_manager{module};
   pass_manager.add(llvm::createInstructionCombiningPass());
   pass_manager.add(llvm::createReassociatePass());
@@ -775,11 +1714,69 @@ void runFunctionOptimizer(llvm::Module* module) {
   pass_manager.add(llvm::createDeadCodeEliminationPass());
   pass_manager.add(llvm::createPromoteMemoryToRegisterPass());
   pass_manager.doInitialization();
-  for (llvm::Function& f : module->functions()) {
-    pass_manager.run(f);
+  // The pass manager adds its own OptFunction and RunPass spans to the trace.
+  for (llvm::Function* f : functions) {
+    pass_manager.run(*f);
   }
 }
 
+void runWholeProgramOptimizer(llvm::Module* module) {
+  llvm::LoopAnalysisManager loop_analyses;
+  llvm::FunctionAnalysisManager function_analyses;
+  llvm::CGSCCAnalysisManager cgscc_analyses;
+  llvm::ModuleAnalysisManager module_analyses;
+  llvm::PassBuilder pass_builder;
+  pass_builder.registerModuleAnalyses(module_analyses);
+  pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+  pass_builder.registerFunctionAnalyses(function_analyses);
+  pass_builder.registerLoopAnalyses(loop_analyses);
+  pass_builder.crossRegisterProxies(loop_analyses, function_analyses, cgscc_analyses,
+                                    module_analyses);
+
+  llvm::ModulePassManager pass_manager;
+  pass_manager.addPass(llvm::IPSCCPPass());
+  // Functions that are never called are dropped before the inliner looks at
+  // them, and those that are inlined everywhere after.
+  pass_manager.addPass(llvm::GlobalDCEPass());
+  // Callees are visited before their callers, so that each function is
+  // simplified, with its attributes inferred, before being inlined.
+  llvm::ModuleInlinerWrapperPass inliner{llvm::getInlineParams()};
+  inliner.getPM().addPass(llvm::PostOrderFunctionAttrsPass());
+  inliner.getPM().addPass(llvm::ArgumentPromotionPass());
+  llvm::FunctionPassManager simplify;
+  simplify.addPass(llvm::InstCombinePass());
+  simplify.addPass(llvm::SimplifyCFGPass());
+  inliner.getPM().addPass(llvm::createCGSCCToFunctionPassAdaptor(std::move(simplify)));
+  pass_manager.addPass(std::move(inliner));
+  pass_manager.addPass(llvm::GlobalDCEPass());
+  pass_manager.run(*module, module_analyses);
+}
+
+void runLoopVectorizer(llvm::Module* module, llvm::TargetMachine* target_machine) {
+  llvm::LoopAnalysisManager loop_analyses;
+  llvm::FunctionAnalysisManager function_analyses;
+  llvm::CGSCCAnalysisManager cgscc_analyses;
+  llvm::ModuleAnalysisManager module_analyses;
+  // The target decides how wide the vectors are, and whether they pay off.
+  llvm::PassBuilder pass_builder{target_machine};
+  pass_builder.registerModuleAnalyses(module_analyses);
+  pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+  pass_builder.registerFunctionAnalyses(function_analyses);
+  pass_builder.registerLoopAnalyses(loop_analyses);
+  pass_builder.crossRegisterProxies(loop_analyses, function_analyses, cgscc_analyses,
+                                    module_analyses);
+
+  llvm::FunctionPassManager pass_manager;
+  pass_manager.addPass(llvm::LoopVectorizePass());
+  // Vectorized loops come with a scalar copy for the remainder, and checks
+  // that are often known to pass.
+  pass_manager.addPass(llvm::InstCombinePass());
+  pass_manager.addPass(llvm::SimplifyCFGPass());
+  llvm::ModulePassManager module_pass_manager;
+  module_pass_manager.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(pass_manager)));
+  module_pass_manager.run(*module, module_analyses);
+}
+
 void printIR(std::ostream& stream, llvm::Module* module) {
   llvm::raw_os_ostream llvm_stream{stream};
   module->print(llvm_stream, nullptr);
@@ -4,17 +4,111 @@
 // Copyright 2017 the Monicelli project authors. All rights reserved.
 // Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
 #include <memory>
+#include <vector>
 
 namespace monicelli {
 
+class DiagnosticSink;
+class Function;
 class Module;
 
-std::unique_ptr<llvm::Module> generateIR(llvm::LLVMContext& context, Module* ast);
+// How freely float operations can be rewritten, from exact IEEE semantics, to
+// fusing multiplies and adds, to anything that is correct for real numbers.
+enum class FPModel { STRICT, CONTRACT, FAST };
+
+struct CodegenOptions {
+  // Whether a branch whose cases compare the lead variable with integer
+  // constants is lowered to a switch, rather than to a chain of compares.
+  bool lower_switches = true;
+  // Whether print and input statements call the buffered output and input
+  // of the Monicelli runtime, rather than printf and scanf.
+  bool use_runtime_io = true;
+  // Whether to warn about calls whose result is returned, but which cannot be
+  // guaranteed to be tail calls.
+  bool warn_tail_calls = false;
+  // Whether a module with an entry point is the whole program, so that the
+  // other functions that it defines are internal to it.
+  bool whole_program = false;
+  // Whether indexing a conte checks the index against the number of elements
+  // of the buffer, aborting if it is out of bounds or the conte is null. This
+  // only works for buffers from sbiriguda, which keep their number of
+  // elements.
+  bool bounds_check = false;
+  // Whether the runtime keeps track of the buffers from sbiriguda, so that
+  // with bounds_check a conte from anywhere else aborts before it is indexed.
+  bool track_buffers = false;
+  // Which rewrites float arithmetic and comparisons allow. Relaxed models are
+  // also recorded in the attributes of each supercazzola, so that they carry
+  // over to the backend and to bitcode linked later.
+  FPModel fp_model = FPModel::STRICT;
+  // Whether each supercazzola counts its calls and cycles in the runtime, and
+  // whether the entry point asks for the profile as JSON rather than text.
+  bool instrument_functions = false;
+  bool profile_json = false;
+  // Whether to emit USDT probes, like those of sys/sdt.h, at the entry and
+  // return of each supercazzola, at input and output, and at failed asserts.
+  bool usdt = false;
+};
+
+// With a sink, errors are collected there, and nullptr is returned if there
+// were any. Otherwise, the first error ends the program.
+std::unique_ptr<llvm::Module> generateIR(llvm::LLVMContext& context, Module* ast,
+                                         DiagnosticSink* sink = nullptr,
+                                         const CodegenOptions& options = CodegenOptions{});
+
+// The size of a supercazzola in the IR.
+struct FunctionSize {
+  unsigned instructions = 0;
+  unsigned blocks = 0;
+};
+
+// What the workers of generateIRInParallel() tell about the function
+// optimizer, which they run along with IR generation.
+struct ParallelIRReport {
+  // Seconds that the workers spent on their groups, added up over all of them,
+  // and the part of those in the function optimizer.
+  double worker_seconds = 0;
+  double optimizer_seconds = 0;
+  // The size of each supercazzola before the function optimizer ran on it.
+  llvm::StringMap<FunctionSize> unoptimized_sizes;
+};
+
+// Same as generateIR() followed by runFunctionOptimizer(), but on threads
+// threads. Groups of supercazzole are generated and optimized each in an
+// LLVMContext of its own, which declares the others as they are called, then
+// linked together in context. The IR does not depend on the number of threads.
+// Errors are collected in the sink, which cannot be nullptr.
+std::unique_ptr<llvm::Module> generateIRInParallel(llvm::LLVMContext& context, Module* ast,
+                                                   DiagnosticSink* sink,
+                                                   const CodegenOptions& options,
+                                                   unsigned threads,
+                                                   ParallelIRReport* report = nullptr);
+
+// Generates and throws away the IR of the functions in ast, reporting any error
+// to the sink. Functions of other modules can be called if they are in
+// prototypes, by name, and only those that are called get declared. This is
+// how the language server re-checks only the functions touched by an edit,
+// without going through the whole file.
+void checkFunctions(llvm::LLVMContext& context, const Module* ast,
+                    const llvm::StringMap<const Function*>& prototypes, DiagnosticSink* sink);
 
 void runFunctionOptimizer(llvm::Module* module);
+// Same, but only on some of the functions of module.
+void runFunctionOptimizer(llvm::Module* module, llvm::ArrayRef<llvm::Function*> functions);
+
+// Runs the interprocedural passes, which can do much more after generateIR()
+// made the functions of a whole program internal. Goes after
+// runFunctionOptimizer(), which puts the functions in SSA form.
+void runWholeProgramOptimizer(llvm::Module* module);
+
+// Vectorizes the loops that the target can run faster that way, such as those
+// over the elements of a buffer. Goes after runFunctionOptimizer().
+void runLoopVectorizer(llvm::Module* module, llvm::TargetMachine* target_machine);
 
 void printIR(std::ostream& stream, llvm::Module* module);
 
@@ -0,0 +1,516 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "document.h"
+#include "ast-visitor.h"
+#include "codegen.h"
+#include "parser.h"
+
+#include "llvm/ADT/STLExtras.h"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <sstream>
+
+using namespace monicelli;
+
+namespace {
+
+// Columns in locations count bytes, while the protocol counts UTF-16 code
+// units. Code points beyond the BMP take 4 bytes in UTF-8 and 2 units in UTF-16.
+int countUTF16Units(const char* begin, const char* end) {
+  int units = 0;
+  for (const char* p = begin; p < end; ++p) {
+    unsigned char c = *p;
+    if ((c & 0xC0) == 0x80) continue;
+    units += c >= 0xF0 ? 2 : 1;
+  }
+  return units;
+}
+
+const char* skipUTF16Units(const char* begin, const char* end, int units) {
+  const char* p = begin;
+  while (p < end && *p != '\n' && units > 0) {
+    units -= static_cast<unsigned char>(*p) >= 0xF0 ? 2 : 1;
+    ++p;
+    while (p < end && (static_cast<unsigned char>(*p) & 0xC0) == 0x80) ++p;
+  }
+  return p;
+}
+
+bool isWithin(const Location& target, const Location& from, const Location& to) {
+  if (target.getLine() < from.getLine() || target.getLine() > to.getLine()) return false;
+  if (target.getLine() == from.getLine() && target.getColumn() < from.getColumn()) return false;
+  // The last location is one past the end, but a cursor right after a name
+  // is still meant to be on it.
+  if (target.getLine() == to.getLine() && target.getColumn() > to.getColumn()) return false;
+  return true;
+}
+
+const char* getSourceTypeName(VarType::BaseType type) {
+  switch (type) {
+#define RETURN_SOURCE_NAME(NAME, _1, _2, _3, SOURCE_NAME, _4) \
+  case VarType::NAME: \
+    return SOURCE_NAME;
+    BUILTIN_TYPES(RETURN_SOURCE_NAME)
+#undef RETURN_SOURCE_NAME
+  default:
+    UNREACHABLE("Unhandled VarType::BaseType.");
+  }
+}
+
+std::string getSourceType(const VarType& type) {
+  std::string name = getSourceTypeName(type.getBaseType());
+  return type.isPointer() ? "conte " + name : name;
+}
+
+std::string describeFunction(const Function* f) {
+  if (f->isEntryPoint()) return "Lei ha clacsonato";
+  std::string description = "blinda la supercazzola ";
+  if (!f->getReturnType().isVoid()) description += getSourceType(f->getReturnType()) + ' ';
+  description += f->getName();
+  const char* separator = " con ";
+  for (const FunctionParam& param : f->params()) {
+    description += separator + param.getArg().getName() + ' ' + getSourceType(param.getType());
+    separator = ", ";
+  }
+  return description + " o scherziamo?";
+}
+
+// What callers depend on, unlike the names of the parameters.
+std::string getSignature(const Function* f) {
+  std::string signature = f->getReturnType().isVoid() ? "" : getSourceType(f->getReturnType());
+  for (const FunctionParam& param : f->params()) signature += ", " + getSourceType(param.getType());
+  return signature;
+}
+
+// Resolves every variable to its declaration, with the same scoping rules
+// as IR generation, looking for the symbol at the target location, if any.
+// Also collects the names of all the functions that are called.
+class SymbolResolver final : public ConstAstVisitor<SymbolResolver, void> {
+public:
+  struct Declaration {
+    const Variable* variable;
+    VarType type;
+    bool is_param;
+  };
+
+  SymbolResolver(const Location* target, llvm::StringSet<>* callees)
+      : target_(target), callees_(callees), found_(false), found_variable_(nullptr),
+        found_declaration_(nullptr), found_function_(nullptr), found_call_(nullptr) {}
+
+  bool isFound() const { return found_; }
+  const Variable* getFoundVariable() const { return found_variable_; }
+  const Declaration* getFoundDeclaration() const { return found_declaration_; }
+  const Function* getFoundFunction() const { return found_function_; }
+  const FunctionCallExpression* getFoundCall() const { return found_call_; }
+
+  void visitModule(const Module* m) {
+    for (const Function* f : m->functions()) visit(f);
+    if (m->hasEntryPoint()) visit(m->getEntryPoint());
+  }
+  void visitFunction(const Function* f) {
+    if (hits(f->getFirstLocation(), f->getLastLocation())) {
+      found_ = true;
+      found_function_ = f;
+    }
+    visible_.clear();
+    scope_starts_.clear();
+    for (const FunctionParam& param : f->params()) {
+      declare(param.getArg(), param.getType(), true);
+    }
+    visitBody(f->body());
+  }
+  void visitAssertStatement(const AssertStatement* s) { visit(s->getExpression()); }
+  void visitExpressionStatement(const ExpressionStatement* s) { visit(s->getExpression()); }
+  void visitInputStatement(const InputStatement* s) { use(s->getVariable()); }
+  void visitAbortStatement(const AbortStatement*) {}
+  void visitBranchStatement(const BranchStatement* s) {
+    use(s->getLeadVariable());
+    for (const BranchCase& c : s->cases()) {
+      visit(c.getExpression());
+      visitBody(c.body());
+    }
+    if (s->hasBranchElse()) {
+      enterScope();
+      visitBody(s->getBranchElse()->body());
+      leaveScope();
+    }
+  }
+  void visitVardeclStatement(const VardeclStatement* s) {
+    declare(s->getVariable(), s->getType(), false);
+    if (s->hasInitializer()) visit(s->getInitializer());
+  }
+  void visitLoopStatement(const LoopStatement* s) {
+    enterScope();
+    visitBody(s->body());
+    leaveScope();
+    visit(s->getCondition());
+  }
+  void visitReturnStatement(const ReturnStatement* s) {
+    if (s->hasExpression()) visit(s->getExpression());
+  }
+  void visitPrintStatement(const PrintStatement* s) { visit(s->getExpression()); }
+  void visitAssignStatement(const AssignStatement* s) {
+    visit(s->getExpression());
+    use(s->getVariable());
+  }
+  void visitElementAssignStatement(const ElementAssignStatement* s) {
+    visit(s->getTarget());
+    visit(s->getExpression());
+  }
+  void visitFunctionCallExpression(const FunctionCallExpression* e) {
+    if (callees_) callees_->insert(e->getFunctionName());
+    for (const Expression* arg : e->args()) visit(arg);
+    // The call spans its arguments, which are more specific, so it only
+    // counts if none of them was hit.
+    if (hits(e->getFirstLocation(), e->getLastLocation())) {
+      found_ = true;
+      found_call_ = e;
+    }
+  }
+  void visitBinaryExpression(const BinaryExpression* e) {
+    // The left side of a semi-expression is the lead variable of the branch.
+    if (!e->isSemiExpression()) visit(e->getLeft());
+    visit(e->getRight());
+  }
+  void visitAtomicExpression(const AtomicExpression* e) {
+    if (e->getType() == AtomicExpression::IDENTIFIER) use(e->getIdentifierValue());
+  }
+  void visitIndexExpression(const IndexExpression* e) {
+    visit(e->getPointer());
+    visit(e->getIndex());
+  }
+  void visitAllocExpression(const AllocExpression* e) { visit(e->getCount()); }
+
+private:
+  template<typename Range> void visitBody(const Range& body) {
+    for (const Statement* s : body) visit(s);
+  }
+
+  bool hits(const Location& from, const Location& to) const {
+    return target_ && !found_ && isWithin(*target_, from, to);
+  }
+
+  void enterScope() { scope_starts_.push_back(visible_.size()); }
+  void leaveScope() {
+    visible_.resize(scope_starts_.back());
+    scope_starts_.pop_back();
+  }
+
+  void declare(const Variable& variable, const VarType& type, bool is_param) {
+    declarations_.push_back({&variable, type, is_param});
+    visible_.push_back(&declarations_.back());
+    if (hits(variable.getFirstLocation(), variable.getLastLocation())) {
+      found_ = true;
+      found_variable_ = &variable;
+      found_declaration_ = visible_.back();
+    }
+  }
+
+  void use(const Variable& variable) {
+    if (!hits(variable.getFirstLocation(), variable.getLastLocation())) return;
+    found_ = true;
+    found_variable_ = &variable;
+    for (auto d = visible_.crbegin(), end = visible_.crend(); d != end; ++d) {
+      if ((*d)->variable->getName() == variable.getName()) {
+        found_declaration_ = *d;
+        break;
+      }
+    }
+  }
+
+  const Location* target_;
+  llvm::StringSet<>* callees_;
+
+  // Owns the declarations, so that pointers to them stay valid.
+  std::list<Declaration> declarations_;
+  std::vector<const Declaration*> visible_;
+  std::vector<size_t> scope_starts_;
+
+  bool found_;
+  const Variable* found_variable_;
+  const Declaration* found_declaration_;
+  const Function* found_function_;
+  const FunctionCallExpression* found_call_;
+};
+
+} // namespace
+
+namespace monicelli {
+
+Document::Document(const std::string& source_filename, const std::string& text)
+    : source_filename_(source_filename), stats_{0, 0} {
+  chunks_.emplace_back(new Chunk);
+  replace(text);
+}
+
+// This mirrors the lexer, which reads these two as a function declaration or
+// as the entry point wherever they are, even as the prefix of a longer word.
+bool Document::isChunkStart(const char* line, const char* end) {
+  static const char* const starts[] = {
+      "blinda la supercazzola",
+      "blinda la supercazzora",
+      "Lei ha clacsonato",
+  };
+  while (line < end && (*line == ' ' || *line == '\t')) ++line;
+  for (const char* start : starts) {
+    size_t length = strlen(start);
+    if (static_cast<size_t>(end - line) >= length && memcmp(line, start, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int Document::findChunk(int line) const {
+  auto after = std::upper_bound(chunks_.begin(), chunks_.end(), line,
+                                [](int line, const std::unique_ptr<Chunk>& chunk) {
+                                  return line < chunk->first_line;
+                                });
+  return std::max<int>(0, after - chunks_.begin() - 1);
+}
+
+void Document::edit(const Range& range, const std::string& text) {
+  int first = findChunk(range.start.line);
+  int last = findChunk(range.end.line);
+
+  std::string region;
+  size_t start = 0, end = 0;
+  for (int i = first; i <= last; ++i) {
+    const Chunk* chunk = chunks_[i].get();
+    if (i == first) start = region.size() + getOffset(chunk, range.start);
+    if (i == last) end = region.size() + getOffset(chunk, range.end);
+    region += chunk->text;
+  }
+  end = std::max(start, end);
+  region.replace(start, end - start, text);
+
+  replaceChunks(first, last, region);
+}
+
+void Document::replace(const std::string& text) { replaceChunks(0, chunks_.size() - 1, text); }
+
+void Document::replaceChunks(int first, int last, const std::string& region) {
+  std::string text = region;
+  // The edit removed the function declaration at the beginning of the first
+  // chunk, so what is left belongs to the previous function.
+  if (first > 0 && !isChunkStart(text.data(), text.data() + text.size())) {
+    --first;
+    text = chunks_[first]->text + text;
+  }
+  bool is_document_end = last == static_cast<int>(chunks_.size()) - 1;
+
+  llvm::StringMap<std::string> old_signatures;
+  for (int i = first; i <= last; ++i) collectSignatures(chunks_[i].get(), &old_signatures);
+
+  std::vector<std::unique_ptr<Chunk>> replacement;
+  auto addChunk = [&](const char* begin, const char* end, bool is_last) {
+    std::unique_ptr<Chunk> chunk{new Chunk};
+    chunk->text.assign(begin, end);
+    chunk->line_offsets.push_back(0);
+    for (size_t i = 0; i < chunk->text.size(); ++i) {
+      // Only the last line of the document may be empty and unterminated.
+      if (chunk->text[i] == '\n' && (i + 1 < chunk->text.size() || is_last)) {
+        chunk->line_offsets.push_back(i + 1);
+      }
+    }
+    replacement.push_back(std::move(chunk));
+  };
+
+  const char* begin = text.data();
+  const char* end = begin + text.size();
+  const char* chunk_begin = begin;
+  for (const char* line = begin; line < end;) {
+    auto newline = static_cast<const char*>(memchr(line, '\n', end - line));
+    const char* next_line = newline ? newline + 1 : end;
+    if (line != chunk_begin && isChunkStart(line, next_line)) {
+      addChunk(chunk_begin, line, false);
+      chunk_begin = line;
+    }
+    line = next_line;
+  }
+  addChunk(chunk_begin, end, is_document_end);
+
+  llvm::StringMap<std::string> new_signatures;
+  for (auto& chunk : replacement) {
+    parseChunk(chunk.get());
+    collectSignatures(chunk.get(), &new_signatures);
+  }
+  stats_.parsed_chunks += replacement.size();
+
+  // Editing the body of a function leaves its callers as they were.
+  for (const auto& entry : old_signatures) {
+    auto new_signature = new_signatures.find(entry.getKey());
+    if (new_signature == new_signatures.end() || new_signature->second != entry.getValue()) {
+      changed_functions_.insert(entry.getKey());
+    }
+  }
+  for (const auto& entry : new_signatures) {
+    if (!old_signatures.count(entry.getKey())) changed_functions_.insert(entry.getKey());
+  }
+
+  chunks_.erase(chunks_.begin() + first, chunks_.begin() + last + 1);
+  chunks_.insert(chunks_.begin() + first, std::make_move_iterator(replacement.begin()),
+                 std::make_move_iterator(replacement.end()));
+
+  // Locations are relative to each chunk, so this is all it takes to move
+  // the chunks after the edit.
+  for (size_t i = std::max(first, 1); i < chunks_.size(); ++i) {
+    chunks_[i]->first_line = chunks_[i - 1]->first_line + chunks_[i - 1]->getLinesCount();
+  }
+}
+
+void Document::parseChunk(Chunk* chunk) {
+  std::istringstream input{chunk->text};
+  DiagnosticSink sink{0};
+  Parser parser{input, source_filename_, &sink};
+  chunk->ast = parser.parsePartial();
+  chunk->parse_diagnostics.assign(sink.begin(), sink.end());
+  chunk->check_diagnostics.clear();
+  chunk->callees.clear();
+  chunk->needs_check = true;
+  if (chunk->ast) {
+    SymbolResolver resolver{nullptr, &chunk->callees};
+    resolver.visit(chunk->ast.get());
+  }
+}
+
+void Document::collectSignatures(const Chunk* chunk,
+                                 llvm::StringMap<std::string>* signatures) const {
+  if (!chunk->ast) return;
+  for (const Function* f : chunk->ast->functions()) {
+    signatures->try_emplace(f->getName(), getSignature(f));
+  }
+}
+
+void Document::check() {
+  // As in the compiler, calls go to the first function with a name.
+  llvm::StringMap<const Function*> prototypes;
+  for (const auto& chunk : chunks_) {
+    if (!chunk->ast) continue;
+    for (const Function* f : chunk->ast->functions()) prototypes.try_emplace(f->getName(), f);
+  }
+  // Types and constants stay in a context as long as it lives, so each check
+  // gets a new one rather than piling up those of every edit.
+  llvm::LLVMContext context;
+
+  for (const auto& chunk : chunks_) {
+    bool calls_changed_function = llvm::any_of(chunk->callees, [this](const auto& callee) {
+      return changed_functions_.count(callee.getKey()) != 0;
+    });
+    if (!chunk->needs_check && !calls_changed_function) continue;
+    chunk->needs_check = false;
+    chunk->check_diagnostics.clear();
+    // Same as the compiler, code which does not parse is not checked any
+    // further, to avoid cascading errors.
+    if (!chunk->ast || !chunk->parse_diagnostics.empty()) continue;
+    DiagnosticSink sink{0};
+    checkFunctions(context, chunk->ast.get(), prototypes, &sink);
+    chunk->check_diagnostics.assign(sink.begin(), sink.end());
+    ++stats_.checked_chunks;
+  }
+
+  changed_functions_.clear();
+}
+
+std::vector<std::pair<Document::Range, std::string>> Document::getDiagnostics() const {
+  std::vector<std::pair<Range, std::string>> diagnostics;
+  auto add = [this, &diagnostics](const Chunk* chunk, const Diagnostic& diagnostic) {
+    Range range = getRange(chunk, diagnostic.from, diagnostic.to);
+    std::string message = diagnostic.message;
+    while (!message.empty() && message.back() == '\n') message.pop_back();
+    diagnostics.emplace_back(range, message);
+  };
+  for (const auto& chunk : chunks_) {
+    for (const Diagnostic& diagnostic : chunk->parse_diagnostics) add(chunk.get(), diagnostic);
+    for (const Diagnostic& diagnostic : chunk->check_diagnostics) add(chunk.get(), diagnostic);
+  }
+  return diagnostics;
+}
+
+bool Document::findSymbol(const Position& position, Symbol* symbol) const {
+  const Chunk* chunk = chunks_[findChunk(position.line)].get();
+  if (!chunk->ast) return false;
+
+  int line = std::clamp(position.line - chunk->first_line, 0, chunk->getLinesCount() - 1);
+  size_t line_offset = chunk->line_offsets[line];
+  const char* line_begin = chunk->text.data() + line_offset;
+  const char* text_end = chunk->text.data() + chunk->text.size();
+  int column = skipUTF16Units(line_begin, text_end, position.character) - line_begin;
+  Location target{line + 1, column + 1};
+
+  SymbolResolver resolver{&target, nullptr};
+  resolver.visit(chunk->ast.get());
+  if (!resolver.isFound()) return false;
+
+  if (const Variable* variable = resolver.getFoundVariable()) {
+    const SymbolResolver::Declaration* declaration = resolver.getFoundDeclaration();
+    // A variable which was never declared.
+    if (!declaration) return false;
+    symbol->range = getRange(chunk, variable->getFirstLocation(), variable->getLastLocation());
+    symbol->definition = getRange(chunk, declaration->variable->getFirstLocation(),
+                                  declaration->variable->getLastLocation());
+    symbol->description = declaration->is_param ? "" : "voglio ";
+    symbol->description += declaration->variable->getName();
+    symbol->description += declaration->is_param ? " " : ", ";
+    symbol->description += getSourceType(declaration->type);
+    return true;
+  }
+
+  const Function* function = resolver.getFoundFunction();
+  const Chunk* function_chunk = chunk;
+  if (const FunctionCallExpression* call = resolver.getFoundCall()) {
+    symbol->range = getRange(chunk, call->getFirstLocation(), call->getLastLocation());
+    function = nullptr;
+    for (const auto& other : chunks_) {
+      if (!other->ast) continue;
+      for (const Function* f : other->ast->functions()) {
+        if (f->getName() != call->getFunctionName()) continue;
+        function = f;
+        function_chunk = other.get();
+        break;
+      }
+      if (function) break;
+    }
+    if (!function) return false;
+  } else {
+    symbol->range = getRange(chunk, function->getFirstLocation(), function->getLastLocation());
+  }
+  symbol->definition =
+      getRange(function_chunk, function->getFirstLocation(), function->getLastLocation());
+  symbol->description = describeFunction(function);
+  return true;
+}
+
+Document::Position Document::getPosition(const Chunk* chunk, const Location& location) const {
+  int line = std::clamp(location.getLine() - 1, 0, chunk->getLinesCount() - 1);
+  const char* line_begin = chunk->text.data() + chunk->line_offsets[line];
+  const char* text_end = chunk->text.data() + chunk->text.size();
+  auto newline = static_cast<const char*>(memchr(line_begin, '\n', text_end - line_begin));
+  const char* line_end = newline ? newline : text_end;
+  const char* column = std::min(line_begin + std::max(location.getColumn() - 1, 0), line_end);
+  return {chunk->first_line + line, countUTF16Units(line_begin, column)};
+}
+
+Document::Range Document::getRange(const Chunk* chunk, const Location& from,
+                                   const Location& to) const {
+  Range range{getPosition(chunk, from), getPosition(chunk, to)};
+  // Errors at a single location would not show up otherwise.
+  if (range.start.line == range.end.line && range.start.character == range.end.character) {
+    ++range.end.character;
+  }
+  return range;
+}
+
+size_t Document::getOffset(const Chunk* chunk, const Position& position) const {
+  int line = position.line - chunk->first_line;
+  if (line < 0) return 0;
+  if (line >= chunk->getLinesCount()) return chunk->text.size();
+  const char* line_begin = chunk->text.data() + chunk->line_offsets[line];
+  const char* text_end = chunk->text.data() + chunk->text.size();
+  return skipUTF16Units(line_begin, text_end, position.character) - chunk->text.data();
+}
+
+} // namespace monicelli
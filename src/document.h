@@ -0,0 +1,110 @@
+#ifndef MONICELLI_DOCUMENT_H
+#define MONICELLI_DOCUMENT_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "ast.h"
+#include "errors.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace monicelli {
+
+// A source file open in the language server.
+//
+// The text is split into chunks of whole lines, each one starting with a
+// function declaration or with the entry point, which are parsed and checked
+// on their own. This way, an edit only needs to re-parse the chunks that it
+// touches, and to re-check them along with the functions that call into them.
+class Document final {
+public:
+  // Both 0-based, with the character counted in UTF-16 code units, as in the
+  // language server protocol.
+  struct Position {
+    int line;
+    int character;
+  };
+
+  struct Range {
+    Position start;
+    Position end;
+  };
+
+  struct Symbol {
+    // Where the symbol under the cursor is.
+    Range range;
+    // The declaration of the symbol, written in Monicelli.
+    std::string description;
+    Range definition;
+  };
+
+  struct Stats {
+    int parsed_chunks;
+    int checked_chunks;
+  };
+
+  Document(const std::string& source_filename, const std::string& text);
+
+  // Replaces the text in range, re-parsing the chunks that it touches. Call
+  // check() once done with the edits to get the diagnostics up to date.
+  void edit(const Range& range, const std::string& text);
+  // Replaces the whole text.
+  void replace(const std::string& text);
+
+  // Re-checks the functions affected by the edits since the last call.
+  void check();
+
+  std::vector<std::pair<Range, std::string>> getDiagnostics() const;
+
+  // Returns false if there is no variable or function at position.
+  bool findSymbol(const Position& position, Symbol* symbol) const;
+
+  // How much work the last edits and check took.
+  const Stats& getStats() const { return stats_; }
+  void resetStats() { stats_ = {0, 0}; }
+
+private:
+  struct Chunk {
+    // Whole lines, all of them terminated by a newline but the last line of
+    // the document.
+    std::string text;
+    std::vector<int> line_offsets;
+    int first_line = 0;
+    // Locations in here are relative to the start of the chunk.
+    std::unique_ptr<Module> ast;
+    std::vector<Diagnostic> parse_diagnostics;
+    std::vector<Diagnostic> check_diagnostics;
+    llvm::StringSet<> callees;
+    bool needs_check = false;
+
+    int getLinesCount() const { return line_offsets.size(); }
+  };
+
+  static bool isChunkStart(const char* line, const char* end);
+
+  int findChunk(int line) const;
+  void replaceChunks(int first, int last, const std::string& text);
+  void parseChunk(Chunk* chunk);
+  void collectSignatures(const Chunk* chunk, llvm::StringMap<std::string>* signatures) const;
+
+  Position getPosition(const Chunk* chunk, const Location& location) const;
+  Range getRange(const Chunk* chunk, const Location& from, const Location& to) const;
+  size_t getOffset(const Chunk* chunk, const Position& position) const;
+
+  std::string source_filename_;
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  // Functions whose signature changed since the last check, including those
+  // that were added or removed.
+  llvm::StringSet<> changed_functions_;
+  Stats stats_;
+};
+
+} // namespace monicelli
+
+#endif
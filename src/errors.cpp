@@ -25,9 +25,11 @@ static std::string getNthLine(std::istream& file, int lineNumber) {
   return line;
 }
 
-void ErrorReportingMixin::printErrorLocation(std::ostream& stream, const Location& from,
-                                             const Location& to) {
-  std::ifstream file{source_filename_};
+void printDiagnostic(std::ostream& stream, const Diagnostic& diagnostic) {
+  const Location& from = diagnostic.from;
+  const Location& to = diagnostic.to;
+
+  std::ifstream file{diagnostic.source_filename};
   auto line = getNthLine(file, from.getLine());
 
   if (!line.empty()) {
@@ -46,7 +48,41 @@ void ErrorReportingMixin::printErrorLocation(std::ostream& stream, const Locatio
     }
   }
 
-  stream << '\n' << from << ": error: ";
+  const char* severity = diagnostic.severity == Diagnostic::WARNING ? "warning" : "error";
+  stream << '\n' << from << ": " << severity << ": " << diagnostic.message;
+}
+
+bool DiagnosticSink::report(Diagnostic diagnostic) {
+  if (isFull()) return false;
+  if (diagnostic.severity == Diagnostic::ERROR) ++errors_count_;
+  diagnostics_.emplace_back(std::move(diagnostic));
+  return !isFull();
+}
+
+void DiagnosticSink::print(std::ostream& stream) const {
+  for (const auto& diagnostic : diagnostics_) {
+    printDiagnostic(stream, diagnostic);
+  }
+  if (isFull()) stream << "Too many errors, stopping now.\n";
+}
+
+void ErrorReportingMixin::raise(const Location& from, const Location& to, std::string message) {
+  Diagnostic diagnostic{source_filename_, from, to, std::move(message)};
+  if (!sink_) {
+    printDiagnostic(std::cerr, diagnostic);
+    exit(1);
+  }
+  if (!sink_->report(std::move(diagnostic))) throw FatalError{};
+  throw RecoverableError{};
+}
+
+void ErrorReportingMixin::warn(const Location& from, const Location& to, std::string message) {
+  Diagnostic diagnostic{source_filename_, from, to, std::move(message), Diagnostic::WARNING};
+  if (!sink_) {
+    printDiagnostic(std::cerr, diagnostic);
+    return;
+  }
+  sink_->report(std::move(diagnostic));
 }
 
 } // namespace monicelli
@@ -8,50 +8,120 @@
 #include "support.h"
 
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 namespace monicelli {
 
 [[noreturn]] void UNREACHABLE(const std::string& message);
 
+// Thrown after an error has been reported to a DiagnosticSink, to unwind to
+// the closest point where compilation can resume.
+class RecoverableError final {};
+
+// Thrown when there is no point in going on, either because the error limit
+// was reached or because there is no more input to recover with.
+class FatalError final {};
+
+// An error or a warning, kept apart from its location so that it can be
+// either printed along with the offending source line, or sent to an editor.
+struct Diagnostic {
+  enum Severity { ERROR, WARNING };
+
+  std::string source_filename;
+  Location from;
+  Location to;
+  std::string message;
+  Severity severity = ERROR;
+};
+
+// Collects the diagnostics of a compilation, so that they can all be reported
+// together once it is over.
+class DiagnosticSink final {
+public:
+  // An error limit of 0 means no limit.
+  explicit DiagnosticSink(int error_limit) : error_limit_(error_limit), errors_count_(0) {}
+
+  // Returns false once the error limit has been reached. Any further
+  // diagnostic is dropped. Warnings do not count towards the limit.
+  bool report(Diagnostic diagnostic);
+
+  bool hasErrors() const { return errors_count_ > 0; }
+  int getErrorsCount() const { return errors_count_; }
+  bool isFull() const { return error_limit_ != 0 && getErrorsCount() >= error_limit_; }
+
+  typedef std::vector<Diagnostic>::const_iterator DiagnosticsConstIter;
+  DiagnosticsConstIter begin() const { return diagnostics_.cbegin(); }
+  DiagnosticsConstIter end() const { return diagnostics_.cend(); }
+
+  void clear() {
+    diagnostics_.clear();
+    errors_count_ = 0;
+  }
+
+  void print(std::ostream& stream) const;
+
+private:
+  int error_limit_;
+  int errors_count_;
+  std::vector<Diagnostic> diagnostics_;
+};
+
+// Prints the source line of a diagnostic, with the offending part underlined,
+// followed by the message.
+void printDiagnostic(std::ostream& stream, const Diagnostic& diagnostic);
+
 class ErrorReportingMixin {
 protected:
-  explicit ErrorReportingMixin(const std::string& source_filename)
-      : source_filename_(source_filename) {}
+  // Without a sink, the first error is printed right away and ends the program.
+  explicit ErrorReportingMixin(const std::string& source_filename, DiagnosticSink* sink = nullptr)
+      : source_filename_(source_filename), sink_(sink) {}
 
   const std::string& getSourceFilename() const { return source_filename_; }
-
-  void printErrorLocation(std::ostream& stream, const Location& from, const Location& to);
+  DiagnosticSink* getDiagnosticSink() const { return sink_; }
 
   template<typename Locatable, typename First>
   [[noreturn]] void error(const Locatable& obj, const First& first) {
-    printErrorLocation(std::cerr, obj->getFirstLocation(), obj->getLastLocation());
-    print(std::cerr, first);
-    exit(1);
+    std::ostringstream stream;
+    print(stream, first);
+    raise(obj->getFirstLocation(), obj->getLastLocation(), stream.str());
   }
 
   template<typename Locatable, typename First, typename... Tail>
   [[noreturn]] void error(const Locatable& obj, const First& first, Tail... tail) {
-    printErrorLocation(std::cerr, obj->getFirstLocation(), obj->getLastLocation());
-    print(std::cerr, first, tail...);
-    exit(1);
+    std::ostringstream stream;
+    print(stream, first, tail...);
+    raise(obj->getFirstLocation(), obj->getLastLocation(), stream.str());
   }
 
   template<typename First> [[noreturn]] void error(const Location& where, const First& first) {
-    printErrorLocation(std::cerr, where, where);
-    print(std::cerr, first);
-    exit(1);
+    std::ostringstream stream;
+    print(stream, first);
+    raise(where, where, stream.str());
   }
 
   template<typename First, typename... Tail>
   [[noreturn]] void error(const Location& where, const First& first, Tail... tail) {
-    printErrorLocation(std::cerr, where, where);
-    print(std::cerr, first, tail...);
-    exit(1);
+    std::ostringstream stream;
+    print(stream, first, tail...);
+    raise(where, where, stream.str());
+  }
+
+  // Unlike an error, a warning does not stop compilation.
+  template<typename Locatable, typename... Args>
+  void warning(const Locatable& obj, const Args&... args) {
+    std::ostringstream stream;
+    print(stream, args...);
+    warn(obj->getFirstLocation(), obj->getLastLocation(), stream.str());
   }
 
 private:
+  [[noreturn]] void raise(const Location& from, const Location& to, std::string message);
+  void warn(const Location& from, const Location& to, std::string message);
+
   std::string source_filename_;
+  DiagnosticSink* sink_;
 };
 
 } // namespace monicelli
@@ -0,0 +1,1381 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "interpreter.h"
+#include "ast-visitor.h"
+#include "bytecode.def"
+#include "codegen.def"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/DynamicLibrary.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// The interpreter runs the program as the IR generator would have compiled
+// it: the same types, conversions and scoping, the same errors, and the same
+// input and output. Where the compiled program would have undefined
+// behavior, the interpreter does what x86 would do, as far as it can cheaply.
+
+using namespace monicelli;
+
+namespace {
+
+// The binary operations come first, with one opcode for each type. The order
+// of the types matters, see getIntOpcode() and getFloatOpcode().
+enum class Opcode : uint16_t {
+#define DECLARE_INT_OPCODES(_, OP) OP##_I32, OP##_I8, OP##_I1,
+  IR_INT_BINARY_OPS(DECLARE_INT_OPCODES)
+#undef DECLARE_INT_OPCODES
+#define DECLARE_ICMP_OPCODE(_, OP) ICMP_##OP,
+  IR_INT_CMP_OPS(DECLARE_ICMP_OPCODE)
+#undef DECLARE_ICMP_OPCODE
+#define DECLARE_FLOAT_OPCODES(_, OP) OP##_F32, OP##_F64,
+  IR_FLOAT_BINARY_OPS(DECLARE_FLOAT_OPCODES)
+#undef DECLARE_FLOAT_OPCODES
+#define DECLARE_FCMP_OPCODES(_, OP) FCMP_##OP##_F32, FCMP_##OP##_F64,
+  IR_FLOAT_CMP_OPS(DECLARE_FCMP_OPCODES)
+#undef DECLARE_FCMP_OPCODES
+#define DECLARE_OPCODE(NAME) NAME,
+  BYTECODE_OPS(DECLARE_OPCODE)
+#undef DECLARE_OPCODE
+  OPCODES_COUNT
+};
+
+struct Instruction {
+  Opcode op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+
+  uint32_t getImmediate() const { return b | static_cast<uint32_t>(c) << 16; }
+};
+
+// Integers are kept sign extended from their width, as SExt would leave them,
+// so that a wider type can take them as they are. Pointers are kept as
+// integers, which are only ever turned back into pointers to access memory.
+union Register {
+  int64_t i;
+  float f;
+  double d;
+};
+
+typedef void (*ForeignThunk)(void* address, const Register* args, Register* result);
+
+// A supercazzola that is only declared, and found among the symbols of mcc.
+struct ForeignFunction {
+  void* address;
+  ForeignThunk thunk;
+};
+
+struct CompiledFunction {
+  std::vector<Instruction> code;
+  std::vector<double> constants;
+  uint16_t params_count = 0;
+  uint32_t registers_count = 0;
+};
+
+struct BytecodeProgram {
+  std::vector<CompiledFunction> functions;
+  std::vector<ForeignFunction> foreign_functions;
+  uint16_t entry_point = 0;
+};
+
+const char* SOURCE_TYPE_NAMES[] = {
+#define SOURCE_TYPE_NAME(_1, _2, _3, _4, SOURCE_NAME, _5) SOURCE_NAME,
+    BUILTIN_TYPES(SOURCE_TYPE_NAME)
+#undef SOURCE_TYPE_NAME
+};
+
+const char* INPUT_FORMATS[] = {
+#define INPUT_FORMAT(_1, _2, FORMAT, _3, _4, _5) FORMAT,
+    BUILTIN_TYPES(INPUT_FORMAT)
+#undef INPUT_FORMAT
+};
+
+const char* OUTPUT_FORMATS[] = {
+#define OUTPUT_FORMAT(_1, _2, _3, FORMAT, _4, _5) FORMAT,
+    BUILTIN_TYPES(OUTPUT_FORMAT)
+#undef OUTPUT_FORMAT
+};
+
+// The type of a value, which as in the IR is either a builtin type or a
+// pointer to one.
+struct ValueType {
+  VarType::BaseType base;
+  bool pointer;
+
+  bool operator==(const ValueType& other) const = default;
+
+  bool isVoid() const { return base == VarType::VOID && !pointer; }
+  bool isInteger() const {
+    return !pointer &&
+           (base == VarType::INTEGER || base == VarType::CHAR || base == VarType::BOOL);
+  }
+  bool isFloatingPoint() const {
+    return !pointer && (base == VarType::FLOAT || base == VarType::DOUBLE);
+  }
+};
+
+ValueType getValueType(const VarType& type) { return {type.getBaseType(), type.isPointer()}; }
+
+std::string getSourceType(const ValueType& type) {
+  return type.pointer ? std::string{"conte "} + SOURCE_TYPE_NAMES[type.base]
+                      : SOURCE_TYPE_NAMES[type.base];
+}
+
+int getIntegerWidth(VarType::BaseType type) {
+  switch (type) {
+  case VarType::INTEGER:
+    return 32;
+  case VarType::CHAR:
+    return 8;
+  case VarType::BOOL:
+    return 1;
+  default:
+    UNREACHABLE("Not an integer type");
+  }
+}
+
+// The size of an element of a buffer, as in the IR, where a Melandri takes a
+// byte.
+uint16_t getElementSize(VarType::BaseType type) {
+  switch (type) {
+  case VarType::INTEGER:
+  case VarType::FLOAT:
+    return 4;
+  case VarType::CHAR:
+  case VarType::BOOL:
+    return 1;
+  case VarType::DOUBLE:
+    return 8;
+  default:
+    UNREACHABLE("Not an element type");
+  }
+}
+
+// The offset of the opcode of an integer type from that of Necchi.
+int getIntegerTypeIndex(VarType::BaseType type) {
+  return type == VarType::INTEGER ? 0 : type == VarType::CHAR ? 1 : 2;
+}
+
+bool isComparison(BinaryExpression::Type op) {
+  switch (op) {
+#define RETURN_IS_COMPARISON(NAME, _) \
+  case BinaryExpression::NAME: \
+    return true;
+    IR_INT_CMP_OPS(RETURN_IS_COMPARISON)
+#undef RETURN_IS_COMPARISON
+  default:
+    return false;
+  }
+}
+
+Opcode getIntOpcode(BinaryExpression::Type op, VarType::BaseType type) {
+  int index = getIntegerTypeIndex(type);
+  switch (op) {
+#define RETURN_INT_OPCODE(NAME, OP) \
+  case BinaryExpression::NAME: \
+    return static_cast<Opcode>(static_cast<int>(Opcode::OP##_I32) + index);
+    IR_INT_BINARY_OPS(RETURN_INT_OPCODE)
+#undef RETURN_INT_OPCODE
+#define RETURN_ICMP_OPCODE(NAME, OP) \
+  case BinaryExpression::NAME: \
+    return Opcode::ICMP_##OP;
+    IR_INT_CMP_OPS(RETURN_ICMP_OPCODE)
+#undef RETURN_ICMP_OPCODE
+  }
+  UNREACHABLE("Unhandled integer operation");
+}
+
+// Returns false for operations that cannot be applied to floats.
+bool getFloatOpcode(BinaryExpression::Type op, VarType::BaseType type, Opcode* opcode) {
+  int index = type == VarType::FLOAT ? 0 : 1;
+  switch (op) {
+#define RETURN_FLOAT_OPCODE(NAME, OP) \
+  case BinaryExpression::NAME: \
+    *opcode = static_cast<Opcode>(static_cast<int>(Opcode::OP##_F32) + index); \
+    return true;
+    IR_FLOAT_BINARY_OPS(RETURN_FLOAT_OPCODE)
+#undef RETURN_FLOAT_OPCODE
+#define RETURN_FCMP_OPCODE(NAME, OP) \
+  case BinaryExpression::NAME: \
+    *opcode = static_cast<Opcode>(static_cast<int>(Opcode::FCMP_##OP##_F32) + index); \
+    return true;
+    IR_FLOAT_CMP_OPS(RETURN_FCMP_OPCODE)
+#undef RETURN_FCMP_OPCODE
+  default:
+    return false;
+  }
+}
+
+Opcode getFPToSIOpcode(VarType::BaseType from, VarType::BaseType to) {
+  int index = getIntegerTypeIndex(to);
+  Opcode first = from == VarType::FLOAT ? Opcode::FPToSI_F32_I32 : Opcode::FPToSI_F64_I32;
+  return static_cast<Opcode>(static_cast<int>(first) + index);
+}
+
+Opcode getPrintOpcode(VarType::BaseType type) {
+  switch (type) {
+  case VarType::INTEGER:
+    return Opcode::Print_I32;
+  case VarType::CHAR:
+    return Opcode::Print_I8;
+  case VarType::BOOL:
+    return Opcode::Print_I1;
+  case VarType::FLOAT:
+    return Opcode::Print_F32;
+  case VarType::DOUBLE:
+    return Opcode::Print_F64;
+  default:
+    UNREACHABLE("Unhandled print type");
+  }
+}
+
+// The elements of buffers are loaded and stored with the same order of types
+// as prints and inputs.
+Opcode getElementOpcode(Opcode first, VarType::BaseType type) {
+  int index = static_cast<int>(getPrintOpcode(type)) - static_cast<int>(Opcode::Print_I32);
+  return static_cast<Opcode>(static_cast<int>(first) + index);
+}
+
+Opcode getInputOpcode(VarType::BaseType type) {
+  switch (type) {
+  case VarType::INTEGER:
+    return Opcode::Input_I32;
+  case VarType::CHAR:
+    return Opcode::Input_I8;
+  case VarType::BOOL:
+    return Opcode::Input_I1;
+  case VarType::FLOAT:
+    return Opcode::Input_F32;
+  case VarType::DOUBLE:
+    return Opcode::Input_F64;
+  default:
+    UNREACHABLE("Unhandled input type");
+  }
+}
+
+// Whether an instruction writes register a, rather than reading it.
+bool writesRegister(Opcode op) {
+  switch (op) {
+  case Opcode::Jump:
+  case Opcode::JumpIfFalse:
+  case Opcode::JumpIfTrue:
+  case Opcode::TailCall:
+  case Opcode::Return:
+  case Opcode::ReturnVoid:
+  case Opcode::Print_I32:
+  case Opcode::Print_I8:
+  case Opcode::Print_I1:
+  case Opcode::Print_F32:
+  case Opcode::Print_F64:
+  case Opcode::Input_I32:
+  case Opcode::Input_I8:
+  case Opcode::Input_I1:
+  case Opcode::Input_F32:
+  case Opcode::Input_F64:
+  case Opcode::Store_I32:
+  case Opcode::Store_I8:
+  case Opcode::Store_I1:
+  case Opcode::Store_F32:
+  case Opcode::Store_F64:
+  case Opcode::Abort:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// How a value is passed to C. Narrow integers are widened anyway, and pointers
+// go in the same registers as integers.
+enum class ForeignKind { VOID, WORD, FLOAT, DOUBLE };
+
+// Each combination of kinds needs a thunk of its own, so this is kept small.
+const int MAX_FOREIGN_PARAMS = 4;
+
+template<typename T> T getForeignArg(const Register& value);
+template<> intptr_t getForeignArg<intptr_t>(const Register& value) { return value.i; }
+template<> float getForeignArg<float>(const Register& value) { return value.f; }
+template<> double getForeignArg<double>(const Register& value) { return value.d; }
+
+void setForeignResult(Register* result, intptr_t value) { result->i = value; }
+void setForeignResult(Register* result, float value) { result->f = value; }
+void setForeignResult(Register* result, double value) { result->d = value; }
+
+template<typename R, typename... Args> struct ForeignThunks {
+  template<size_t... I>
+  static void call(void* address, const Register* args, Register* result,
+                   std::index_sequence<I...>) {
+    auto function = reinterpret_cast<R (*)(Args...)>(address);
+    if constexpr (std::is_void_v<R>) {
+      function(getForeignArg<Args>(args[I])...);
+    } else {
+      setForeignResult(result, function(getForeignArg<Args>(args[I])...));
+    }
+  }
+
+  static void thunk(void* address, const Register* args, Register* result) {
+    call(address, args, result, std::index_sequence_for<Args...>{});
+  }
+
+  // Adds the kinds of the parameters one at a time, up to those given.
+  static ForeignThunk select(const std::vector<ForeignKind>& params) {
+    constexpr size_t count = sizeof...(Args);
+    if (params.size() == count) return &thunk;
+    if constexpr (count < MAX_FOREIGN_PARAMS) {
+      switch (params[count]) {
+      case ForeignKind::WORD:
+        return ForeignThunks<R, Args..., intptr_t>::select(params);
+      case ForeignKind::FLOAT:
+        return ForeignThunks<R, Args..., float>::select(params);
+      case ForeignKind::DOUBLE:
+        return ForeignThunks<R, Args..., double>::select(params);
+      case ForeignKind::VOID:
+        break;
+      }
+    }
+    return nullptr;
+  }
+};
+
+ForeignThunk selectForeignThunk(ForeignKind result, const std::vector<ForeignKind>& params) {
+  switch (result) {
+  case ForeignKind::VOID:
+    return ForeignThunks<void>::select(params);
+  case ForeignKind::WORD:
+    return ForeignThunks<intptr_t>::select(params);
+  case ForeignKind::FLOAT:
+    return ForeignThunks<float>::select(params);
+  case ForeignKind::DOUBLE:
+    return ForeignThunks<double>::select(params);
+  }
+  return nullptr;
+}
+
+ForeignKind getForeignKind(const ValueType& type) {
+  if (type.isVoid()) return ForeignKind::VOID;
+  if (type.pointer || type.isInteger()) return ForeignKind::WORD;
+  return type.base == VarType::FLOAT ? ForeignKind::FLOAT : ForeignKind::DOUBLE;
+}
+
+// A value in a register, along with its type.
+struct Operand {
+  uint16_t reg;
+  ValueType type;
+};
+
+// Compiles each supercazzola to register bytecode. Every variable gets a
+// register of its own for as long as it is in scope, like its stack slot in
+// the IR, and intermediate values get registers above those, which are reused
+// from one statement to the next. The arguments of a call go in consecutive
+// registers, which are the first ones of the frame of the callee.
+class BytecodeCompiler final : public ConstAstVisitor<BytecodeCompiler, Operand>,
+                               public ErrorReportingMixin {
+public:
+  BytecodeCompiler(const std::string& source_filename, DiagnosticSink* sink,
+                   BytecodeProgram* program)
+      : ErrorReportingMixin(source_filename, sink), program_(program), function_(nullptr),
+        compiled_(nullptr), next_register_(0), live_registers_(0) {}
+
+  void compileModule(const Module* m);
+
+  Operand visitVardeclStatement(const VardeclStatement* s);
+  Operand visitReturnStatement(const ReturnStatement* r);
+  Operand visitAssignStatement(const AssignStatement* a);
+  Operand visitElementAssignStatement(const ElementAssignStatement* a);
+  Operand visitBranchStatement(const BranchStatement* b);
+  Operand visitLoopStatement(const LoopStatement* l);
+  Operand visitInputStatement(const InputStatement* s);
+  Operand visitPrintStatement(const PrintStatement* p);
+  Operand visitAssertStatement(const AssertStatement* a);
+  Operand visitAbortStatement(const AbortStatement* a);
+  Operand visitExpressionStatement(const ExpressionStatement* s) {
+    visit(s->getExpression());
+    return {};
+  }
+  Operand visitBinaryExpression(const BinaryExpression* e);
+  Operand visitAtomicExpression(const AtomicExpression* e);
+  Operand visitFunctionCallExpression(const FunctionCallExpression* e);
+  Operand visitIndexExpression(const IndexExpression* e);
+  Operand visitAllocExpression(const AllocExpression* e);
+
+private:
+  // Calls go to the first supercazzola with a name, as in the IR.
+  struct Callee {
+    const Function* function = nullptr;
+    // Into the compiled or the foreign functions of the program.
+    std::optional<uint16_t> index;
+  };
+
+  struct Scope {
+    llvm::StringMap<Operand> variables;
+    uint32_t live_registers;
+  };
+
+  class ScopeGuard final {
+  public:
+    explicit ScopeGuard(BytecodeCompiler* compiler) : compiler_(compiler) {
+      compiler_->scopes_.push_back({{}, compiler_->live_registers_});
+    }
+
+    ~ScopeGuard() {
+      compiler_->live_registers_ = compiler_->scopes_.back().live_registers;
+      compiler_->next_register_ = compiler_->live_registers_;
+      compiler_->scopes_.pop_back();
+    }
+
+  private:
+    BytecodeCompiler* compiler_;
+  };
+
+  void compileFunction(const Function* f, CompiledFunction* compiled);
+  template<typename Range> void visitStatements(const Range& body);
+
+  uint16_t allocateRegister();
+  uint16_t defineVariable(const Variable& variable, const ValueType& type);
+  const Operand* lookup(const std::string& name) const;
+
+  size_t emit(Opcode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0) {
+    compiled_->code.push_back({op, a, b, c});
+    return compiled_->code.size() - 1;
+  }
+  size_t emitImmediate(Opcode op, uint16_t a, uint32_t immediate) {
+    return emit(op, a, immediate & 0xffff, immediate >> 16);
+  }
+  // Returns the jump, so that its target can be patched once known.
+  size_t emitJump(Opcode op, uint16_t condition = 0) { return emitImmediate(op, condition, 0); }
+  void patchJump(size_t jump) {
+    Instruction& instruction = compiled_->code[jump];
+    uint32_t target = compiled_->code.size();
+    instruction.b = target & 0xffff;
+    instruction.c = target >> 16;
+  }
+
+  void emitDefaultReturn();
+  std::optional<Operand> convert(const Operand& value, const ValueType& type);
+  void moveInto(uint16_t target, const Operand& value);
+  uint16_t compileCondition(const Expression* e);
+  void compileElement(const IndexExpression* e, Operand* pointer, Operand* index);
+  uint16_t getForeignFunction(const FunctionCallExpression* e, Callee* callee);
+
+  BytecodeProgram* program_;
+  llvm::StringMap<Callee> callees_;
+
+  const Function* function_;
+  CompiledFunction* compiled_;
+  std::vector<Scope> scopes_;
+  // Registers from next_register_ on are free. Those below live_registers_
+  // hold variables that are in scope, those in between temporaries.
+  uint32_t next_register_;
+  uint32_t live_registers_;
+};
+
+void BytecodeCompiler::compileModule(const Module* m) {
+  for (const Function* f : m->functions()) {
+    Callee& callee = callees_[f->getName()];
+    // A prototype followed by its definition is the same supercazzola.
+    if (!callee.function || (callee.function->body_empty() && !f->body_empty())) {
+      callee.function = f;
+    }
+  }
+
+  std::vector<const Function*> compiled;
+  for (const Function* f : m->functions()) {
+    Callee& callee = callees_[f->getName()];
+    if (callee.function != f || f->body_empty()) continue;
+    callee.index = compiled.size();
+    compiled.push_back(f);
+  }
+  program_->entry_point = compiled.size();
+  compiled.push_back(m->getEntryPoint());
+
+  program_->functions.resize(compiled.size());
+  for (size_t i = 0; i < compiled.size(); ++i) {
+    compileFunction(compiled[i], &program_->functions[i]);
+  }
+}
+
+void BytecodeCompiler::compileFunction(const Function* f, CompiledFunction* compiled) {
+  function_ = f;
+  compiled_ = compiled;
+  next_register_ = 0;
+  live_registers_ = 0;
+
+  ScopeGuard scope_guard{this};
+  for (const FunctionParam& param : f->params()) {
+    Operand arg{allocateRegister(), getValueType(param.getType())};
+    live_registers_ = next_register_;
+    scopes_.back().variables.insert({param.getArg().getName(), arg});
+  }
+  compiled->params_count = f->params_size();
+
+  visitStatements(f->body());
+  emitDefaultReturn();
+}
+
+// Statements are the unit of error recovery, as in the IR generator.
+template<typename Range> void BytecodeCompiler::visitStatements(const Range& body) {
+  for (const Statement* s : body) {
+    try {
+      visit(s);
+    } catch (const RecoverableError&) {
+    }
+    // Temporaries are only needed by the statement that computed them.
+    next_register_ = live_registers_;
+  }
+}
+
+uint16_t BytecodeCompiler::allocateRegister() {
+  if (next_register_ > UINT16_MAX) {
+    error(function_, "this supercazzola has too many variables to be interpreted");
+  }
+  compiled_->registers_count = std::max(compiled_->registers_count, next_register_ + 1);
+  return next_register_++;
+}
+
+uint16_t BytecodeCompiler::defineVariable(const Variable& variable, const ValueType& type) {
+  Operand var{allocateRegister(), type};
+  live_registers_ = next_register_;
+  if (!scopes_.back().variables.insert({variable.getName(), var}).second) {
+    error(&variable, "redefining an existing variable");
+  }
+  return var.reg;
+}
+
+const Operand* BytecodeCompiler::lookup(const std::string& name) const {
+  for (auto scope = scopes_.crbegin(), end = scopes_.crend(); scope != end; ++scope) {
+    auto var = scope->variables.find(name);
+    if (var != scope->variables.end()) return &var->second;
+  }
+  return nullptr;
+}
+
+// The result of the entry point starts out as 0, that of other supercazzole
+// is undefined until they return something.
+void BytecodeCompiler::emitDefaultReturn() {
+  ValueType return_type = getValueType(function_->getReturnType());
+  if (return_type.isVoid()) {
+    emit(Opcode::ReturnVoid);
+    return;
+  }
+  uint16_t result = allocateRegister();
+  if (function_->isEntryPoint()) emitImmediate(Opcode::LoadInt, result, 0);
+  emit(Opcode::Return, result);
+}
+
+// The same conversions as ensureType() in the IR generator. Returns nullopt
+// where that would fail.
+std::optional<Operand> BytecodeCompiler::convert(const Operand& value, const ValueType& type) {
+  if (value.type == type) return value;
+  if (value.type.pointer || type.pointer || value.type.isVoid() || type.isVoid()) {
+    return std::nullopt;
+  }
+  if (value.type.isInteger() && type.isInteger() &&
+      getIntegerWidth(type.base) > getIntegerWidth(value.type.base)) {
+    // Already sign extended.
+    return Operand{value.reg, type};
+  }
+  Operand result{allocateRegister(), type};
+  if (value.type.isInteger() && type.isInteger()) {
+    Opcode truncate = type.base == VarType::CHAR ? Opcode::Trunc_I8 : Opcode::Trunc_I1;
+    emit(truncate, result.reg, value.reg);
+  } else if (value.type.isInteger()) {
+    emit(type.base == VarType::FLOAT ? Opcode::SIToFP_F32 : Opcode::SIToFP_F64, result.reg,
+         value.reg);
+  } else if (type.isInteger()) {
+    emit(getFPToSIOpcode(value.type.base, type.base), result.reg, value.reg);
+  } else {
+    emit(type.base == VarType::FLOAT ? Opcode::FPTrunc : Opcode::FPExt, result.reg, value.reg);
+  }
+  return result;
+}
+
+// A value that the last instruction computed in a temporary is computed in
+// the target register instead, without a move.
+void BytecodeCompiler::moveInto(uint16_t target, const Operand& value) {
+  if (value.reg == target) return;
+  std::vector<Instruction>& code = compiled_->code;
+  if (value.reg >= live_registers_ && !code.empty() && code.back().a == value.reg &&
+      writesRegister(code.back().op)) {
+    code.back().a = target;
+    return;
+  }
+  emit(Opcode::Move, target, value.reg);
+}
+
+// Anything that compares to zero will do, like in evalTruthiness().
+uint16_t BytecodeCompiler::compileCondition(const Expression* e) {
+  Operand condition = visit(e);
+  if (!condition.type.isInteger()) {
+    error(e, "cannot convert expression of type", getSourceType(condition.type), "to boolean");
+  }
+  return condition.reg;
+}
+
+Operand BytecodeCompiler::visitVardeclStatement(const VardeclStatement* s) {
+  ValueType type = getValueType(s->getType());
+  uint16_t var = defineVariable(s->getVariable(), type);
+  if (s->hasInitializer()) {
+    Operand init = visit(s->getInitializer());
+    auto converted = convert(init, type);
+    if (!converted) {
+      error(s->getInitializer(), "cannot initialize variable of type", getSourceType(type),
+            "with expression of type", getSourceType(init.type));
+    }
+    moveInto(var, *converted);
+  }
+  return {};
+}
+
+Operand BytecodeCompiler::visitReturnStatement(const ReturnStatement* r) {
+  if (!r->hasExpression()) {
+    emitDefaultReturn();
+    return {};
+  }
+  ValueType return_type = getValueType(function_->getReturnType());
+  if (return_type.isVoid()) {
+    error(r->getExpression(), "cannot return a value from a function of type void");
+  }
+  Operand value = visit(r->getExpression());
+  auto converted = convert(value, return_type);
+  if (!converted) {
+    error(r->getExpression(), "cannot return expression of type", getSourceType(value.type),
+          "from function of type", getSourceType(return_type));
+  }
+  // As in the compiled program, a call whose result is returned as it is
+  // replaces the frame of the caller, so recursion in tail position runs in
+  // constant space.
+  Instruction& last = compiled_->code.back();
+  if (value.type == return_type && last.op == Opcode::Call && last.a == value.reg) {
+    last = {Opcode::TailCall, 0, last.b, last.c};
+  } else {
+    emit(Opcode::Return, converted->reg);
+  }
+  return {};
+}
+
+Operand BytecodeCompiler::visitAssignStatement(const AssignStatement* a) {
+  Operand value = visit(a->getExpression());
+  const Operand* var = lookup(a->getVariable().getName());
+  if (!var) {
+    error(&a->getVariable(), "assigning to undefined variable", a->getVariable().getName());
+  }
+  auto converted = convert(value, var->type);
+  if (!converted) {
+    error(a->getExpression(), "cannot assign expression of type", getSourceType(value.type),
+          "to variable of type", getSourceType(var->type));
+  }
+  moveInto(var->reg, *converted);
+  return {};
+}
+
+// The buffer and the index come before the value, as in the IR.
+Operand BytecodeCompiler::visitElementAssignStatement(const ElementAssignStatement* a) {
+  Operand pointer, index;
+  compileElement(a->getTarget(), &pointer, &index);
+  Operand value = visit(a->getExpression());
+  ValueType element_type{pointer.type.base, false};
+  auto converted = convert(value, element_type);
+  if (!converted) {
+    error(a->getExpression(), "cannot assign expression of type", getSourceType(value.type),
+          "to element of type", getSourceType(element_type));
+  }
+  emit(getElementOpcode(Opcode::Store_I32, element_type.base), converted->reg, pointer.reg,
+       index.reg);
+  return {};
+}
+
+// Cases declare their variables in the enclosing scope, the else in its own.
+Operand BytecodeCompiler::visitBranchStatement(const BranchStatement* b) {
+  std::vector<size_t> exits;
+  for (const BranchCase& branch_case : b->cases()) {
+    size_t next_case = emitJump(Opcode::JumpIfFalse, compileCondition(branch_case.getExpression()));
+    visitStatements(branch_case.body());
+    exits.push_back(emitJump(Opcode::Jump));
+    patchJump(next_case);
+  }
+  if (b->hasBranchElse()) {
+    ScopeGuard scope_guard{this};
+    visitStatements(b->getBranchElse()->body());
+  }
+  for (size_t exit : exits) patchJump(exit);
+  return {};
+}
+
+Operand BytecodeCompiler::visitLoopStatement(const LoopStatement* l) {
+  uint32_t body = compiled_->code.size();
+  {
+    ScopeGuard scope_guard{this};
+    visitStatements(l->body());
+  }
+  emitImmediate(Opcode::JumpIfTrue, compileCondition(l->getCondition()), body);
+  return {};
+}
+
+Operand BytecodeCompiler::visitInputStatement(const InputStatement* s) {
+  const Operand* var = lookup(s->getVariable().getName());
+  if (!var) {
+    error(&s->getVariable(), "reading an undefined variable");
+  }
+  if (!var->type.isInteger() && !var->type.isFloatingPoint()) {
+    error(&s->getVariable(), "can only read integers and floating point");
+  }
+  emit(getInputOpcode(var->type.base), var->reg);
+  return {};
+}
+
+Operand BytecodeCompiler::visitPrintStatement(const PrintStatement* p) {
+  Operand value = visit(p->getExpression());
+  if (!value.type.isInteger() && !value.type.isFloatingPoint()) {
+    error(p->getExpression(), "only integer and float valued expressions may be printed");
+  }
+  emit(getPrintOpcode(value.type.base), value.reg);
+  return {};
+}
+
+Operand BytecodeCompiler::visitAssertStatement(const AssertStatement* a) {
+  size_t success = emitJump(Opcode::JumpIfTrue, compileCondition(a->getExpression()));
+  emit(Opcode::Abort);
+  patchJump(success);
+  return {};
+}
+
+Operand BytecodeCompiler::visitAbortStatement(const AbortStatement*) {
+  emit(Opcode::Abort);
+  return {};
+}
+
+Operand BytecodeCompiler::visitBinaryExpression(const BinaryExpression* e) {
+  Operand lhs = visit(e->getLeft());
+  Operand rhs = visit(e->getRight());
+
+  if (lhs.type.pointer || rhs.type.pointer) {
+    error(e, "pointer arithmetic is not supported");
+  }
+  if (lhs.type.isVoid() || rhs.type.isVoid()) {
+    error(e, "cannot operate on void");
+  }
+
+  // As in ResultTypeCalculator, double always wins, and integers upcast.
+  ValueType type = lhs.type;
+  if (lhs.type != rhs.type) {
+    if (lhs.type.isFloatingPoint() || rhs.type.isFloatingPoint()) {
+      type = {VarType::DOUBLE, false};
+    } else if (getIntegerWidth(rhs.type.base) > getIntegerWidth(lhs.type.base)) {
+      type = rhs.type;
+    }
+  }
+  lhs = *convert(lhs, type);
+  rhs = *convert(rhs, type);
+
+  Opcode op;
+  if (type.isInteger()) {
+    op = getIntOpcode(e->getType(), type.base);
+  } else if (!getFloatOpcode(e->getType(), type.base, &op)) {
+    error(e, "this operation cannot be applied to floats");
+  }
+
+  Operand result{allocateRegister(),
+                 isComparison(e->getType()) ? ValueType{VarType::BOOL, false} : type};
+  emit(op, result.reg, lhs.reg, rhs.reg);
+  return result;
+}
+
+Operand BytecodeCompiler::visitAtomicExpression(const AtomicExpression* e) {
+  switch (e->getType()) {
+  case AtomicExpression::INTEGER: {
+    Operand result{allocateRegister(), {VarType::INTEGER, false}};
+    emitImmediate(Opcode::LoadInt, result.reg, static_cast<uint32_t>(e->getIntValue()));
+    return result;
+  }
+  case AtomicExpression::FLOAT: {
+    Operand result{allocateRegister(), {VarType::DOUBLE, false}};
+    emitImmediate(Opcode::LoadReal, result.reg, compiled_->constants.size());
+    compiled_->constants.push_back(e->getFloatValue());
+    return result;
+  }
+  case AtomicExpression::IDENTIFIER: {
+    const Operand* var = lookup(e->getIdentifierValue().getName());
+    if (!var) {
+      error(&e->getIdentifierValue(), "undefined variable", e->getIdentifierValue().getName());
+    }
+    return *var;
+  }
+  default:
+    UNREACHABLE("Unhandled AtomicExpression type");
+  }
+}
+
+Operand BytecodeCompiler::visitFunctionCallExpression(const FunctionCallExpression* e) {
+  auto callee = callees_.find(e->getFunctionName());
+  if (callee == callees_.end()) {
+    error(e, "call to undefined function", e->getFunctionName());
+  }
+  const Function* f = callee->second.function;
+  if (e->args_size() != f->params_size()) {
+    error(e, "wrong number of arguments in call to", e->getFunctionName());
+  }
+  bool foreign = f->body_empty();
+  uint16_t index = foreign ? getForeignFunction(e, &callee->second) : *callee->second.index;
+
+  Operand result{allocateRegister(), getValueType(f->getReturnType())};
+  uint16_t args = next_register_;
+  for (int i = 0; i < f->params_size(); ++i) allocateRegister();
+
+  uint16_t arg_register = args;
+  auto param = f->begin_params();
+  for (const Expression* ast_arg : e->args()) {
+    Operand arg = visit(ast_arg);
+    ValueType param_type = getValueType(param->getType());
+    auto converted = convert(arg, param_type);
+    if (!converted) {
+      error(ast_arg, "cannot pass expression of type", getSourceType(arg.type),
+            "as argument of type", getSourceType(param_type), "in call to",
+            e->getFunctionName());
+    }
+    moveInto(arg_register, *converted);
+    if (foreign && param_type == ValueType{VarType::BOOL, false}) {
+      emit(Opcode::ZExt_I1, arg_register, arg_register);
+    }
+    ++arg_register;
+    ++param;
+  }
+
+  emit(foreign ? Opcode::CallForeign : Opcode::Call, result.reg, args, index);
+  // C leaves the bits above the width of the result undefined.
+  if (foreign && result.type.isInteger()) {
+    static const Opcode TRUNCATE[] = {Opcode::Trunc_I32, Opcode::Trunc_I8, Opcode::Trunc_I1};
+    emit(TRUNCATE[getIntegerTypeIndex(result.type.base)], result.reg, result.reg);
+  }
+  next_register_ = args;
+  return result;
+}
+
+void BytecodeCompiler::compileElement(const IndexExpression* e, Operand* pointer,
+                                      Operand* index) {
+  *pointer = visit(e->getPointer());
+  if (!pointer->type.pointer) {
+    error(e->getPointer(), "cannot index expression of type", getSourceType(pointer->type));
+  }
+  *index = visit(e->getIndex());
+  if (!index->type.isInteger()) {
+    error(e->getIndex(), "index must be an integer, not", getSourceType(index->type));
+  }
+}
+
+Operand BytecodeCompiler::visitIndexExpression(const IndexExpression* e) {
+  Operand pointer, index;
+  compileElement(e, &pointer, &index);
+  Operand result{allocateRegister(), {pointer.type.base, false}};
+  emit(getElementOpcode(Opcode::Load_I32, result.type.base), result.reg, pointer.reg, index.reg);
+  return result;
+}
+
+Operand BytecodeCompiler::visitAllocExpression(const AllocExpression* e) {
+  Operand count = visit(e->getCount());
+  if (!count.type.isInteger()) {
+    error(e->getCount(), "the number of elements must be an integer, not",
+          getSourceType(count.type));
+  }
+  Operand result{allocateRegister(), {e->getElementType(), true}};
+  emit(Opcode::Alloc, result.reg, count.reg, getElementSize(e->getElementType()));
+  return result;
+}
+
+uint16_t BytecodeCompiler::getForeignFunction(const FunctionCallExpression* e, Callee* callee) {
+  if (callee->index) return *callee->index;
+
+  const Function* f = callee->function;
+  if (f->params_size() > MAX_FOREIGN_PARAMS) {
+    error(e, "the interpreter can only call external functions with up to",
+          MAX_FOREIGN_PARAMS, "parameters");
+  }
+  std::vector<ForeignKind> params;
+  for (const FunctionParam& param : f->params()) {
+    params.push_back(getForeignKind(getValueType(param.getType())));
+  }
+  ForeignThunk thunk =
+      selectForeignThunk(getForeignKind(getValueType(f->getReturnType())), params);
+  void* address = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(f->getName());
+  if (!thunk || !address) {
+    error(e, "cannot find function", f->getName(), "to call it from the interpreter");
+  }
+
+  callee->index = program_->foreign_functions.size();
+  program_->foreign_functions.push_back({address, thunk});
+  return *callee->index;
+}
+
+// The compiled program would crash, or worse.
+[[noreturn]] void runtimeError(const char* message) {
+  std::fflush(stdout);
+  std::cerr << message << '\n';
+  std::abort();
+}
+
+template<int width> int64_t truncate(uint64_t value) {
+  const uint64_t sign = uint64_t{1} << (width - 1);
+  const uint64_t mask = (sign << 1) - 1;
+  return static_cast<int64_t>(((value & mask) ^ sign) - sign);
+}
+
+template<BinaryExpression::Type op, int width> int64_t evalInt(int64_t left, int64_t right) {
+  uint64_t unsigned_left = left;
+  uint64_t unsigned_right = right;
+  if constexpr (op == BinaryExpression::PLUS) {
+    return truncate<width>(unsigned_left + unsigned_right);
+  } else if constexpr (op == BinaryExpression::MINUS) {
+    return truncate<width>(unsigned_left - unsigned_right);
+  } else if constexpr (op == BinaryExpression::TIMES) {
+    return truncate<width>(unsigned_left * unsigned_right);
+  } else if constexpr (op == BinaryExpression::DIV) {
+    // Both trap on x86.
+    if (right == 0) runtimeError("Division by zero.");
+    if (right == -1 && left == truncate<width>(uint64_t{1} << (width - 1))) {
+      runtimeError("Division overflow.");
+    }
+    return truncate<width>(left / right);
+  } else if constexpr (op == BinaryExpression::SHL) {
+    // Shifting by the width or more is undefined, x86 masks the amount.
+    return truncate<width>(unsigned_left << (unsigned_right & (width - 1)));
+  } else {
+    static_assert(op == BinaryExpression::SHR);
+    return truncate<width>(left >> (unsigned_right & (width - 1)));
+  }
+}
+
+template<BinaryExpression::Type op, typename T> T evalFloat(T left, T right) {
+  if constexpr (op == BinaryExpression::PLUS) {
+    return left + right;
+  } else if constexpr (op == BinaryExpression::MINUS) {
+    return left - right;
+  } else if constexpr (op == BinaryExpression::TIMES) {
+    return left * right;
+  } else {
+    static_assert(op == BinaryExpression::DIV);
+    return left / right;
+  }
+}
+
+// Signed and ordered comparisons. True is -1, as an i1 sign extended.
+template<BinaryExpression::Type op, typename T> int64_t evalCompare(T left, T right) {
+  bool result;
+  if constexpr (op == BinaryExpression::EQ) {
+    result = left == right;
+  } else if constexpr (op == BinaryExpression::GE) {
+    result = left >= right;
+  } else if constexpr (op == BinaryExpression::GT) {
+    result = left > right;
+  } else if constexpr (op == BinaryExpression::LE) {
+    result = left <= right;
+  } else {
+    static_assert(op == BinaryExpression::LT);
+    result = left < right;
+  }
+  return -static_cast<int64_t>(result);
+}
+
+// Out of range values are undefined, x86 converts to 32 bits and gives the
+// smallest integer for those, then truncates.
+template<int width, typename T> int64_t convertToInt(T value) {
+  if (value > T(-2147483649.0) && value < T(2147483648.0)) {
+    return truncate<width>(static_cast<int64_t>(value));
+  }
+  return truncate<width>(static_cast<uint64_t>(INT32_MIN));
+}
+
+// As in the IR generator, buffers start with a header that holds their number
+// of elements right before the first one.
+const int BUFFER_HEADER_SIZE = 16;
+
+template<typename T> T* getElement(const Register& pointer, const Register& index) {
+  return reinterpret_cast<T*>(pointer.i) + index.i;
+}
+
+// Deep enough for anything that the compiled program can do with the default
+// stack size.
+const size_t MAX_STACK_REGISTERS = size_t{1} << 24;
+const size_t MAX_CALL_DEPTH = size_t{1} << 20;
+
+class VirtualMachine final {
+public:
+  explicit VirtualMachine(const BytecodeProgram& program) : program_(program) {}
+
+  // Returns the result of the function.
+  int32_t run(uint16_t function_index);
+
+private:
+  struct Frame {
+    const CompiledFunction* function;
+    const Instruction* return_pc;
+    size_t base;
+    uint16_t result;
+  };
+
+  // Returns the registers of a frame starting at base, which are invalidated
+  // by the next call.
+  Register* reserveRegisters(size_t base, size_t count) {
+    if (base + count > stack_.size()) growStack(base + count);
+    return stack_.data() + base;
+  }
+  void growStack(size_t size);
+
+  const BytecodeProgram& program_;
+  std::vector<Register> stack_;
+  std::vector<Frame> frames_;
+};
+
+void VirtualMachine::growStack(size_t size) {
+  if (size > MAX_STACK_REGISTERS) runtimeError("Stack overflow.");
+  stack_.resize(std::max(size, stack_.size() * 2));
+}
+
+#if defined(__GNUC__)
+// Each handler jumps straight to the next one, instead of going back to a
+// single switch, so that each gets a branch of its own to predict.
+#define MONICELLI_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+int32_t VirtualMachine::run(uint16_t function_index) {
+  const CompiledFunction* function = &program_.functions[function_index];
+  const Instruction* code = function->code.data();
+  const Instruction* pc = code;
+  size_t base = 0;
+  Register* regs = reserveRegisters(base, function->registers_count);
+
+#ifdef MONICELLI_THREADED_DISPATCH
+  static const void* const HANDLERS[] = {
+#define INT_HANDLERS(_, OP) &&handle_##OP##_I32, &&handle_##OP##_I8, &&handle_##OP##_I1,
+      IR_INT_BINARY_OPS(INT_HANDLERS)
+#undef INT_HANDLERS
+#define ICMP_HANDLER(_, OP) &&handle_ICMP_##OP,
+      IR_INT_CMP_OPS(ICMP_HANDLER)
+#undef ICMP_HANDLER
+#define FLOAT_HANDLERS(_, OP) &&handle_##OP##_F32, &&handle_##OP##_F64,
+      IR_FLOAT_BINARY_OPS(FLOAT_HANDLERS)
+#undef FLOAT_HANDLERS
+#define FCMP_HANDLERS(_, OP) &&handle_FCMP_##OP##_F32, &&handle_FCMP_##OP##_F64,
+      IR_FLOAT_CMP_OPS(FCMP_HANDLERS)
+#undef FCMP_HANDLERS
+#define HANDLER(NAME) &&handle_##NAME,
+      BYTECODE_OPS(HANDLER)
+#undef HANDLER
+  };
+  static_assert(sizeof(HANDLERS) / sizeof(HANDLERS[0]) ==
+                    static_cast<size_t>(Opcode::OPCODES_COUNT),
+                "Every opcode needs a handler");
+#define HANDLE(NAME) handle_##NAME:
+#define DISPATCH() goto* HANDLERS[static_cast<int>(pc->op)]
+  DISPATCH();
+#else
+#define HANDLE(NAME) case Opcode::NAME:
+#define DISPATCH() continue
+  for (;;) {
+    switch (pc->op) {
+#endif
+
+#define NEXT() \
+  { \
+    ++pc; \
+    DISPATCH(); \
+  }
+#define JUMP_TO(TARGET) \
+  { \
+    pc = code + (TARGET); \
+    DISPATCH(); \
+  }
+
+#define INT_HANDLERS(NAME, OP) \
+  HANDLE(OP##_I32) \
+  regs[pc->a].i = evalInt<BinaryExpression::NAME, 32>(regs[pc->b].i, regs[pc->c].i); \
+  NEXT(); \
+  HANDLE(OP##_I8) \
+  regs[pc->a].i = evalInt<BinaryExpression::NAME, 8>(regs[pc->b].i, regs[pc->c].i); \
+  NEXT(); \
+  HANDLE(OP##_I1) \
+  regs[pc->a].i = evalInt<BinaryExpression::NAME, 1>(regs[pc->b].i, regs[pc->c].i); \
+  NEXT();
+    IR_INT_BINARY_OPS(INT_HANDLERS)
+#undef INT_HANDLERS
+
+#define ICMP_HANDLER(NAME, OP) \
+  HANDLE(ICMP_##OP) \
+  regs[pc->a].i = evalCompare<BinaryExpression::NAME>(regs[pc->b].i, regs[pc->c].i); \
+  NEXT();
+    IR_INT_CMP_OPS(ICMP_HANDLER)
+#undef ICMP_HANDLER
+
+#define FLOAT_HANDLERS(NAME, OP) \
+  HANDLE(OP##_F32) \
+  regs[pc->a].f = evalFloat<BinaryExpression::NAME>(regs[pc->b].f, regs[pc->c].f); \
+  NEXT(); \
+  HANDLE(OP##_F64) \
+  regs[pc->a].d = evalFloat<BinaryExpression::NAME>(regs[pc->b].d, regs[pc->c].d); \
+  NEXT();
+    IR_FLOAT_BINARY_OPS(FLOAT_HANDLERS)
+#undef FLOAT_HANDLERS
+
+#define FCMP_HANDLERS(NAME, OP) \
+  HANDLE(FCMP_##OP##_F32) \
+  regs[pc->a].i = evalCompare<BinaryExpression::NAME>(regs[pc->b].f, regs[pc->c].f); \
+  NEXT(); \
+  HANDLE(FCMP_##OP##_F64) \
+  regs[pc->a].i = evalCompare<BinaryExpression::NAME>(regs[pc->b].d, regs[pc->c].d); \
+  NEXT();
+    IR_FLOAT_CMP_OPS(FCMP_HANDLERS)
+#undef FCMP_HANDLERS
+
+    HANDLE(Move)
+    regs[pc->a] = regs[pc->b];
+    NEXT();
+    HANDLE(LoadInt)
+    regs[pc->a].i = truncate<32>(pc->getImmediate());
+    NEXT();
+    HANDLE(LoadReal)
+    regs[pc->a].d = function->constants[pc->getImmediate()];
+    NEXT();
+    HANDLE(Trunc_I32)
+    regs[pc->a].i = truncate<32>(regs[pc->b].i);
+    NEXT();
+    HANDLE(Trunc_I8)
+    regs[pc->a].i = truncate<8>(regs[pc->b].i);
+    NEXT();
+    HANDLE(Trunc_I1)
+    regs[pc->a].i = truncate<1>(regs[pc->b].i);
+    NEXT();
+    HANDLE(ZExt_I1)
+    regs[pc->a].i = regs[pc->b].i & 1;
+    NEXT();
+    HANDLE(FPExt)
+    regs[pc->a].d = regs[pc->b].f;
+    NEXT();
+    HANDLE(FPTrunc)
+    regs[pc->a].f = static_cast<float>(regs[pc->b].d);
+    NEXT();
+    HANDLE(SIToFP_F32)
+    regs[pc->a].f = static_cast<float>(regs[pc->b].i);
+    NEXT();
+    HANDLE(SIToFP_F64)
+    regs[pc->a].d = static_cast<double>(regs[pc->b].i);
+    NEXT();
+    HANDLE(FPToSI_F32_I32)
+    regs[pc->a].i = convertToInt<32>(regs[pc->b].f);
+    NEXT();
+    HANDLE(FPToSI_F32_I8)
+    regs[pc->a].i = convertToInt<8>(regs[pc->b].f);
+    NEXT();
+    HANDLE(FPToSI_F32_I1)
+    regs[pc->a].i = convertToInt<1>(regs[pc->b].f);
+    NEXT();
+    HANDLE(FPToSI_F64_I32)
+    regs[pc->a].i = convertToInt<32>(regs[pc->b].d);
+    NEXT();
+    HANDLE(FPToSI_F64_I8)
+    regs[pc->a].i = convertToInt<8>(regs[pc->b].d);
+    NEXT();
+    HANDLE(FPToSI_F64_I1)
+    regs[pc->a].i = convertToInt<1>(regs[pc->b].d);
+    NEXT();
+
+    HANDLE(Jump)
+    JUMP_TO(pc->getImmediate());
+    HANDLE(JumpIfFalse)
+    if (regs[pc->a].i == 0) JUMP_TO(pc->getImmediate());
+    NEXT();
+    HANDLE(JumpIfTrue)
+    if (regs[pc->a].i != 0) JUMP_TO(pc->getImmediate());
+    NEXT();
+
+    HANDLE(Call) {
+      if (frames_.size() == MAX_CALL_DEPTH) runtimeError("Stack overflow.");
+      frames_.push_back({function, pc + 1, base, pc->a});
+      base += pc->b;
+      function = &program_.functions[pc->c];
+      regs = reserveRegisters(base, function->registers_count);
+      code = function->code.data();
+      JUMP_TO(0);
+    }
+    HANDLE(CallForeign) {
+      const ForeignFunction& callee = program_.foreign_functions[pc->c];
+      callee.thunk(callee.address, regs + pc->b, regs + pc->a);
+      NEXT();
+    }
+    HANDLE(TailCall) {
+      function = &program_.functions[pc->c];
+      std::copy(regs + pc->b, regs + pc->b + function->params_count, regs);
+      regs = reserveRegisters(base, function->registers_count);
+      code = function->code.data();
+      JUMP_TO(0);
+    }
+    HANDLE(Return) {
+      Register result = regs[pc->a];
+      if (frames_.empty()) return static_cast<int32_t>(result.i);
+      const Frame& caller = frames_.back();
+      function = caller.function;
+      code = function->code.data();
+      pc = caller.return_pc;
+      base = caller.base;
+      regs = stack_.data() + base;
+      regs[caller.result] = result;
+      frames_.pop_back();
+      DISPATCH();
+    }
+    HANDLE(ReturnVoid) {
+      if (frames_.empty()) return 0;
+      const Frame& caller = frames_.back();
+      function = caller.function;
+      code = function->code.data();
+      pc = caller.return_pc;
+      base = caller.base;
+      regs = stack_.data() + base;
+      frames_.pop_back();
+      DISPATCH();
+    }
+
+    // The same as printf and scanf with the formats of types.def, like the
+    // runtime. Narrow integers are zero extended, and floats widened.
+    HANDLE(Print_I32)
+    std::printf(OUTPUT_FORMATS[VarType::INTEGER], static_cast<int32_t>(regs[pc->a].i));
+    NEXT();
+    HANDLE(Print_I8)
+    std::printf(OUTPUT_FORMATS[VarType::CHAR], static_cast<uint8_t>(regs[pc->a].i));
+    NEXT();
+    HANDLE(Print_I1)
+    std::printf(OUTPUT_FORMATS[VarType::BOOL], static_cast<int>(regs[pc->a].i & 1));
+    NEXT();
+    HANDLE(Print_F32)
+    std::printf(OUTPUT_FORMATS[VarType::FLOAT], static_cast<double>(regs[pc->a].f));
+    NEXT();
+    HANDLE(Print_F64)
+    std::printf(OUTPUT_FORMATS[VarType::DOUBLE], regs[pc->a].d);
+    NEXT();
+    HANDLE(Input_I32) {
+      int value;
+      if (std::scanf(INPUT_FORMATS[VarType::INTEGER], &value) == 1) regs[pc->a].i = value;
+      NEXT();
+    }
+    HANDLE(Input_I8) {
+      char value;
+      if (std::scanf(INPUT_FORMATS[VarType::CHAR], &value) == 1) {
+        regs[pc->a].i = static_cast<int8_t>(value);
+      }
+      NEXT();
+    }
+    HANDLE(Input_I1) {
+      int value;
+      if (std::scanf(INPUT_FORMATS[VarType::BOOL], &value) == 1) regs[pc->a].i = value ? -1 : 0;
+      NEXT();
+    }
+    HANDLE(Input_F32) {
+      float value;
+      if (std::scanf(INPUT_FORMATS[VarType::FLOAT], &value) == 1) regs[pc->a].f = value;
+      NEXT();
+    }
+    HANDLE(Input_F64) {
+      double value;
+      if (std::scanf(INPUT_FORMATS[VarType::DOUBLE], &value) == 1) regs[pc->a].d = value;
+      NEXT();
+    }
+    HANDLE(Alloc) {
+      int64_t count = regs[pc->b].i;
+      if (count < 0 || count > (INT64_MAX - BUFFER_HEADER_SIZE) / pc->c) {
+        runtimeError("Invalid number of elements for a buffer.");
+      }
+      auto buffer = static_cast<char*>(std::calloc(1, BUFFER_HEADER_SIZE + count * pc->c));
+      if (!buffer) runtimeError("Out of memory.");
+      std::memcpy(buffer + BUFFER_HEADER_SIZE - sizeof(count), &count, sizeof(count));
+      regs[pc->a].i = reinterpret_cast<intptr_t>(buffer + BUFFER_HEADER_SIZE);
+      NEXT();
+    }
+    HANDLE(Load_I32)
+    regs[pc->a].i = *getElement<int32_t>(regs[pc->b], regs[pc->c]);
+    NEXT();
+    HANDLE(Load_I8)
+    regs[pc->a].i = *getElement<int8_t>(regs[pc->b], regs[pc->c]);
+    NEXT();
+    HANDLE(Load_I1)
+    regs[pc->a].i = truncate<1>(*getElement<uint8_t>(regs[pc->b], regs[pc->c]));
+    NEXT();
+    HANDLE(Load_F32)
+    regs[pc->a].f = *getElement<float>(regs[pc->b], regs[pc->c]);
+    NEXT();
+    HANDLE(Load_F64)
+    regs[pc->a].d = *getElement<double>(regs[pc->b], regs[pc->c]);
+    NEXT();
+    HANDLE(Store_I32)
+    *getElement<int32_t>(regs[pc->b], regs[pc->c]) = static_cast<int32_t>(regs[pc->a].i);
+    NEXT();
+    HANDLE(Store_I8)
+    *getElement<int8_t>(regs[pc->b], regs[pc->c]) = static_cast<int8_t>(regs[pc->a].i);
+    NEXT();
+    HANDLE(Store_I1)
+    *getElement<uint8_t>(regs[pc->b], regs[pc->c]) = regs[pc->a].i & 1;
+    NEXT();
+    HANDLE(Store_F32)
+    *getElement<float>(regs[pc->b], regs[pc->c]) = regs[pc->a].f;
+    NEXT();
+    HANDLE(Store_F64)
+    *getElement<double>(regs[pc->b], regs[pc->c]) = regs[pc->a].d;
+    NEXT();
+    HANDLE(Abort)
+    // Output is flushed first, as the runtime does.
+    std::fflush(stdout);
+    std::abort();
+
+#ifndef MONICELLI_THREADED_DISPATCH
+    case Opcode::OPCODES_COUNT:
+      break;
+    }
+    UNREACHABLE("Invalid opcode");
+  }
+#endif
+
+#undef HANDLE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP_TO
+}
+
+#ifdef MONICELLI_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#undef MONICELLI_THREADED_DISPATCH
+#endif
+
+} // namespace
+
+namespace monicelli {
+
+std::optional<int> interpret(const Module* ast, DiagnosticSink* sink) {
+  assert(ast->hasEntryPoint() && "Nothing to interpret");
+  int errors_before = sink ? sink->getErrorsCount() : 0;
+  // Makes the symbols of mcc itself visible to SearchForAddressOfSymbol().
+  llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+  BytecodeProgram program;
+  BytecodeCompiler compiler{ast->getSourceFilename(), sink, &program};
+  try {
+    compiler.compileModule(ast);
+  } catch (const FatalError&) {
+    return std::nullopt;
+  }
+  if (sink && sink->getErrorsCount() > errors_before) return std::nullopt;
+
+  VirtualMachine vm{program};
+  int exit_status = vm.run(program.entry_point);
+  std::fflush(stdout);
+  return exit_status;
+}
+
+} // namespace monicelli
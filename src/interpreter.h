@@ -0,0 +1,24 @@
+#ifndef MONICELLI_INTERPRETER_H
+#define MONICELLI_INTERPRETER_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include <optional>
+
+namespace monicelli {
+
+class DiagnosticSink;
+class Module;
+
+// Compiles the AST to bytecode and runs its entry point straight away, without
+// going through LLVM. Input and output are the same as those of the compiled
+// program. Supercazzole that are only declared are looked up among the symbols
+// of mcc itself, which include the C library. Errors are reported to the sink,
+// and if there are any nothing runs. Returns the exit status of the program,
+// or nullopt if it did not run.
+std::optional<int> interpret(const Module* ast, DiagnosticSink* sink);
+
+} // namespace monicelli
+
+#endif
@@ -50,6 +50,8 @@ initial := |*
   "vaffanzum" => { SET_TOKEN(RETURN); fbreak; };
   "voglio" => { SET_TOKEN(VARDECL); fbreak; };
   "come " ("se "?) "fosse" => { SET_TOKEN(ASSIGN); fbreak; };
+  "al posto " di => { SET_TOKEN(INDEX); fbreak; };
+  "sbiriguda" => { SET_TOKEN(ALLOC); fbreak; };
   "a posterdati" => { SET_TOKEN(PRINT); fbreak; };
   "mi porga" => { SET_TOKEN(INPUT); fbreak; };
   "ho visto" => { SET_TOKEN(ASSERT); fbreak; };
@@ -11,13 +11,12 @@ namespace monicelli {
 class Location final {
 public:
   Location() : line_(1), column_(1) {}
+  Location(int line, int column) : line_(line), column_(column) {}
 
   int getLine() const { return line_; }
   int getColumn() const { return column_; }
 
 private:
-  Location(int line, int column) : line_(line), column_(column) {}
-
   void advanceColumn(int amount) { column_ += amount; }
   void newLine() {
     column_ = 1;
@@ -44,6 +43,8 @@ protected:
   Location last_location_;
 
   friend class Parser;
+  friend class AstCacheReader;
+  friend class CallFolder;
 };
 
 static inline std::ostream& operator<<(std::ostream& stream, const Location& location) {
@@ -0,0 +1,385 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "document.h"
+
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace monicelli {
+
+// Positions and ranges go in and out of messages as they are.
+
+bool fromJSON(const llvm::json::Value& value, Document::Position& position,
+              llvm::json::Path path) {
+  llvm::json::ObjectMapper mapper{value, path};
+  return mapper && mapper.map("line", position.line) &&
+         mapper.map("character", position.character);
+}
+
+bool fromJSON(const llvm::json::Value& value, Document::Range& range, llvm::json::Path path) {
+  llvm::json::ObjectMapper mapper{value, path};
+  return mapper && mapper.map("start", range.start) && mapper.map("end", range.end);
+}
+
+llvm::json::Value toJSON(const Document::Position& position) {
+  return llvm::json::Object{{"line", position.line}, {"character", position.character}};
+}
+
+llvm::json::Value toJSON(const Document::Range& range) {
+  return llvm::json::Object{{"start", range.start}, {"end", range.end}};
+}
+
+} // namespace monicelli
+
+using namespace monicelli;
+
+namespace {
+
+// From the language server protocol specification.
+#define LSP_ERROR_CODES(V) \
+  V(PARSE_ERROR, -32700) \
+  V(INVALID_REQUEST, -32600) \
+  V(METHOD_NOT_FOUND, -32601)
+
+enum ErrorCode {
+#define DECLARE_ERROR_CODE(NAME, CODE) NAME = CODE,
+  LSP_ERROR_CODES(DECLARE_ERROR_CODE)
+#undef DECLARE_ERROR_CODE
+};
+
+enum DiagnosticSeverity { SEVERITY_ERROR = 1 };
+enum TextDocumentSyncKind { SYNC_INCREMENTAL = 2 };
+
+class LanguageServer final {
+public:
+  explicit LanguageServer(bool log_enabled)
+      : log_enabled_(log_enabled), shutdown_(false), exited_(false) {}
+
+  void handleMessage(const std::string& content);
+
+  bool hasExited() const { return exited_; }
+  // As the protocol has it, exiting without a shutdown request first is an error.
+  int getExitCode() const { return shutdown_ ? 0 : 1; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  void dispatch(const llvm::json::Object& message);
+
+  llvm::json::Value initialize();
+  void didOpen(const llvm::json::Object& params);
+  void didChange(const llvm::json::Object& params);
+  void didClose(const llvm::json::Object& params);
+  llvm::json::Value hover(const llvm::json::Object& params);
+  llvm::json::Value definition(const llvm::json::Object& params);
+
+  void publishDiagnostics(const std::string& uri, const Document* document);
+
+  // Returns nullptr if the document is not open.
+  Document* getDocument(const llvm::json::Object& params, std::string* uri);
+
+  void reply(const llvm::json::Value& id, llvm::json::Value result);
+  void replyError(const llvm::json::Value& id, ErrorCode code, const std::string& message);
+  void notify(llvm::StringRef method, llvm::json::Value params);
+  void send(llvm::json::Value message);
+
+  void log(const std::string& uri, const char* what, const Document* document,
+           Clock::time_point start);
+
+  static std::string getFilename(const std::string& uri);
+
+  std::map<std::string, std::unique_ptr<Document>> documents_;
+  bool log_enabled_;
+  bool shutdown_;
+  bool exited_;
+};
+
+void LanguageServer::handleMessage(const std::string& content) {
+  auto message = llvm::json::parse(content);
+  if (!message) {
+    replyError(nullptr, PARSE_ERROR, llvm::toString(message.takeError()));
+    return;
+  }
+  const llvm::json::Object* object = message->getAsObject();
+  if (!object) {
+    replyError(nullptr, INVALID_REQUEST, "Expected an object.");
+    return;
+  }
+  dispatch(*object);
+}
+
+void LanguageServer::dispatch(const llvm::json::Object& message) {
+  auto method = message.getString("method");
+  const llvm::json::Value* id = message.get("id");
+  const llvm::json::Object* params = message.getObject("params");
+  static const llvm::json::Object no_params;
+  if (!params) params = &no_params;
+
+  if (!method) {
+    // A response to a request of ours, and we never send any.
+    if (!id) replyError(nullptr, INVALID_REQUEST, "Missing method.");
+    return;
+  }
+
+  // Notifications.
+  if (!id) {
+    if (*method == "textDocument/didOpen") {
+      didOpen(*params);
+    } else if (*method == "textDocument/didChange") {
+      didChange(*params);
+    } else if (*method == "textDocument/didClose") {
+      didClose(*params);
+    } else if (*method == "exit") {
+      exited_ = true;
+    }
+    // Everything else, like initialized or $/cancelRequest, may be ignored.
+    return;
+  }
+
+  if (*method == "initialize") {
+    reply(*id, initialize());
+  } else if (*method == "shutdown") {
+    shutdown_ = true;
+    reply(*id, nullptr);
+  } else if (*method == "textDocument/hover") {
+    reply(*id, hover(*params));
+  } else if (*method == "textDocument/definition") {
+    reply(*id, definition(*params));
+  } else {
+    replyError(*id, METHOD_NOT_FOUND, "Unsupported method " + method->str() + ".");
+  }
+}
+
+llvm::json::Value LanguageServer::initialize() {
+  return llvm::json::Object{
+      {"capabilities",
+       llvm::json::Object{
+           {"textDocumentSync",
+            llvm::json::Object{
+                {"openClose", true},
+                {"change", static_cast<int>(SYNC_INCREMENTAL)},
+            }},
+           {"hoverProvider", true},
+           {"definitionProvider", true},
+       }},
+      {"serverInfo", llvm::json::Object{{"name", "mcc-lsp"}}},
+  };
+}
+
+void LanguageServer::didOpen(const llvm::json::Object& params) {
+  const llvm::json::Object* text_document = params.getObject("textDocument");
+  if (!text_document) return;
+  auto uri = text_document->getString("uri");
+  auto text = text_document->getString("text");
+  if (!uri || !text) return;
+
+  auto start = Clock::now();
+  auto& document = documents_[uri->str()];
+  document.reset(new Document{getFilename(uri->str()), text->str()});
+  document->check();
+  log(uri->str(), "didOpen", document.get(), start);
+  publishDiagnostics(uri->str(), document.get());
+}
+
+void LanguageServer::didChange(const llvm::json::Object& params) {
+  std::string uri;
+  Document* document = getDocument(params, &uri);
+  const llvm::json::Array* changes = params.getArray("contentChanges");
+  if (!document || !changes) return;
+
+  auto start = Clock::now();
+  document->resetStats();
+  for (const llvm::json::Value& change : *changes) {
+    const llvm::json::Object* object = change.getAsObject();
+    if (!object) continue;
+    auto text = object->getString("text");
+    if (!text) continue;
+    Document::Range range;
+    llvm::json::Path::Root root;
+    if (const llvm::json::Value* range_value = object->get("range")) {
+      if (!fromJSON(*range_value, range, root)) continue;
+      document->edit(range, text->str());
+    } else {
+      document->replace(text->str());
+    }
+  }
+  // All the edits in a change are checked together.
+  document->check();
+  log(uri, "didChange", document, start);
+  publishDiagnostics(uri, document);
+}
+
+void LanguageServer::didClose(const llvm::json::Object& params) {
+  std::string uri;
+  if (!getDocument(params, &uri)) return;
+  documents_.erase(uri);
+  // Diagnostics of a closed document are no longer our business.
+  notify("textDocument/publishDiagnostics",
+         llvm::json::Object{{"uri", uri}, {"diagnostics", llvm::json::Array{}}});
+}
+
+llvm::json::Value LanguageServer::hover(const llvm::json::Object& params) {
+  std::string uri;
+  Document* document = getDocument(params, &uri);
+  Document::Position position;
+  llvm::json::Path::Root root;
+  const llvm::json::Value* position_value = params.get("position");
+  if (!document || !position_value || !fromJSON(*position_value, position, root)) return nullptr;
+
+  Document::Symbol symbol;
+  if (!document->findSymbol(position, &symbol)) return nullptr;
+  return llvm::json::Object{
+      {"contents", llvm::json::Object{{"kind", "plaintext"}, {"value", symbol.description}}},
+      {"range", symbol.range},
+  };
+}
+
+llvm::json::Value LanguageServer::definition(const llvm::json::Object& params) {
+  std::string uri;
+  Document* document = getDocument(params, &uri);
+  Document::Position position;
+  llvm::json::Path::Root root;
+  const llvm::json::Value* position_value = params.get("position");
+  if (!document || !position_value || !fromJSON(*position_value, position, root)) return nullptr;
+
+  Document::Symbol symbol;
+  if (!document->findSymbol(position, &symbol)) return nullptr;
+  return llvm::json::Object{{"uri", uri}, {"range", symbol.definition}};
+}
+
+void LanguageServer::publishDiagnostics(const std::string& uri, const Document* document) {
+  llvm::json::Array diagnostics;
+  for (const auto& diagnostic : document->getDiagnostics()) {
+    diagnostics.push_back(llvm::json::Object{
+        {"range", diagnostic.first},
+        {"severity", static_cast<int>(SEVERITY_ERROR)},
+        {"source", "mcc"},
+        {"message", diagnostic.second},
+    });
+  }
+  notify("textDocument/publishDiagnostics",
+         llvm::json::Object{{"uri", uri}, {"diagnostics", std::move(diagnostics)}});
+}
+
+Document* LanguageServer::getDocument(const llvm::json::Object& params, std::string* uri) {
+  const llvm::json::Object* text_document = params.getObject("textDocument");
+  if (!text_document) return nullptr;
+  auto document_uri = text_document->getString("uri");
+  if (!document_uri) return nullptr;
+  *uri = document_uri->str();
+  auto document = documents_.find(*uri);
+  return document != documents_.end() ? document->second.get() : nullptr;
+}
+
+void LanguageServer::reply(const llvm::json::Value& id, llvm::json::Value result) {
+  send(llvm::json::Object{{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}});
+}
+
+void LanguageServer::replyError(const llvm::json::Value& id, ErrorCode code,
+                                const std::string& message) {
+  send(llvm::json::Object{
+      {"jsonrpc", "2.0"},
+      {"id", id},
+      {"error", llvm::json::Object{{"code", static_cast<int>(code)}, {"message", message}}},
+  });
+}
+
+void LanguageServer::notify(llvm::StringRef method, llvm::json::Value params) {
+  send(llvm::json::Object{{"jsonrpc", "2.0"}, {"method", method}, {"params", std::move(params)}});
+}
+
+void LanguageServer::send(llvm::json::Value message) {
+  std::string content;
+  llvm::raw_string_ostream stream{content};
+  stream << message;
+  stream.flush();
+  std::cout << "Content-Length: " << content.size() << "\r\n\r\n" << content << std::flush;
+}
+
+void LanguageServer::log(const std::string& uri, const char* what, const Document* document,
+                         Clock::time_point start) {
+  if (!log_enabled_) return;
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  const Document::Stats& stats = document->getStats();
+  std::cerr << what << ' ' << uri << ": parsed " << stats.parsed_chunks << " and checked "
+            << stats.checked_chunks << " chunks in " << elapsed.count() << " ms\n";
+}
+
+std::string LanguageServer::getFilename(const std::string& uri) {
+  static const char scheme[] = "file://";
+  if (uri.compare(0, sizeof(scheme) - 1, scheme) != 0) return uri;
+  std::string filename;
+  for (size_t i = sizeof(scheme) - 1; i < uri.size(); ++i) {
+    if (uri[i] == '%' && i + 2 < uri.size()) {
+      filename += static_cast<char>(std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      filename += uri[i];
+    }
+  }
+  return filename;
+}
+
+// Returns false at the end of the input.
+bool readMessage(std::istream& input, std::string* content) {
+  size_t content_length = 0;
+  std::string header;
+  while (std::getline(input, header)) {
+    if (!header.empty() && header.back() == '\r') header.pop_back();
+    if (header.empty()) break;
+    static const char content_length_header[] = "Content-Length:";
+    if (header.compare(0, sizeof(content_length_header) - 1, content_length_header) == 0) {
+      const char* value = header.c_str() + sizeof(content_length_header) - 1;
+      content_length = std::strtoull(value, nullptr, 10);
+    }
+  }
+  if (!input) return false;
+  content->resize(content_length);
+  input.read(&(*content)[0], content_length);
+  return static_cast<bool>(input);
+}
+
+void printHelp(const char* program_name) {
+  std::cout << "Usage: " << program_name
+            << " [options...]\n\n"
+               "Language server for Monicelli, speaking the protocol on stdin and stdout.\n\n"
+               "Options:\n"
+               "  --log      : Log how long each change takes to stderr.\n"
+               "  --help, -h : Print this message.\n"
+               "\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bool log_enabled = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--log") == 0) {
+      log_enabled = true;
+      continue;
+    }
+    if (strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0) {
+      std::cerr << "Unknown option " << argv[i] << ".\n\n";
+      printHelp(argv[0]);
+      return 1;
+    }
+    printHelp(argv[0]);
+    return 0;
+  }
+
+  LanguageServer server{log_enabled};
+  std::string content;
+  while (!server.hasExited() && readMessage(std::cin, &content)) {
+    server.handleMessage(content);
+  }
+  return server.getExitCode();
+}
@@ -2,19 +2,97 @@
 // Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
 
 #include "asmgen.h"
+#include "ast-cache.h"
 #include "ast-printer.h"
+#include "ast.h"
+#include "call-folding.h"
 #include "codegen.h"
+#include "interpreter.h"
+#include "monicelli.h"
 #include "options.h"
-#include "parser.h"
-
-#include "llvm/TargetParser/Host.h"
+#include "stats.h"
+#include "timing.h"
 
 #include <fstream>
+#include <optional>
 #include <string>
 #include <vector>
 
 using namespace monicelli;
 
+namespace {
+
+// Runs the program on the interpreter, and returns its exit status.
+int interpretFile(const ProgramOptions& options) {
+  if (options.input_filenames_size() > 1) {
+    std::cerr << "Only a single input file can be interpreted.\n";
+    return 1;
+  }
+
+  if (!options.getBitcodeFilenames().empty()) {
+    std::cerr << "Bitcode files cannot be interpreted.\n";
+    return 1;
+  }
+
+  const std::string& input_filename = *options.begin_input_filenames();
+  std::ifstream input{input_filename};
+  if (!input) {
+    std::cerr << "Cannot open input file " << input_filename << ".\n";
+    return 1;
+  }
+
+  DiagnosticSink sink{options.getErrorLimit()};
+  CompileHooks hooks;
+  hooks.trace_lexer = options.shouldTraceLexer();
+  std::unique_ptr<Module> ast = parseSource(input, input_filename, &sink, hooks);
+  if (ast && !ast->hasEntryPoint()) {
+    std::cerr << input_filename << " has no entry point to run.\n";
+    return 1;
+  }
+
+  std::optional<int> exit_status;
+  if (ast) {
+    if (options.shouldFoldCalls()) foldConstantCalls(ast.get());
+    exit_status = interpret(ast.get(), &sink);
+  }
+  sink.print(std::cerr);
+  return exit_status.value_or(1);
+}
+
+const char* getEmitExtension(EmitFormat format) {
+  switch (format) {
+  case EmitFormat::OBJECT:
+    return ".o";
+  case EmitFormat::ASSEMBLY:
+    return ".s";
+  case EmitFormat::BITCODE:
+    return ".bc";
+  case EmitFormat::IR:
+    return ".ll";
+  }
+  UNREACHABLE("Unhandled EmitFormat");
+}
+
+void writeNonObjectFile(EmitFormat format, const std::string& output_filename,
+                        llvm::Module* ir, llvm::TargetMachine* target_machine) {
+  switch (format) {
+  case EmitFormat::ASSEMBLY:
+    writeAssembly(output_filename, ir, target_machine, true);
+    return;
+  case EmitFormat::BITCODE:
+    writeBitcode(output_filename, ir);
+    return;
+  case EmitFormat::IR:
+    writeIR(output_filename, ir);
+    return;
+  case EmitFormat::OBJECT:
+    break;
+  }
+  UNREACHABLE("Object files are written with writeAssembly()");
+}
+
+} // namespace
+
 int main(int argc, char** argv) {
   ProgramOptions options = ProgramOptions::fromCommandLine(argc, argv);
   if (options.input_filenames_empty()) {
@@ -29,11 +107,64 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  registerTargets();
+  // Nothing below is needed to run the program.
+  if (options.shouldInterpret()) return interpretFile(options);
+
+  if (!options.getTimeTraceFilename().empty()) {
+    startTimeTrace(options.getTimeTraceGranularity());
+  }
 
-  auto triple = llvm::sys::getDefaultTargetTriple();
-  auto target_machine =
-      getTargetMachine(triple, options.getCPU(), options.getCPUFeatures(), options.shouldEmitPIC());
+  CompilerOptions compiler_options;
+  compiler_options.cpu = options.getCPU();
+  compiler_options.cpu_features = options.getCPUFeatures();
+  compiler_options.emit_pic = options.shouldEmitPIC();
+  compiler_options.fold_calls = options.shouldFoldCalls();
+  compiler_options.irgen_threads = options.getIRGenThreads();
+  compiler_options.bitcode_filenames = options.getBitcodeFilenames();
+  compiler_options.error_limit = options.getErrorLimit();
+
+  CodegenOptions& codegen_options = compiler_options.codegen;
+  codegen_options.lower_switches = options.shouldLowerSwitches();
+  codegen_options.warn_tail_calls = options.shouldWarnTailCalls();
+  codegen_options.whole_program = options.isWholeProgram();
+  codegen_options.bounds_check = options.shouldCheckBounds();
+  codegen_options.fp_model = options.getFPModel();
+  codegen_options.usdt = options.shouldEmitUSDT();
+#ifdef MONICELLI_ENABLE_LINKER
+  codegen_options.use_runtime_io = !options.shouldUseLibcIO();
+  codegen_options.instrument_functions = options.getProfileFormat() != ReportFormat::NONE;
+  codegen_options.profile_json = options.getProfileFormat() == ReportFormat::JSON;
+  codegen_options.track_buffers = options.shouldCheckBounds();
+#else
+  // The runtime is only built along with the linker.
+  codegen_options.use_runtime_io = false;
+#endif
+
+  std::string target_error;
+  std::unique_ptr<llvm::TargetMachine> target_machine =
+      createTargetMachine(compiler_options, &target_error);
+  if (!target_machine) {
+    std::cerr << target_error << "\n";
+    return 1;
+  }
+  // Each thread of the code generator needs a target machine of its own.
+  auto make_target_machine = [&]() {
+    std::string error;
+    return createTargetMachine(compiler_options, &error);
+  };
+
+  std::unique_ptr<TimeReport> time_report;
+  if (options.getTimeReportFormat() != ReportFormat::NONE) {
+    time_report.reset(new TimeReport{options.getTimeReportFormat() == ReportFormat::JSON});
+  }
+
+  std::unique_ptr<CompilerStats> stats;
+  if (options.getStatsFormat() != ReportFormat::NONE) {
+    stats.reset(new CompilerStats{options.getStatsFormat() == ReportFormat::JSON});
+  }
+
+  // All errors are reported together once every file has been compiled.
+  DiagnosticSink sink{options.getErrorLimit()};
 
 #ifdef MONICELLI_ENABLE_LINKER
   std::vector<std::string> object_filenames;
@@ -47,46 +178,150 @@ int main(int argc, char** argv) {
       return 1;
     }
 
-    Parser parser{input, input_filename};
-    parser.setLexerTrace(options.shouldTraceLexer());
-    auto ast = parser.parse();
+    llvm::TimeTraceScope file_trace_scope{"File", input_filename};
+
+    TimeReport::FileTimes* file_times = nullptr;
+    if (time_report) file_times = time_report->addFile(input_filename);
+    auto phase_time = [file_times](CompilerPhase phase) {
+      return file_times ? &file_times->phases[phase] : nullptr;
+    };
+    CompilerStats::FileStats* file_stats = nullptr;
+    if (stats) file_stats = stats->addFile(input_filename);
+
+    CompileHooks hooks;
+    hooks.trace_lexer = options.shouldTraceLexer();
+    hooks.times = file_times;
+    hooks.stats = file_stats;
+    SourceDigest source_digest;
+    if (options.shouldUseAstCache() && computeSourceDigest(input_filename, &source_digest)) {
+      std::string ast_cache_filename =
+          getAstCacheFilename(input_filename, options.getAstCacheDir());
+      hooks.load_ast = [&, ast_cache_filename]() {
+        return loadAstCache(ast_cache_filename, input_filename, source_digest);
+      };
+      hooks.save_ast = [&, ast_cache_filename](const Module* ast) {
+        saveAstCache(ast_cache_filename, source_digest, ast);
+      };
+    }
+
+    std::unique_ptr<Module> ast = parseSource(input, input_filename, &sink, hooks);
+    if (!ast) {
+      if (sink.isFull()) break;
+      continue;
+    }
 
     if (options.shouldPrintAST()) {
       printAst(std::cout, ast.get());
+      CompilerStats::measurePeakRSS(file_stats);
       continue;
     }
 
     llvm::LLVMContext context;
-    auto ir = generateIR(context, ast.get());
-    ir->setTargetTriple(triple);
-    ir->setDataLayout(target_machine->createDataLayout());
-    runFunctionOptimizer(ir.get());
+    std::unique_ptr<llvm::Module> ir =
+        compileIR(context, ast.get(), compiler_options, target_machine.get(), &sink, hooks);
+    if (time_report) time_report->collectPassTimings(file_times);
+    if (!ir) {
+      if (sink.isFull()) break;
+      continue;
+    }
 
     if (options.shouldPrintIR()) {
       printIR(std::cout, ir.get());
+      CompilerStats::measurePeakRSS(file_stats);
       continue;
     }
 
-    if (options.shouldSkipCompilation()) continue;
+    if (options.shouldSkipCompilation()) {
+      CompilerStats::measurePeakRSS(file_stats);
+      continue;
+    }
 
     std::string object_filename;
     if (options.shouldOnlyCompile() && !options.getOutputFilename().empty()) {
       object_filename = options.getOutputFilename();
     } else {
-      object_filename = basename(input_filename) + ".o";
+      object_filename = basename(input_filename) + getEmitExtension(options.getEmitFormat());
+    }
+
+    if (options.getEmitFormat() != EmitFormat::OBJECT) {
+      PhaseTimer timer{PHASE_CODEGEN, phase_time(PHASE_CODEGEN)};
+      writeNonObjectFile(options.getEmitFormat(), object_filename, ir.get(), target_machine.get());
+      CompilerStats::measurePeakRSS(file_stats);
+      continue;
     }
 
-    writeAssembly(object_filename, ir.get(), target_machine);
+    std::vector<std::string> partition_filenames;
+    llvm::StringMap<std::string> original_names;
+    {
+      PhaseTimer timer{PHASE_CODEGEN, phase_time(PHASE_CODEGEN)};
+      if (options.getCodegenThreads() > 1) {
+        partition_filenames = writeAssemblyPartitions(
+            object_filename, ir.get(), options.getCodegenThreads(), make_target_machine,
+            file_stats ? &original_names : nullptr);
+      } else {
+        writeAssembly(object_filename, ir.get(), target_machine.get());
+      }
+    }
+#ifdef MONICELLI_ENABLE_LINKER
+    // The partitions can go to the linker as they are, but a single object
+    // file was asked for when only compiling.
+    if (!partition_filenames.empty() && options.shouldOnlyCompile()) {
+      PhaseTimer timer{PHASE_CODEGEN, phase_time(PHASE_CODEGEN), true};
+      combineObjectFiles(object_filename, partition_filenames);
+      partition_filenames.clear();
+    }
+#endif
+    if (partition_filenames.empty()) partition_filenames.push_back(std::move(object_filename));
+    for (const auto& partition_filename : partition_filenames) {
+      CompilerStats::measureCodeSize(file_stats, partition_filename, &original_names);
+    }
+    CompilerStats::measurePeakRSS(file_stats);
 
 #ifdef MONICELLI_ENABLE_LINKER
-    object_filenames.emplace_back(std::move(object_filename));
+    object_filenames.insert(object_filenames.end(), partition_filenames.begin(),
+                            partition_filenames.end());
 #endif
   }
 
+  sink.print(std::cerr);
+  if (sink.hasErrors()) return 1;
+
 #ifdef MONICELLI_ENABLE_LINKER
   if (!options.shouldSkipCompilation() && !options.shouldOnlyCompile() &&
       !object_filenames.empty()) {
-    linkAssembly(options.getOutputFilename(), object_filenames);
+    PhaseTimer timer{PHASE_LINK, time_report ? time_report->getLinkTime() : nullptr, true};
+    std::string runtime_library;
+    if (!options.shouldUseLibcIO() || options.getProfileFormat() != ReportFormat::NONE ||
+        options.shouldCheckBounds()) {
+      runtime_library = getRuntimeLibrary(argv[0]);
+    }
+    linkAssembly(options.getOutputFilename(), object_filenames, runtime_library);
   }
 #endif
+
+  if (!options.getTimeTraceFilename().empty() &&
+      !writeTimeTrace(options.getTimeTraceFilename())) {
+    return 1;
+  }
+
+  if (stats && !stats->isJSON()) stats->print(std::cerr);
+  if (time_report && !time_report->isJSON()) time_report->print(std::cerr);
+
+  if (stats && stats->isJSON()) {
+    std::ofstream output{options.getStatsFilename()};
+    if (!output) {
+      std::cerr << "Cannot open " << options.getStatsFilename() << " for output.\n";
+      return 1;
+    }
+    stats->printJSON(output);
+  }
+
+  if (time_report && time_report->isJSON()) {
+    std::ofstream output{options.getTimeReportFilename()};
+    if (!output) {
+      std::cerr << "Cannot open " << options.getTimeReportFilename() << " for output.\n";
+      return 1;
+    }
+    time_report->printJSON(output);
+  }
 }
@@ -0,0 +1,251 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "monicelli.h"
+#include "asmgen.h"
+#include "call-folding.h"
+#include "parser.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Pass.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/TargetParser/Host.h"
+
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace monicelli {
+
+namespace {
+
+std::once_flag targets_registered;
+
+std::string getHostCPU(const CompilerOptions& options) {
+  if (options.cpu == "native") return llvm::sys::getHostCPUName().str();
+  return options.cpu;
+}
+
+// Errors that do not come from the source are reported at its beginning.
+void reportError(DiagnosticSink* sink, const std::string& source_filename, std::string message) {
+  sink->report({source_filename, Location{}, Location{}, std::move(message)});
+}
+
+PhaseTime* getPhaseTime(const CompileHooks& hooks, CompilerPhase phase) {
+  return hooks.times ? &hooks.times->phases[phase] : nullptr;
+}
+
+// Parses source and compiles it to optimized IR for target_machine. Returns
+// nullptr if there were errors, which are in the sink.
+std::unique_ptr<llvm::Module> compileSource(llvm::LLVMContext& context, const std::string& source,
+                                            const std::string& source_filename,
+                                            const CompilerOptions& options,
+                                            llvm::TargetMachine* target_machine,
+                                            DiagnosticSink* sink) {
+  std::istringstream input{source};
+  std::unique_ptr<Module> ast = parseSource(input, source_filename, sink);
+  if (!ast) return nullptr;
+  return compileIR(context, ast.get(), options, target_machine, sink);
+}
+
+} // namespace
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const CompilerOptions& options,
+                                                         std::string* error) {
+  std::call_once(targets_registered, registerTargets);
+  return std::unique_ptr<llvm::TargetMachine>{
+      getTargetMachine(llvm::sys::getDefaultTargetTriple(), getHostCPU(options),
+                       options.cpu_features, options.emit_pic, error)};
+}
+
+std::unique_ptr<Module> parseSource(std::istream& input, const std::string& source_filename,
+                                    DiagnosticSink* sink, const CompileHooks& hooks) {
+  std::unique_ptr<Module> ast;
+  if (hooks.load_ast) {
+    PhaseTimer timer{PHASE_PARSE, getPhaseTime(hooks, PHASE_PARSE)};
+    ast = hooks.load_ast();
+  }
+  if (!ast) {
+    Parser parser{input, source_filename, sink};
+    parser.setLexerTrace(hooks.trace_lexer);
+    parser.setLexerTiming(hooks.times != nullptr);
+    {
+      PhaseTimer timer{PHASE_PARSE, getPhaseTime(hooks, PHASE_PARSE)};
+      ast = parser.parse();
+    }
+    TimeReport::splitLexTime(hooks.times, parser.getLexerSeconds());
+    if (hooks.stats) hooks.stats->tokens = parser.getTokensCount();
+    if (ast && hooks.save_ast) hooks.save_ast(ast.get());
+  }
+  if (ast) CompilerStats::countAstNodes(hooks.stats, ast.get());
+  return ast;
+}
+
+std::unique_ptr<llvm::Module> compileIR(llvm::LLVMContext& context, Module* ast,
+                                        const CompilerOptions& options,
+                                        llvm::TargetMachine* target_machine, DiagnosticSink* sink,
+                                        const CompileHooks& hooks) {
+  // With many threads, the workers also run the function optimizer.
+  bool parallel = options.irgen_threads > 1;
+  ParallelIRReport report;
+  std::unique_ptr<llvm::Module> ir;
+  PhaseTime irgen_time;
+  {
+    PhaseTimer timer{PHASE_IRGEN, hooks.times ? &irgen_time : nullptr};
+    if (options.fold_calls) foldConstantCalls(ast);
+    if (parallel) {
+      ir = generateIRInParallel(context, ast, sink, options.codegen, options.irgen_threads,
+                                &report);
+    } else {
+      ir = generateIR(context, ast, sink, options.codegen);
+    }
+  }
+  TimeReport::addIRGenTime(hooks.times, irgen_time, report.worker_seconds,
+                           report.optimizer_seconds);
+  if (!ir) return nullptr;
+
+  ir->setTargetTriple(target_machine->getTargetTriple().str());
+  ir->setDataLayout(target_machine->createDataLayout());
+  if (!options.bitcode_filenames.empty()) {
+    PhaseTimer timer{PHASE_IRGEN, getPhaseTime(hooks, PHASE_IRGEN)};
+    std::string error;
+    if (!linkBitcodeFiles(ir.get(), options.bitcode_filenames, &error)) {
+      reportError(sink, ast->getSourceFilename(), std::move(error));
+      return nullptr;
+    }
+  }
+  CompilerStats::countIR(hooks.stats, ir.get(), false,
+                         parallel ? &report.unoptimized_sizes : nullptr);
+
+  {
+    PhaseTimer timer{PHASE_OPTIMIZE, getPhaseTime(hooks, PHASE_OPTIMIZE)};
+    // Only the optimizer passes that run on this thread are timed, not those
+    // of the backend.
+    llvm::TimePassesIsEnabled = hooks.times != nullptr;
+    if (parallel) {
+      // What is left to optimize is what the bitcode libraries brought in.
+      std::vector<llvm::Function*> linked_functions;
+      for (llvm::Function& f : *ir) {
+        if (!f.isDeclaration() && !report.unoptimized_sizes.count(f.getName())) {
+          linked_functions.push_back(&f);
+        }
+      }
+      runFunctionOptimizer(ir.get(), linked_functions);
+    } else {
+      runFunctionOptimizer(ir.get());
+    }
+    if (options.codegen.whole_program) runWholeProgramOptimizer(ir.get());
+    runLoopVectorizer(ir.get(), target_machine);
+    llvm::TimePassesIsEnabled = false;
+  }
+  CompilerStats::countIR(hooks.stats, ir.get(), true);
+  return ir;
+}
+
+bool CompileResult::hasErrors() const {
+  for (const Diagnostic& diagnostic : diagnostics) {
+    if (diagnostic.severity == Diagnostic::ERROR) return true;
+  }
+  return false;
+}
+
+ObjectResult compileToObject(const std::string& source, const std::string& source_filename,
+                             const CompilerOptions& options) {
+  ObjectResult result;
+  DiagnosticSink sink{options.error_limit};
+
+  std::string error;
+  std::unique_ptr<llvm::TargetMachine> target_machine = createTargetMachine(options, &error);
+  if (!target_machine) {
+    reportError(&sink, source_filename, std::move(error));
+  } else {
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> ir =
+        compileSource(context, source, source_filename, options, target_machine.get(), &sink);
+    if (ir) {
+      llvm::SmallString<0> object;
+      llvm::raw_svector_ostream output{object};
+      if (emitAssembly(output, ir.get(), target_machine.get())) {
+        result.object.assign(object.begin(), object.end());
+      } else {
+        reportError(&sink, source_filename, "Cannot emit an object file for this target.");
+      }
+    }
+  }
+
+  result.diagnostics.assign(sink.begin(), sink.end());
+  return result;
+}
+
+JITProgram::JITProgram(std::unique_ptr<llvm::orc::LLJIT> jit) : jit_(std::move(jit)) {}
+
+JITProgram::~JITProgram() = default;
+
+void* JITProgram::lookup(const std::string& name) const {
+  auto address = jit_->lookup(name);
+  if (!address) {
+    llvm::consumeError(address.takeError());
+    return nullptr;
+  }
+  return address->toPtr<void*>();
+}
+
+JITResult compileToJIT(const std::string& source, const std::string& source_filename,
+                       const CompilerOptions& options) {
+  JITResult result;
+  DiagnosticSink sink{options.error_limit};
+
+  // The runtime library is not part of the process, the C library is.
+  CompilerOptions jit_options = options;
+  jit_options.codegen.use_runtime_io = false;
+  jit_options.codegen.instrument_functions = false;
+  jit_options.codegen.track_buffers = false;
+  jit_options.emit_pic = false;
+
+  std::string error;
+  std::unique_ptr<llvm::TargetMachine> target_machine = createTargetMachine(jit_options, &error);
+  if (!target_machine) {
+    reportError(&sink, source_filename, std::move(error));
+    result.diagnostics.assign(sink.begin(), sink.end());
+    return result;
+  }
+
+  // Each program owns its context, which goes to the JIT along with the IR.
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> ir =
+      compileSource(*context, source, source_filename, jit_options, target_machine.get(), &sink);
+  if (ir) {
+    llvm::orc::JITTargetMachineBuilder machine_builder{target_machine->getTargetTriple()};
+    machine_builder.setCPU(target_machine->getTargetCPU().str());
+    machine_builder.addFeatures({target_machine->getTargetFeatureString().str()});
+    auto jit = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(machine_builder).create();
+    llvm::Error jit_error = jit ? llvm::Error::success() : jit.takeError();
+    if (!jit_error) {
+      auto process_symbols = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*jit)->getDataLayout().getGlobalPrefix());
+      if (process_symbols) {
+        (*jit)->getMainJITDylib().addGenerator(std::move(*process_symbols));
+        jit_error = (*jit)->addIRModule(
+            llvm::orc::ThreadSafeModule{std::move(ir), std::move(context)});
+      } else {
+        jit_error = process_symbols.takeError();
+      }
+    }
+    if (jit_error) {
+      reportError(&sink, source_filename,
+                  "Cannot load the program: " + llvm::toString(std::move(jit_error)));
+    } else {
+      result.program.reset(new JITProgram{std::move(*jit)});
+    }
+  }
+
+  result.diagnostics.assign(sink.begin(), sink.end());
+  return result;
+}
+
+} // namespace monicelli
@@ -0,0 +1,139 @@
+#ifndef MONICELLI_MONICELLI_H
+#define MONICELLI_MONICELLI_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+// The compiler as a library, for programs that compile Monicelli source held
+// in memory without going through mcc and the file system. Nothing here
+// prints or exits: errors come back as diagnostics. Each call works in an
+// LLVM context of its own, so many threads can compile at the same time.
+
+#include "codegen.h"
+#include "errors.h"
+#include "stats.h"
+#include "timing.h"
+
+#include "llvm/Target/TargetMachine.h"
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+
+namespace monicelli {
+
+// Everything that a compilation depends on, other than the source.
+struct CompilerOptions {
+  CodegenOptions codegen;
+  // The CPU model, or native for the one that is running, and the features
+  // to enable on top of it.
+  std::string cpu = "generic";
+  std::string cpu_features;
+  bool emit_pic = true;
+  // Whether pure calls with constant arguments are evaluated while compiling.
+  bool fold_calls = true;
+  // How many threads generate the IR and run the function optimizer, see
+  // generateIRInParallel().
+  unsigned irgen_threads = 1;
+  // Bitcode libraries linked into the module before it is optimized.
+  std::vector<std::string> bitcode_filenames;
+  // Compilation stops after this many errors, 0 means no limit.
+  int error_limit = 20;
+};
+
+// Returns a target machine for the host, set up as in options, or nullptr if
+// there is none, with the reason in error.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const CompilerOptions& options,
+                                                         std::string* error);
+
+// What a driver such as mcc gets to see of parseSource() and compileIR(), and
+// what it can do in their place. Every member is optional.
+struct CompileHooks {
+  // Returns the AST of the source without parsing it, for example from a
+  // cache, or nullptr to parse it.
+  std::function<std::unique_ptr<Module>()> load_ast;
+  // Called with the AST of a source that was parsed, not loaded.
+  std::function<void(const Module*)> save_ast;
+  bool trace_lexer = false;
+  // Where the time of each phase is added up, and the statistics collected.
+  // The timings of the optimizer passes are also enabled with the former.
+  TimeReport::FileTimes* times = nullptr;
+  CompilerStats::FileStats* stats = nullptr;
+};
+
+// Returns the AST of the source read from input, or nullptr if there were
+// errors, which are in the sink.
+std::unique_ptr<Module> parseSource(std::istream& input, const std::string& source_filename,
+                                    DiagnosticSink* sink, const CompileHooks& hooks = {});
+
+// Generates the IR of ast for target_machine, links in the bitcode libraries
+// and runs the optimizer of mcc, which is how every caller of the library
+// gets from an AST to IR that is ready for the backend. Returns nullptr if
+// there were errors, which are in the sink.
+std::unique_ptr<llvm::Module> compileIR(llvm::LLVMContext& context, Module* ast,
+                                        const CompilerOptions& options,
+                                        llvm::TargetMachine* target_machine, DiagnosticSink* sink,
+                                        const CompileHooks& hooks = {});
+
+struct CompileResult {
+  // Errors and warnings, in the order they were found. They refer to the
+  // source filename given, which need not exist.
+  std::vector<Diagnostic> diagnostics;
+
+  bool hasErrors() const;
+};
+
+struct ObjectResult : CompileResult {
+  // The object file, empty if there were errors.
+  std::string object;
+};
+
+// Compiles source to an object file in memory, which is ready to be linked
+// with the runtime library, unless options.codegen.use_runtime_io is false.
+ObjectResult compileToObject(const std::string& source, const std::string& source_filename,
+                             const CompilerOptions& options);
+
+struct JITResult;
+
+// Compiles source and loads it in the running process. The program does its
+// input and output through the C library, and calls to supercazzole that are
+// only declared go to the symbols of the process. The runtime library and
+// the instrumentation that needs it are not available.
+JITResult compileToJIT(const std::string& source, const std::string& source_filename,
+                       const CompilerOptions& options);
+
+// A program compiled in memory and loaded in the running process. The code
+// stays there for as long as this does.
+class JITProgram final {
+public:
+  ~JITProgram();
+
+  // Returns the address of the supercazzola with this name, or nullptr if
+  // there is none. The entry point is called main.
+  void* lookup(const std::string& name) const;
+
+private:
+  explicit JITProgram(std::unique_ptr<llvm::orc::LLJIT> jit);
+
+  std::unique_ptr<llvm::orc::LLJIT> jit_;
+
+  friend JITResult compileToJIT(const std::string& source, const std::string& source_filename,
+                                const CompilerOptions& options);
+};
+
+struct JITResult : CompileResult {
+  // The loaded program, nullptr if there were errors.
+  std::unique_ptr<JITProgram> program;
+};
+
+} // namespace monicelli
+
+#endif
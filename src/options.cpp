@@ -3,12 +3,38 @@
 
 #include "options.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 
 namespace monicelli {
 
+static const struct {
+  const char* option;
+  EmitFormat format;
+} EMIT_OPTIONS[] = {
+    {"--emit=obj", EmitFormat::OBJECT},
+    {"--emit=asm", EmitFormat::ASSEMBLY},
+    {"--emit=bc", EmitFormat::BITCODE},
+    {"--emit=ll", EmitFormat::IR},
+};
+
+static const struct {
+  const char* option;
+  FPModel model;
+} FP_MODEL_OPTIONS[] = {
+    {"--fp-model=strict", FPModel::STRICT},
+    {"--fp-model=contract", FPModel::CONTRACT},
+    {"--fp-model=fast", FPModel::FAST},
+};
+
+static bool endsWith(const std::string& string, const char* suffix) {
+  size_t length = strlen(suffix);
+  return string.size() > length && string.compare(string.size() - length, length, suffix) == 0;
+}
+
 // static
 ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
   ProgramOptions options;
@@ -37,10 +63,135 @@ ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
       options.skip_compile_ = true;
       continue;
     }
+    if (strcmp(argv[i], "--ast-cache") == 0) {
+      options.use_ast_cache_ = true;
+      continue;
+    }
+    if (strncmp(argv[i], "--ast-cache=", 12) == 0 && argv[i][12] != '\0') {
+      options.use_ast_cache_ = true;
+      options.ast_cache_dir_ = argv[i] + 12;
+      continue;
+    }
+    if (strcmp(argv[i], "--error-limit") == 0) {
+      if (i == argc - 1) {
+        std::cerr << "--error-limit must be followed by a number.\n";
+        break;
+      }
+      options.error_limit_ = std::max(0, atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "--time-report") == 0 || strcmp(argv[i], "--time-report=text") == 0) {
+      options.time_report_format_ = ReportFormat::TEXT;
+      continue;
+    }
+    if (strcmp(argv[i], "--time-report=json") == 0) {
+      options.time_report_format_ = ReportFormat::JSON;
+      continue;
+    }
+    if (strcmp(argv[i], "--time-report-file") == 0) {
+      if (i == argc - 1) {
+        std::cerr << "--time-report-file must be followed by a filename.\n";
+        break;
+      }
+      options.time_report_filename_ = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0) {
+      options.stats_format_ = ReportFormat::TEXT;
+      continue;
+    }
+    if (strcmp(argv[i], "--stats=json") == 0) {
+      options.stats_format_ = ReportFormat::JSON;
+      continue;
+    }
+    if (strcmp(argv[i], "--stats-file") == 0) {
+      if (i == argc - 1) {
+        std::cerr << "--stats-file must be followed by a filename.\n";
+        break;
+      }
+      options.stats_filename_ = argv[++i];
+      continue;
+    }
+    if (strncmp(argv[i], "--time-trace=", 13) == 0 && argv[i][13] != '\0') {
+      options.time_trace_filename_ = argv[i] + 13;
+      continue;
+    }
+    if (strcmp(argv[i], "--time-trace-granularity") == 0) {
+      if (i == argc - 1) {
+        std::cerr << "--time-trace-granularity must be followed by microseconds.\n";
+        break;
+      }
+      options.time_trace_granularity_ = strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
     if (strcmp(argv[i], "--no-pic") == 0) {
       options.emit_pic_ = false;
       continue;
     }
+    if (strcmp(argv[i], "--no-switch") == 0) {
+      options.lower_switches_ = false;
+      continue;
+    }
+    if (strcmp(argv[i], "--libc-io") == 0) {
+      options.use_libc_io_ = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--whole-program") == 0) {
+      options.whole_program_ = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--no-fold-calls") == 0) {
+      options.fold_calls_ = false;
+      continue;
+    }
+    if (strncmp(argv[i], "--codegen-threads=", 18) == 0 && argv[i][18] != '\0') {
+      options.codegen_threads_ = std::max(1, atoi(argv[i] + 18));
+      continue;
+    }
+    if (strncmp(argv[i], "--irgen-threads=", 16) == 0 && argv[i][16] != '\0') {
+      options.irgen_threads_ = std::max(1, atoi(argv[i] + 16));
+      continue;
+    }
+    auto emit = std::find_if(std::begin(EMIT_OPTIONS), std::end(EMIT_OPTIONS),
+                             [&](const auto& emit) { return strcmp(argv[i], emit.option) == 0; });
+    if (emit != std::end(EMIT_OPTIONS)) {
+      // Nothing is linked, whatever the format.
+      options.emit_format_ = emit->format;
+      options.compile_only_ = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--interpret") == 0) {
+      options.interpret_ = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--bounds-check") == 0) {
+      options.bounds_check_ = true;
+      continue;
+    }
+    auto fp_model =
+        std::find_if(std::begin(FP_MODEL_OPTIONS), std::end(FP_MODEL_OPTIONS),
+                     [&](const auto& fp_model) { return strcmp(argv[i], fp_model.option) == 0; });
+    if (fp_model != std::end(FP_MODEL_OPTIONS)) {
+      options.fp_model_ = fp_model->model;
+      continue;
+    }
+    if (strcmp(argv[i], "--instrument-functions") == 0 ||
+        strcmp(argv[i], "--instrument-functions=text") == 0) {
+      options.profile_format_ = ReportFormat::TEXT;
+      continue;
+    }
+    if (strcmp(argv[i], "--instrument-functions=json") == 0) {
+      options.profile_format_ = ReportFormat::JSON;
+      continue;
+    }
+    if (strcmp(argv[i], "--usdt") == 0) {
+      options.emit_usdt_ = true;
+      continue;
+    }
+    if (strcmp(argv[i], "-Wtail") == 0) {
+      options.warn_tail_calls_ = true;
+      continue;
+    }
 #ifdef MONICELLI_ENABLE_LINKER
     if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--only-compile") == 0) {
       options.compile_only_ = true;
@@ -53,6 +204,7 @@ ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
         break;
       }
       options.cpu_ = argv[++i];
+      continue;
     }
     if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--cpu-features") == 0) {
       if (i == argc - 1) {
@@ -60,6 +212,7 @@ ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
         break;
       }
       options.cpu_features_ = argv[++i];
+      continue;
     }
     if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       printHelp(argv[0]);
@@ -69,6 +222,10 @@ ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
       printHelp(argv[0]);
       exit(1);
     }
+    if (endsWith(argv[i], ".bc")) {
+      options.bitcode_filenames_.emplace_back(argv[i]);
+      continue;
+    }
     options.input_filenames_.emplace_back(argv[i]);
   }
 #ifndef MONICELLI_ENABLE_LINKER
@@ -80,7 +237,7 @@ ProgramOptions ProgramOptions::fromCommandLine(int argc, char** argv) {
 // static
 void ProgramOptions::printHelp(const char* program_name) {
   std::cout << "Usage: " << program_name
-            << " [options...] [input.mc ...]\n\n"
+            << " [options...] [input.mc ...] [library.bc ...]\n\n"
                "Options:\n"
 #ifdef MONICELLI_ENABLE_LINKER
                "  --only-compile, -c      : Compile only, do not link.\n"
@@ -90,9 +247,41 @@ void ProgramOptions::printHelp(const char* program_name) {
                "  --trace-lexer, -t       : Print tokens as seen by the lexer.\n"
                "  --print-ast, -p         : Print the AST as pseudocode.\n"
                "  --print-ir, -s          : Print the IR of the code.\n"
-               "  --cpu, -m model         : Set the CPU model to this (default: generic).\n"
+               "  --cpu, -m model         : Set the CPU model, or native (default: generic).\n"
                "  --cpu-features, -f feat : Enable these CPU features (default: none).\n"
                "  --no-pic                : Disable position independent code.\n"
+               "  --no-switch             : Lower every branch to a chain of compares.\n"
+               "  --libc-io               : Use printf and scanf, without the Monicelli runtime.\n"
+               "  --whole-program         : Optimize each file with an entry point as a whole\n"
+               "                            program, with its other functions internal.\n"
+               "  --no-fold-calls         : Do not evaluate pure calls with constant arguments.\n"
+               "  --emit=obj|asm|bc|ll    : Write an object file, assembly, bitcode or IR for\n"
+               "                            each input file, and do not link.\n"
+               "  --codegen-threads=n     : Split each file in n parts, and generate machine\n"
+               "                            code for each on a thread of its own.\n"
+               "  --irgen-threads=n       : Generate and optimize the IR of the supercazzole of\n"
+               "                            each file on n threads.\n"
+               "  --interpret             : Run the program right away, without compiling it.\n"
+               "  --bounds-check          : Abort on out of bounds indices into buffers.\n"
+               "  --fp-model=strict|contract|fast\n"
+               "                          : Keep float operations exact, allow fusing multiplies\n"
+               "                            and adds, or allow any rewrite (default: strict).\n"
+               "  --instrument-functions[=json]\n"
+               "                          : Count the calls and cycles of each function, and\n"
+               "                            write a profile when the program ends.\n"
+               "  --usdt                  : Add static probes for tracers such as bpftrace.\n"
+               "  -Wtail                  : Warn about returned calls that are not tail calls.\n"
+               "  --ast-cache[=dir]       : Cache the AST of each file next to it, or in dir.\n"
+               "  --error-limit n         : Stop after n errors, 0 for no limit (default: 20).\n"
+               "  --time-report[=json]    : Report the time taken by each phase and pass.\n"
+               "  --time-report-file file : Where to write the JSON time report\n"
+               "                            (default: time-report.json).\n"
+               "  --stats[=json]          : Report memory, token, AST and IR statistics.\n"
+               "  --stats-file file       : Where to write the JSON statistics\n"
+               "                            (default: stats.json).\n"
+               "  --time-trace=file       : Write a Chrome trace of the compiler to file.\n"
+               "  --time-trace-granularity us\n"
+               "                          : Drop spans shorter than this (default: 500).\n"
                "  --help, -h              : Print this message.\n"
                "\n";
   exit(0);
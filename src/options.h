@@ -4,6 +4,7 @@
 #ifndef MONICELLI_OPTIONS_H
 #define MONICELLI_OPTIONS_H
 
+#include "codegen.h"
 #include "iterators.h"
 
 #include <string>
@@ -11,6 +12,11 @@
 
 namespace monicelli {
 
+enum class ReportFormat { NONE, TEXT, JSON };
+
+// What is written for each input file with --emit.
+enum class EmitFormat { OBJECT, ASSEMBLY, BITCODE, IR };
+
 class ProgramOptions final {
 public:
   typedef std::vector<std::string>::const_iterator ConstStringIter;
@@ -32,16 +38,49 @@ public:
   int input_filenames_size() const { return input_filenames_.size(); }
   bool input_filenames_empty() const { return input_filenames_.empty(); }
 
+  // Inputs ending in .bc, which are linked into each Monicelli file.
+  const std::vector<std::string>& getBitcodeFilenames() const { return bitcode_filenames_; }
+
   const std::string& getCPU() const { return cpu_; }
   const std::string& getCPUFeatures() const { return cpu_features_; }
   bool shouldEmitPIC() const { return emit_pic_; }
+  bool shouldLowerSwitches() const { return lower_switches_; }
+  bool shouldUseLibcIO() const { return use_libc_io_; }
+  bool shouldWarnTailCalls() const { return warn_tail_calls_; }
+  bool isWholeProgram() const { return whole_program_; }
+  bool shouldFoldCalls() const { return fold_calls_; }
+  bool shouldInterpret() const { return interpret_; }
+  bool shouldCheckBounds() const { return bounds_check_; }
+  FPModel getFPModel() const { return fp_model_; }
+  ReportFormat getProfileFormat() const { return profile_format_; }
+  bool shouldEmitUSDT() const { return emit_usdt_; }
+  unsigned getCodegenThreads() const { return codegen_threads_; }
+  unsigned getIRGenThreads() const { return irgen_threads_; }
+  EmitFormat getEmitFormat() const { return emit_format_; }
+
+  ReportFormat getTimeReportFormat() const { return time_report_format_; }
+  const std::string& getTimeReportFilename() const { return time_report_filename_; }
+  ReportFormat getStatsFormat() const { return stats_format_; }
+  const std::string& getStatsFilename() const { return stats_filename_; }
+  const std::string& getTimeTraceFilename() const { return time_trace_filename_; }
+  unsigned getTimeTraceGranularity() const { return time_trace_granularity_; }
+  int getErrorLimit() const { return error_limit_; }
+  bool shouldUseAstCache() const { return use_ast_cache_; }
+  const std::string& getAstCacheDir() const { return ast_cache_dir_; }
 
 private:
   static void printHelp(const char* program_name);
 
   ProgramOptions()
       : print_ir_(false), print_ast_(false), trace_lexer_(false), compile_only_(false),
-        skip_compile_(false), cpu_("generic"), emit_pic_(true) {}
+        skip_compile_(false), cpu_("generic"), emit_pic_(true), lower_switches_(true),
+        use_libc_io_(false), warn_tail_calls_(false), whole_program_(false),
+        fold_calls_(true), interpret_(false), codegen_threads_(1), irgen_threads_(1),
+        emit_format_(EmitFormat::OBJECT), bounds_check_(false), fp_model_(FPModel::STRICT),
+        profile_format_(ReportFormat::NONE), emit_usdt_(false),
+        time_report_format_(ReportFormat::NONE), time_report_filename_("time-report.json"),
+        stats_format_(ReportFormat::NONE), stats_filename_("stats.json"),
+        time_trace_granularity_(500), error_limit_(20), use_ast_cache_(false) {}
 
   bool print_ir_;
   bool print_ast_;
@@ -49,10 +88,33 @@ private:
   bool compile_only_;
   bool skip_compile_;
   std::vector<std::string> input_filenames_;
+  std::vector<std::string> bitcode_filenames_;
   std::string output_filename_;
   std::string cpu_;
   std::string cpu_features_;
   bool emit_pic_;
+  bool lower_switches_;
+  bool use_libc_io_;
+  bool warn_tail_calls_;
+  bool whole_program_;
+  bool fold_calls_;
+  bool interpret_;
+  unsigned codegen_threads_;
+  unsigned irgen_threads_;
+  EmitFormat emit_format_;
+  bool bounds_check_;
+  FPModel fp_model_;
+  ReportFormat profile_format_;
+  bool emit_usdt_;
+  ReportFormat time_report_format_;
+  std::string time_report_filename_;
+  ReportFormat stats_format_;
+  std::string stats_filename_;
+  std::string time_trace_filename_;
+  unsigned time_trace_granularity_;
+  int error_limit_;
+  bool use_ast_cache_;
+  std::string ast_cache_dir_;
 };
 
 } // namespace monicelli
@@ -6,24 +6,49 @@
 
 namespace monicelli {
 
-std::unique_ptr<Module> Parser::parseModule() {
-  std::unique_ptr<Module> module{new Module};
+std::unique_ptr<Module> Parser::parse() {
+  DiagnosticSink* sink = getDiagnosticSink();
+  int errors_before = sink ? sink->getErrorsCount() : 0;
+  auto module = parsePartial();
+  if (sink && sink->getErrorsCount() > errors_before) return nullptr;
+  return module;
+}
 
-  while (peekNextToken()->getType() == Token::TOKEN_FUN_DECL) {
-    module->functions_.emplace_back(parseFunction());
+std::unique_ptr<Module> Parser::parsePartial() {
+  try {
+    current_token_ = lexToken();
+    return parseModule();
+  } catch (const FatalError&) {
+    return nullptr;
   }
+}
 
-  if (peekNextToken()->getType() == Token::TOKEN_ENTRY_POINT) {
-    module->maybe_entry_point_ = parseEntryPoint();
-  }
+std::unique_ptr<Module> Parser::parseModule() {
+  std::unique_ptr<Module> module{new Module};
 
-  while (peekNextToken()->getType() == Token::TOKEN_FUN_DECL) {
-    module->functions_.emplace_back(parseFunction());
-  }
+  for (bool done = false; !done;) {
+    uint64_t tokens_before = tokens_count_;
+    try {
+      switch (peekNextToken()->getType()) {
+      case Token::TOKEN_FUN_DECL:
+        module->functions_.emplace_back(parseFunction());
+        continue;
+      case Token::TOKEN_ENTRY_POINT:
+        if (module->maybe_entry_point_) break;
+        module->maybe_entry_point_ = parseEntryPoint();
+        continue;
+      default:
+        break;
+      }
 
-  auto token = getNextToken();
-  if (token->getType() != Token::TOKEN_END) {
-    error(token, "expected end of file");
+      auto token = getNextToken();
+      if (token->getType() != Token::TOKEN_END) {
+        error(token, "expected end of file");
+      }
+      done = true;
+    } catch (const RecoverableError&) {
+      synchronizeModule(tokens_before);
+    }
   }
 
   module->source_filename_ = getSourceFilename();
@@ -38,6 +63,8 @@ std::unique_ptr<Function> Parser::parseEntryPoint() {
   if (token->getType() != Token::TOKEN_ENTRY_POINT) {
     error(token, "expected entry point declaration");
   }
+  function->first_location_ = token->getFirstLocation();
+  function->last_location_ = token->getLastLocation();
 
   function->return_type_.base_type_ = VarType::INTEGER;
   function->body_ = parseStatements();
@@ -67,6 +94,8 @@ std::unique_ptr<Function> Parser::parseFunction() {
     error(token, "expected function name");
   }
   function->name_ = token->getStringValue();
+  function->first_location_ = token->getFirstLocation();
+  function->last_location_ = token->getLastLocation();
 
   token = getNextToken();
   switch (token->getType()) {
@@ -144,7 +173,14 @@ VarType Parser::parseType() {
 std::vector<std::unique_ptr<Statement>> Parser::parseStatements() {
   std::vector<std::unique_ptr<Statement>> statements;
   while (true) {
-    auto statement = maybeParseStatement();
+    uint64_t tokens_before = tokens_count_;
+    std::unique_ptr<Statement> statement;
+    try {
+      statement = maybeParseStatement();
+    } catch (const RecoverableError&) {
+      if (!synchronize(tokens_before)) throw;
+      continue;
+    }
     if (!statement) break;
     statements.emplace_back(std::move(statement));
   }
@@ -198,6 +234,13 @@ std::unique_ptr<Statement> Parser::maybeParseStatement() {
     return statement;
   }
   case Token::TOKEN_ASSIGN: {
+    if (expression->getClassType() == Expression::TYPE_IndexExpression) {
+      ignoreNextToken();
+      std::unique_ptr<ElementAssignStatement> statement{new ElementAssignStatement};
+      statement->target_.reset(static_cast<IndexExpression*>(expression.release()));
+      statement->expression_ = parseExpression();
+      return statement;
+    }
     AtomicExpression* e = dynamic_cast<AtomicExpression*>(expression.get());
     if (!e || e->getType() != AtomicExpression::IDENTIFIER) {
       error(token, "assignment target must be an identifier");
@@ -323,10 +366,25 @@ std::unique_ptr<BranchStatement> Parser::parseBranchStatement() {
     error(token, "expected branch condition");
   }
 
+  NestingGuard nesting_guard{branch_depth_};
+
   std::unique_ptr<BranchStatement> statement{new BranchStatement};
+  try {
+    parseBranchBody(statement.get());
+  } catch (const RecoverableError&) {
+    // Once the error unwinds past the guard, the end of this branch would be
+    // taken for that of an enclosing one, so the rest of it is skipped here.
+    skipBranch();
+    throw;
+  }
+
+  return statement;
+}
+
+void Parser::parseBranchBody(BranchStatement* statement) {
   statement->lead_var_ = parseVariable();
 
-  token = getNextToken();
+  auto token = getNextToken();
   if (token->getType() != Token::TOKEN_BRANCH_BEGIN) {
     error(token, "expected begin of branch");
   }
@@ -370,8 +428,6 @@ std::unique_ptr<BranchStatement> Parser::parseBranchStatement() {
     error(token, "expected either else case or end of branch");
     break;
   }
-
-  return statement;
 }
 
 std::unique_ptr<VardeclStatement> Parser::parseVardeclStatement() {
@@ -403,8 +459,16 @@ std::unique_ptr<LoopStatement> Parser::parseLoopStatement() {
   }
 
   std::unique_ptr<LoopStatement> statement{new LoopStatement};
-  while (peekNextToken()->getType() != Token::TOKEN_LOOP_CONDITION) {
-    statement->body_.emplace_back(parseStatement());
+  {
+    NestingGuard nesting_guard{loop_depth_};
+    while (peekNextToken()->getType() != Token::TOKEN_LOOP_CONDITION) {
+      uint64_t tokens_before = tokens_count_;
+      try {
+        statement->body_.emplace_back(parseStatement());
+      } catch (const RecoverableError&) {
+        if (!synchronize(tokens_before) || endsEnclosingBlock(peekNextToken())) throw;
+      }
+    }
   }
   ignoreNextToken(); // This was a Token::TOKEN_LOOP_CONDITION.
 
@@ -509,6 +573,49 @@ std::unique_ptr<Expression> Parser::maybeParseExpressionInternal(int min_precede
 }
 
 std::unique_ptr<Expression> Parser::maybeParseAtomicExpression() {
+  Location first_location = peekNextToken()->getFirstLocation();
+  auto operand = maybeParseOperand();
+  if (!operand || peekNextToken()->getType() != Token::TOKEN_INDEX) return operand;
+  operand->first_location_ = first_location;
+  operand->last_location_ = peekNextToken()->getFirstLocation();
+
+  auto index_location = getNextToken()->getFirstLocation();
+  Location index_first_location = peekNextToken()->getFirstLocation();
+  auto index = maybeParseAtomicExpression();
+  if (!index) {
+    error(index_location, "expected index");
+  }
+  index->first_location_ = index_first_location;
+  index->last_location_ = peekNextToken()->getFirstLocation();
+
+  std::unique_ptr<IndexExpression> expression{new IndexExpression};
+  expression->pointer_ = std::move(operand);
+  expression->index_ = std::move(index);
+  return expression;
+}
+
+std::unique_ptr<AllocExpression> Parser::parseAllocExpression() {
+  auto alloc_token = getNextToken();
+  Location count_location = peekNextToken()->getFirstLocation();
+  auto count = maybeParseAtomicExpression();
+  if (!count) {
+    error(alloc_token, "expected number of elements");
+  }
+  count->first_location_ = count_location;
+  count->last_location_ = peekNextToken()->getFirstLocation();
+
+  auto type_token = getNextToken();
+  if (type_token->getType() != Token::TOKEN_TYPENAME) {
+    error(type_token, "expected type name of the elements");
+  }
+
+  std::unique_ptr<AllocExpression> expression{new AllocExpression};
+  expression->element_type_ = builtinTypeToASTType(type_token->getBuiltinTypeValue());
+  expression->count_ = std::move(count);
+  return expression;
+}
+
+std::unique_ptr<Expression> Parser::maybeParseOperand() {
   switch (peekNextToken()->getType()) {
   case Token::TOKEN_ARTICLE:
   case Token::TOKEN_IDENTIFIER:
@@ -519,6 +626,8 @@ std::unique_ptr<Expression> Parser::maybeParseAtomicExpression() {
     return AtomicExpression ::fromFloat(getNextToken()->getFloatValue());
   case Token::TOKEN_FUN_CALL:
     return parseFunctionCallExpression();
+  case Token::TOKEN_ALLOC:
+    return parseAllocExpression();
   default:
     return nullptr;
   }
@@ -533,10 +642,114 @@ std::unique_ptr<Token> Parser::getNextToken() {
     current_token_ = nullptr;
     break;
   default:
-    current_token_ = lexer_.getNextToken();
+    current_token_ = lexToken();
     break;
   }
   return token;
 }
 
+// static
+bool Parser::endsEnclosingBlock(const Token* token) {
+  switch (token->getType()) {
+  case Token::TOKEN_CASE_END:
+  case Token::TOKEN_BRANCH_ELSE:
+  case Token::TOKEN_BRANCH_END:
+  case Token::TOKEN_FUN_DECL:
+  case Token::TOKEN_ENTRY_POINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool Parser::synchronize(uint64_t tokens_before) {
+  // The error was on the last token of the stream.
+  if (!current_token_) throw FatalError{};
+  for (;;) {
+    switch (peekNextToken()->getType()) {
+    case Token::TOKEN_BANG:
+      ignoreNextToken();
+      return true;
+    case Token::TOKEN_ASSERT:
+    case Token::TOKEN_INPUT:
+    case Token::TOKEN_ABORT:
+    case Token::TOKEN_BRANCH_CONDITION:
+    case Token::TOKEN_VARDECL:
+    case Token::TOKEN_LOOP_BEGIN:
+    case Token::TOKEN_RETURN:
+    case Token::TOKEN_FUN_DECL:
+    case Token::TOKEN_ENTRY_POINT:
+      return tokens_count_ > tokens_before;
+    case Token::TOKEN_CASE_END:
+    case Token::TOKEN_BRANCH_ELSE:
+    case Token::TOKEN_BRANCH_END:
+      if (branch_depth_ > 0) return tokens_count_ > tokens_before;
+      break;
+    case Token::TOKEN_LOOP_CONDITION:
+      if (loop_depth_ > 0) return tokens_count_ > tokens_before;
+      break;
+    case Token::TOKEN_END:
+    case Token::TOKEN_UNKNOWN:
+      throw FatalError{};
+    default:
+      break;
+    }
+    ignoreNextToken();
+  }
+}
+
+void Parser::skipBranch() {
+  if (!current_token_) throw FatalError{};
+  for (int depth = 1;;) {
+    switch (peekNextToken()->getType()) {
+    case Token::TOKEN_BRANCH_CONDITION:
+      ++depth;
+      break;
+    case Token::TOKEN_BRANCH_END:
+      if (--depth == 0) {
+        ignoreNextToken();
+        return;
+      }
+      break;
+    case Token::TOKEN_FUN_DECL:
+    case Token::TOKEN_ENTRY_POINT:
+      return;
+    case Token::TOKEN_END:
+    case Token::TOKEN_UNKNOWN:
+      throw FatalError{};
+    default:
+      break;
+    }
+    ignoreNextToken();
+  }
+}
+
+void Parser::synchronizeModule(uint64_t tokens_before) {
+  if (!current_token_) throw FatalError{};
+  // Whatever went wrong, we must move on, or we will keep failing here.
+  if (tokens_count_ == tokens_before) ignoreNextToken();
+  for (;;) {
+    switch (peekNextToken()->getType()) {
+    case Token::TOKEN_FUN_DECL:
+    case Token::TOKEN_ENTRY_POINT:
+    case Token::TOKEN_END:
+      return;
+    case Token::TOKEN_UNKNOWN:
+      throw FatalError{};
+    default:
+      ignoreNextToken();
+      break;
+    }
+  }
+}
+
+std::unique_ptr<Token> Parser::lexToken() {
+  ++tokens_count_;
+  if (!lexer_timing_enabled_) return lexer_.getNextToken();
+  auto start = std::chrono::steady_clock::now();
+  auto token = lexer_.getNextToken();
+  lexer_time_ += std::chrono::steady_clock::now() - start;
+  return token;
+}
+
 } // namespace monicelli
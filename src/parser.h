@@ -9,6 +9,7 @@
 #include "lexer.h"
 #include "support.h"
 
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -17,16 +18,30 @@ namespace monicelli {
 
 class Parser final : public ErrorReportingMixin {
 public:
-  Parser(std::istream& input, const std::string& source_filename)
-      : ErrorReportingMixin(source_filename), lexer_{input} {}
+  // With a sink, the parser reports all the errors it can find, not only the
+  // first one, skipping the statements or functions that contain them.
+  Parser(std::istream& input, const std::string& source_filename,
+         DiagnosticSink* sink = nullptr)
+      : ErrorReportingMixin(source_filename, sink), lexer_{input}, tokens_count_(0),
+        branch_depth_(0), loop_depth_(0), lexer_timing_enabled_(false), lexer_time_(0) {}
 
-  std::unique_ptr<Module> parse() {
-    current_token_ = lexer_.getNextToken();
-    return parseModule();
-  }
+  // Returns nullptr if any error was reported to the sink.
+  std::unique_ptr<Module> parse();
+
+  // Same, but keeps what could be parsed around the errors, as long as they
+  // were not fatal. Used by the language server, to keep working on code that
+  // is being edited.
+  std::unique_ptr<Module> parsePartial();
 
   void setLexerTrace(bool enabled) { lexer_.setTraceEnabled(enabled); }
 
+  uint64_t getTokensCount() const { return tokens_count_; }
+
+  // Lexing is interleaved with parsing, so the only way to tell how long it
+  // takes is to time each call to the lexer, which is not free.
+  void setLexerTiming(bool enabled) { lexer_timing_enabled_ = enabled; }
+  double getLexerSeconds() const { return std::chrono::duration<double>(lexer_time_).count(); }
+
 private:
   Variable parseVariable();
   VarType parseType();
@@ -42,6 +57,7 @@ private:
   BranchCase parseBranchCase(std::shared_ptr<Expression> condition_lhs);
   std::unique_ptr<BranchElse> parseBranchElse();
   std::unique_ptr<BranchStatement> parseBranchStatement();
+  void parseBranchBody(BranchStatement* statement);
   std::unique_ptr<VardeclStatement> parseVardeclStatement();
   std::unique_ptr<LoopStatement> parseLoopStatement();
   std::unique_ptr<ReturnStatement> parseReturnStatement();
@@ -49,10 +65,34 @@ private:
   std::unique_ptr<Expression> parseSemiExpression(std::shared_ptr<Expression> lhs);
   std::unique_ptr<Expression> maybeParseExpression() { return maybeParseExpressionInternal(0); }
   std::unique_ptr<Expression> maybeParseExpressionInternal(int min_precedence);
+  // An operand, possibly indexed.
   std::unique_ptr<Expression> maybeParseAtomicExpression();
+  std::unique_ptr<Expression> maybeParseOperand();
+  std::unique_ptr<AllocExpression> parseAllocExpression();
   std::unique_ptr<FunctionCallExpression> parseFunctionCallExpression();
 
   std::unique_ptr<Token> getNextToken();
+  std::unique_ptr<Token> lexToken();
+
+  // Skips tokens after an error, up to where a statement may begin. Returns
+  // false if that means not moving at all since tokens_before, so that the
+  // caller knows that the error must go up to an enclosing statement instead.
+  bool synchronize(uint64_t tokens_before);
+  // Same, but skips up to the next function.
+  void synchronizeModule(uint64_t tokens_before);
+  // Skips the rest of a branch that failed to parse, up to and including its
+  // end, unless the function ends first.
+  void skipBranch();
+  static bool endsEnclosingBlock(const Token* token);
+
+  class NestingGuard final {
+  public:
+    explicit NestingGuard(int& depth) : depth_(depth) { ++depth_; }
+    ~NestingGuard() { --depth_; }
+
+  private:
+    int& depth_;
+  };
 
   Token* peekNextToken() {
     assert(current_token_ && "Cannot peek into an empty stream.");
@@ -66,6 +106,13 @@ private:
 
   Lexer lexer_;
   std::unique_ptr<Token> current_token_;
+  uint64_t tokens_count_;
+  // How many branches and loops we are in, to know which closing tokens are
+  // meaningful when recovering from an error.
+  int branch_depth_;
+  int loop_depth_;
+  bool lexer_timing_enabled_;
+  std::chrono::steady_clock::duration lexer_time_;
 };
 
 } // namespace monicelli
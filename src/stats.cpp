@@ -0,0 +1,301 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "stats.h"
+#include "ast-visitor.h"
+#include "support.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace monicelli {
+
+static const char* AST_NODE_NAMES[] = {
+#define AST_NODE_NAME(NAME) #NAME,
+    AST_NODES(AST_NODE_NAME)
+#undef AST_NODE_NAME
+};
+
+namespace {
+
+class AstNodeStatistics final : public ConstAstVisitor<AstNodeStatistics, void> {
+public:
+  explicit AstNodeStatistics(uint64_t* counts) : counts_(counts) {}
+
+  void visitModule(const Module* m) {
+    count(m);
+    for (const Function* f : m->functions()) visit(f);
+    if (m->hasEntryPoint()) visit(m->getEntryPoint());
+  }
+  void visitFunction(const Function* f) {
+    count(f);
+    visitBody(f->body());
+  }
+  void visitAssertStatement(const AssertStatement* s) {
+    count(s);
+    visit(s->getExpression());
+  }
+  void visitExpressionStatement(const ExpressionStatement* s) {
+    count(s);
+    visit(s->getExpression());
+  }
+  void visitInputStatement(const InputStatement* s) { count(s); }
+  void visitAbortStatement(const AbortStatement* s) { count(s); }
+  void visitBranchStatement(const BranchStatement* s) {
+    count(s);
+    for (const BranchCase& c : s->cases()) {
+      visit(c.getExpression());
+      visitBody(c.body());
+    }
+    if (s->hasBranchElse()) visitBody(s->getBranchElse()->body());
+  }
+  void visitVardeclStatement(const VardeclStatement* s) {
+    count(s);
+    if (s->hasInitializer()) visit(s->getInitializer());
+  }
+  void visitLoopStatement(const LoopStatement* s) {
+    count(s);
+    visitBody(s->body());
+    visit(s->getCondition());
+  }
+  void visitReturnStatement(const ReturnStatement* s) {
+    count(s);
+    if (s->hasExpression()) visit(s->getExpression());
+  }
+  void visitPrintStatement(const PrintStatement* s) {
+    count(s);
+    visit(s->getExpression());
+  }
+  void visitAssignStatement(const AssignStatement* s) {
+    count(s);
+    visit(s->getExpression());
+  }
+  void visitElementAssignStatement(const ElementAssignStatement* s) {
+    count(s);
+    visit(s->getTarget());
+    visit(s->getExpression());
+  }
+  void visitFunctionCallExpression(const FunctionCallExpression* e) {
+    count(e);
+    for (const Expression* arg : e->args()) visit(arg);
+  }
+  void visitBinaryExpression(const BinaryExpression* e) {
+    count(e);
+    // The lead variable of a branch is shared by all of its cases, so we count
+    // it only once, when visiting the branch.
+    if (!e->isSemiExpression()) visit(e->getLeft());
+    visit(e->getRight());
+  }
+  void visitAtomicExpression(const AtomicExpression* e) { count(e); }
+  void visitIndexExpression(const IndexExpression* e) {
+    count(e);
+    visit(e->getPointer());
+    visit(e->getIndex());
+  }
+  void visitAllocExpression(const AllocExpression* e) {
+    count(e);
+    visit(e->getCount());
+  }
+
+private:
+  void count(const AstNode* node) { ++counts_[node->getClassType()]; }
+
+  template<typename Range> void visitBody(const Range& body) {
+    for (const Statement* s : body) visit(s);
+  }
+
+  uint64_t* counts_;
+};
+
+} // namespace
+
+CompilerStats::FileStats* CompilerStats::addFile(const std::string& filename) {
+  files_.emplace_back(new FileStats);
+  files_.back()->filename = filename;
+  return files_.back().get();
+}
+
+// static
+void CompilerStats::countAstNodes(FileStats* file, const Module* ast) {
+  if (!file) return;
+  AstNodeStatistics{file->ast_nodes}.visit(ast);
+}
+
+// static
+void CompilerStats::countIR(FileStats* file, const llvm::Module* module, bool optimized,
+                            const llvm::StringMap<FunctionSize>* unoptimized_sizes) {
+  if (!file) return;
+  if (!optimized) {
+    for (const llvm::Function& f : module->functions()) {
+      if (f.isDeclaration()) continue;
+      file->functions.emplace_back();
+      FunctionStats& function = file->functions.back();
+      function.name = f.getName().str();
+      if (unoptimized_sizes && unoptimized_sizes->count(f.getName())) {
+        const FunctionSize& size = unoptimized_sizes->find(f.getName())->second;
+        function.instructions_before = size.instructions;
+        function.blocks_before = size.blocks;
+      } else {
+        function.instructions_before = f.getInstructionCount();
+        function.blocks_before = f.size();
+      }
+    }
+    return;
+  }
+
+  // The whole program optimizer inlines functions and drops those that are
+  // left unused, so the two passes are matched by name.
+  llvm::StringMap<size_t> indices;
+  for (size_t i = 0; i < file->functions.size(); ++i) {
+    indices.try_emplace(file->functions[i].name, i);
+    file->functions[i].removed = true;
+  }
+  for (const llvm::Function& f : module->functions()) {
+    if (f.isDeclaration()) continue;
+    auto index = indices.find(f.getName());
+    if (index == indices.end()) {
+      file->functions.emplace_back();
+      file->functions.back().name = f.getName().str();
+    }
+    FunctionStats& function =
+        index == indices.end() ? file->functions.back() : file->functions[index->second];
+    function.removed = false;
+    function.instructions_after = f.getInstructionCount();
+    function.blocks_after = f.size();
+  }
+}
+
+// static
+void CompilerStats::measureCodeSize(FileStats* file, const std::string& object_filename,
+                                    const llvm::StringMap<std::string>* original_names) {
+  if (!file) return;
+  auto object = llvm::object::ObjectFile::createObjectFile(object_filename);
+  if (!object) {
+    llvm::consumeError(object.takeError());
+    std::cerr << "Cannot read the symbols of " << object_filename << ".\n";
+    return;
+  }
+
+  llvm::StringMap<size_t> indices;
+  for (size_t i = 0; i < file->functions.size(); ++i) {
+    indices.try_emplace(file->functions[i].name, i);
+  }
+  auto setCodeSize = [&](llvm::StringRef name, uint64_t size) {
+    if (original_names) {
+      auto original_name = original_names->find(name);
+      if (original_name != original_names->end()) name = original_name->second;
+    }
+    auto index = indices.find(name);
+    if (index == indices.end()) return;
+    file->functions[index->second].has_code_size = true;
+    file->functions[index->second].code_size = size;
+  };
+
+  for (const auto& symbol_size : llvm::object::computeSymbolSizes(*object->getBinary())) {
+    const llvm::object::SymbolRef& symbol = symbol_size.first;
+    auto type = symbol.getType();
+    auto name = symbol.getName();
+    if (!type || !name || *type != llvm::object::SymbolRef::ST_Function) {
+      if (!type) llvm::consumeError(type.takeError());
+      if (!name) llvm::consumeError(name.takeError());
+      continue;
+    }
+    setCodeSize(*name, symbol_size.second);
+    // Some object formats prefix C symbols with an underscore.
+    if (!name->empty() && name->front() == '_') setCodeSize(name->drop_front(), symbol_size.second);
+  }
+}
+
+// static
+void CompilerStats::measurePeakRSS(FileStats* file) {
+  if (!file) return;
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return;
+#ifdef __APPLE__
+  file->peak_rss_bytes = usage.ru_maxrss;
+#else
+  file->peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void CompilerStats::print(std::ostream& stream) const {
+  char line[128];
+  for (const auto& file : files_) {
+    stream << "===== Statistics for " << file->filename << " =====\n";
+    snprintf(line, sizeof(line), "  peak RSS: %.1f MiB\n  tokens: %llu\n  AST nodes:\n",
+             file->peak_rss_bytes / (1024.0 * 1024.0),
+             static_cast<unsigned long long>(file->tokens));
+    stream << line;
+    for (int type = 0; type < AST_NODE_TYPES_COUNT; ++type) {
+      if (!file->ast_nodes[type]) continue;
+      snprintf(line, sizeof(line), "    %-24s %10llu\n", AST_NODE_NAMES[type],
+               static_cast<unsigned long long>(file->ast_nodes[type]));
+      stream << line;
+    }
+    if (file->functions.empty()) {
+      stream << '\n';
+      continue;
+    }
+    snprintf(line, sizeof(line), "  %-24s %21s %17s %10s\n", "function", "instructions",
+             "blocks", "code size");
+    stream << line;
+    for (const FunctionStats& function : file->functions) {
+      if (function.removed) {
+        snprintf(line, sizeof(line), "  %-24s %10u -> %-7s %6u -> %-7s", function.name.c_str(),
+                 function.instructions_before, "removed", function.blocks_before, "removed");
+      } else {
+        snprintf(line, sizeof(line), "  %-24s %10u -> %-7u %6u -> %-7u", function.name.c_str(),
+                 function.instructions_before, function.instructions_after,
+                 function.blocks_before, function.blocks_after);
+      }
+      stream << line;
+      if (function.has_code_size) {
+        snprintf(line, sizeof(line), " %10llu",
+                 static_cast<unsigned long long>(function.code_size));
+        stream << line;
+      }
+      stream << '\n';
+    }
+    stream << '\n';
+  }
+}
+
+void CompilerStats::printJSON(std::ostream& stream) const {
+  stream << "{\n  \"files\": [";
+  for (size_t i = 0; i < files_.size(); ++i) {
+    const FileStats& file = *files_[i];
+    stream << (i ? ",\n" : "\n") << "    {\n      \"filename\": ";
+    printJSONString(stream, file.filename);
+    stream << ",\n      \"peak_rss_bytes\": " << file.peak_rss_bytes
+           << ",\n      \"tokens\": " << file.tokens << ",\n      \"ast_nodes\": {";
+    for (int type = 0; type < AST_NODE_TYPES_COUNT; ++type) {
+      stream << (type ? ", " : "") << '"' << AST_NODE_NAMES[type] << "\": " << file.ast_nodes[type];
+    }
+    stream << "},\n      \"functions\": [";
+    for (size_t j = 0; j < file.functions.size(); ++j) {
+      const FunctionStats& function = file.functions[j];
+      stream << (j ? ",\n" : "\n") << "        {\"name\": ";
+      printJSONString(stream, function.name);
+      stream << ", \"instructions_before\": " << function.instructions_before
+             << ", \"instructions_after\": " << function.instructions_after
+             << ", \"blocks_before\": " << function.blocks_before
+             << ", \"blocks_after\": " << function.blocks_after;
+      if (function.removed) stream << ", \"removed\": true";
+      if (function.has_code_size) stream << ", \"code_size\": " << function.code_size;
+      stream << '}';
+    }
+    stream << (file.functions.empty() ? "]\n    }" : "\n      ]\n    }");
+  }
+  stream << "\n  ]\n}\n";
+}
+
+} // namespace monicelli
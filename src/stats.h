@@ -0,0 +1,87 @@
+#ifndef MONICELLI_STATS_H
+#define MONICELLI_STATS_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "ast.def"
+#include "codegen.h"
+
+#include "llvm/IR/Module.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace monicelli {
+
+class Module;
+
+class CompilerStats final {
+public:
+  static const int AST_NODE_TYPES_COUNT = 0
+#define COUNT_AST_NODE(_) +1
+      AST_NODES(COUNT_AST_NODE)
+#undef COUNT_AST_NODE
+      ;
+
+  struct FunctionStats {
+    std::string name;
+    unsigned instructions_before = 0;
+    unsigned blocks_before = 0;
+    unsigned instructions_after = 0;
+    unsigned blocks_after = 0;
+    // Whether the optimizer inlined the function everywhere, or found it
+    // unused, and dropped it. Its after counts are then 0.
+    bool removed = false;
+    // Only known once the object file has been written.
+    bool has_code_size = false;
+    uint64_t code_size = 0;
+  };
+
+  struct FileStats {
+    std::string filename;
+    uint64_t peak_rss_bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t ast_nodes[AST_NODE_TYPES_COUNT] = {};
+    std::vector<FunctionStats> functions;
+  };
+
+  explicit CompilerStats(bool json) : json_(json) {}
+
+  bool isJSON() const { return json_; }
+
+  FileStats* addFile(const std::string& filename);
+
+  static void countAstNodes(FileStats* file, const Module* ast);
+
+  // Counts instructions and basic blocks of every function with a body,
+  // either before or after the optimizer has run. Functions that the
+  // optimizer dropped are marked as removed. Before the optimizer, the size
+  // of functions that were already optimized on other threads is taken from
+  // unoptimized_sizes.
+  static void countIR(FileStats* file, const llvm::Module* module, bool optimized,
+                      const llvm::StringMap<FunctionSize>* unoptimized_sizes = nullptr);
+
+  // Takes the size of every function from the symbol table of an object file.
+  // Symbols that were renamed after the IR was counted are looked up in
+  // original_names, from the new name to the old one.
+  static void measureCodeSize(FileStats* file, const std::string& object_filename,
+                              const llvm::StringMap<std::string>* original_names = nullptr);
+
+  // The peak resident set size of the whole process so far.
+  static void measurePeakRSS(FileStats* file);
+
+  void print(std::ostream& stream) const;
+  void printJSON(std::ostream& stream) const;
+
+private:
+  bool json_;
+  std::vector<std::unique_ptr<FileStats>> files_;
+};
+
+} // namespace monicelli
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "support.h"
 
+#include <cstdio>
+
 namespace monicelli {
 
 std::string basename(std::string input_filename) {
@@ -14,4 +16,20 @@ std::string basename(std::string input_filename) {
   return input_filename;
 }
 
+void printJSONString(std::ostream& stream, const std::string& string) {
+  stream << '"';
+  for (char c : string) {
+    if (c == '"' || c == '\\') {
+      stream << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      stream << escape;
+    } else {
+      stream << c;
+    }
+  }
+  stream << '"';
+}
+
 } // namespace monicelli
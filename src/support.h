@@ -23,6 +23,9 @@ static void print(std::ostream& stream, const First& first, Tail... tail) {
 
 std::string basename(std::string input_filename);
 
+// Prints a string as a quoted JSON string, escaping it as needed.
+void printJSONString(std::ostream& stream, const std::string& string);
+
 } // namespace monicelli
 
 #endif
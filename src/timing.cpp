@@ -0,0 +1,201 @@
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "timing.h"
+#include "support.h"
+
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+
+#ifdef MONICELLI_ENABLE_LINKER
+#include <sys/resource.h>
+#endif
+
+namespace monicelli {
+
+static const char* PHASE_NAMES[] = {
+#define PHASE_NAME(_, NAME) NAME,
+    COMPILER_PHASES(PHASE_NAME)
+#undef PHASE_NAME
+};
+
+static const char* TIME_TRACE_PROCESS_NAME = "mcc";
+
+static std::atomic<bool> time_trace_started{false};
+static unsigned time_trace_granularity_us = 0;
+
+const char* getPhaseName(CompilerPhase phase) {
+  assert(phase < PHASES_COUNT && "Not a phase");
+  return PHASE_NAMES[phase];
+}
+
+PhaseTime PhaseTimer::sample() const {
+  llvm::sys::TimePoint<> now;
+  std::chrono::nanoseconds user;
+  std::chrono::nanoseconds system;
+  llvm::sys::Process::GetTimeUsage(now, user, system);
+
+  PhaseTime time;
+  time.wall = std::chrono::duration<double>(now.time_since_epoch()).count();
+  time.user = std::chrono::duration<double>(user).count();
+  time.system = std::chrono::duration<double>(system).count();
+
+#ifdef MONICELLI_ENABLE_LINKER
+  if (include_children_) {
+    struct rusage children;
+    if (getrusage(RUSAGE_CHILDREN, &children) == 0) {
+      time.user += children.ru_utime.tv_sec + children.ru_utime.tv_usec / 1e6;
+      time.system += children.ru_stime.tv_sec + children.ru_stime.tv_usec / 1e6;
+    }
+  }
+#endif
+
+  return time;
+}
+
+TimeReport::FileTimes* TimeReport::addFile(const std::string& filename) {
+  files_.emplace_back(new FileTimes);
+  files_.back()->filename = filename;
+  return files_.back().get();
+}
+
+// static
+void TimeReport::splitLexTime(FileTimes* file, double lex_wall_seconds) {
+  if (!file) return;
+  PhaseTime& parse = file->phases[PHASE_PARSE];
+  PhaseTime& lex = file->phases[PHASE_LEX];
+  double share = parse.wall > 0 ? std::min(1.0, lex_wall_seconds / parse.wall) : 0;
+  lex.wall = parse.wall * share;
+  lex.user = parse.user * share;
+  lex.system = parse.system * share;
+  parse.wall -= lex.wall;
+  parse.user -= lex.user;
+  parse.system -= lex.system;
+}
+
+void TimeReport::addIRGenTime(FileTimes* file, const PhaseTime& time, double worker_seconds,
+                              double optimizer_seconds) {
+  if (!file) return;
+  double share = worker_seconds > 0 ? std::min(1.0, optimizer_seconds / worker_seconds) : 0;
+  PhaseTime& irgen = file->phases[PHASE_IRGEN];
+  PhaseTime& optimize = file->phases[PHASE_OPTIMIZE];
+  optimize.wall += time.wall * share;
+  optimize.user += time.user * share;
+  optimize.system += time.system * share;
+  irgen.wall += time.wall * (1 - share);
+  irgen.user += time.user * (1 - share);
+  irgen.system += time.system * (1 - share);
+}
+
+void TimeReport::collectPassTimings(FileTimes* file) {
+  if (!file) return;
+  llvm::raw_string_ostream stream{file->passes};
+  if (json_) {
+    llvm::TimerGroup::printAllJSONValues(stream, "");
+    llvm::TimerGroup::clearAll();
+  } else {
+    llvm::reportAndResetTimings(&stream);
+  }
+  stream.flush();
+}
+
+static void printPhaseTime(std::ostream& stream, const char* name, const PhaseTime& time) {
+  char line[80];
+  snprintf(line, sizeof(line), "  %-10s %12.6f %12.6f %12.6f\n", name, time.wall, time.user,
+           time.system);
+  stream << line;
+}
+
+void TimeReport::print(std::ostream& stream) const {
+  PhaseTime total;
+  for (const auto& file : files_) {
+    stream << "===== Time report for " << file->filename << " =====\n";
+    char header[80];
+    snprintf(header, sizeof(header), "  %-10s %12s %12s %12s\n", "phase", "wall (s)", "user (s)",
+             "system (s)");
+    stream << header;
+    for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+      if (phase == PHASE_LINK) continue;
+      printPhaseTime(stream, PHASE_NAMES[phase], file->phases[phase]);
+      total += file->phases[phase];
+    }
+    stream << file->passes << '\n';
+  }
+  if (link_time_.wall > 0) {
+    stream << "===== Time report for linking =====\n";
+    printPhaseTime(stream, PHASE_NAMES[PHASE_LINK], link_time_);
+    total += link_time_;
+    stream << '\n';
+  }
+  printPhaseTime(stream, "total", total);
+}
+
+static void printPhaseTimeJSON(std::ostream& stream, const PhaseTime& time) {
+  char object[128];
+  snprintf(object, sizeof(object), "{\"wall\": %.6f, \"user\": %.6f, \"system\": %.6f}",
+           time.wall, time.user, time.system);
+  stream << object;
+}
+
+void TimeReport::printJSON(std::ostream& stream) const {
+  stream << "{\n  \"files\": [";
+  for (size_t i = 0; i < files_.size(); ++i) {
+    const FileTimes& file = *files_[i];
+    stream << (i ? ",\n" : "\n") << "    {\n      \"filename\": ";
+    printJSONString(stream, file.filename);
+    stream << ",\n      \"phases\": {";
+    bool first = true;
+    for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+      if (phase == PHASE_LINK) continue;
+      stream << (first ? "\n" : ",\n") << "        \"" << PHASE_NAMES[phase] << "\": ";
+      printPhaseTimeJSON(stream, file.phases[phase]);
+      first = false;
+    }
+    // The values from LLVM are already formatted as key-value pairs.
+    stream << "\n      },\n      \"passes\": {\n" << file.passes << "\n      }\n    }";
+  }
+  stream << "\n  ],\n  \"link\": ";
+  printPhaseTimeJSON(stream, link_time_);
+  stream << "\n}\n";
+}
+
+void startTimeTrace(unsigned granularity_us) {
+  time_trace_granularity_us = granularity_us;
+  llvm::timeTraceProfilerInitialize(granularity_us, TIME_TRACE_PROCESS_NAME);
+  time_trace_started = true;
+}
+
+bool writeTimeTrace(const std::string& filename) {
+  if (!time_trace_started) return true;
+  time_trace_started = false;
+  auto error = llvm::timeTraceProfilerWrite(filename, TIME_TRACE_PROCESS_NAME);
+  llvm::timeTraceProfilerCleanup();
+  if (error) {
+    std::cerr << "Cannot write the time trace: " << llvm::toString(std::move(error)) << '\n';
+    return false;
+  }
+  return true;
+}
+
+// The thread that started the trace, or one that already joined it, has a
+// track already.
+TimeTraceThread::TimeTraceThread()
+    : joined_(time_trace_started && !llvm::getTimeTraceProfilerInstance()) {
+  if (joined_) {
+    llvm::timeTraceProfilerInitialize(time_trace_granularity_us, TIME_TRACE_PROCESS_NAME);
+  }
+}
+
+TimeTraceThread::~TimeTraceThread() {
+  if (joined_) llvm::timeTraceProfilerFinishThread();
+}
+
+} // namespace monicelli
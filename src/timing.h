@@ -0,0 +1,136 @@
+#ifndef MONICELLI_TIMING_H
+#define MONICELLI_TIMING_H
+
+// Copyright 2017 the Monicelli project authors. All rights reserved.
+// Use of this source code is governed by a GPLv3 license, see LICENSE.txt.
+
+#include "phases.def"
+
+#include "llvm/Support/TimeProfiler.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace monicelli {
+
+enum CompilerPhase {
+#define DECLARE_PHASE(NAME, _) PHASE_##NAME,
+  COMPILER_PHASES(DECLARE_PHASE)
+#undef DECLARE_PHASE
+  PHASES_COUNT
+};
+
+const char* getPhaseName(CompilerPhase phase);
+
+struct PhaseTime {
+  double wall = 0;
+  double user = 0;
+  double system = 0;
+
+  void operator+=(const PhaseTime& other) {
+    wall += other.wall;
+    user += other.user;
+    system += other.system;
+  }
+};
+
+// Adds the time elapsed during its lifetime to a PhaseTime, or does nothing
+// if that is null. The CPU time of child processes is only included if
+// requested, which is what we want for the linker. The phase also shows up as
+// a span in the time trace, if there is one.
+class PhaseTimer final {
+public:
+  PhaseTimer(CompilerPhase phase, PhaseTime* time, bool include_children = false)
+      : trace_scope_(getPhaseName(phase)), time_(time), include_children_(include_children) {
+    if (time_) start_ = sample();
+  }
+
+  ~PhaseTimer() {
+    if (!time_) return;
+    PhaseTime end = sample();
+    time_->wall += end.wall - start_.wall;
+    time_->user += end.user - start_.user;
+    time_->system += end.system - start_.system;
+  }
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+  PhaseTime sample() const;
+
+  llvm::TimeTraceScope trace_scope_;
+  PhaseTime* time_;
+  PhaseTime start_;
+  bool include_children_;
+};
+
+class TimeReport final {
+public:
+  struct FileTimes {
+    std::string filename;
+    PhaseTime phases[PHASES_COUNT];
+    // Optimizer pass timings, already formatted as requested.
+    std::string passes;
+  };
+
+  explicit TimeReport(bool json) : json_(json) {}
+
+  bool isJSON() const { return json_; }
+
+  FileTimes* addFile(const std::string& filename);
+
+  PhaseTime* getLinkTime() { return &link_time_; }
+
+  // Lexing happens on demand while parsing, so it is timed by the parser with
+  // a cheap wall clock around each token. Here we take it out of the parse
+  // phase, splitting the CPU time in proportion.
+  static void splitLexTime(FileTimes* file, double lex_wall_seconds);
+
+  // With many threads, each one runs the function optimizer on the IR that it
+  // has just generated, timing both with a wall clock. Here we add the time
+  // of IR generation to file, with the share of the optimizer in its phase.
+  static void addIRGenTime(FileTimes* file, const PhaseTime& time, double worker_seconds,
+                           double optimizer_seconds);
+
+  // Moves the timings of the passes that ran since the last call into file,
+  // and resets them.
+  void collectPassTimings(FileTimes* file);
+
+  void print(std::ostream& stream) const;
+  void printJSON(std::ostream& stream) const;
+
+private:
+  bool json_;
+  std::vector<std::unique_ptr<FileTimes>> files_;
+  PhaseTime link_time_;
+};
+
+// Starts recording a Chrome trace of the compiler on the calling thread. Spans
+// shorter than the granularity are dropped.
+void startTimeTrace(unsigned granularity_us);
+
+// Writes the trace to a file and stops recording. Returns false on errors.
+bool writeTimeTrace(const std::string& filename);
+
+// Any other thread doing work must hold one of these while it does, so that
+// it gets a track of its own in the trace. It has no effect without a trace,
+// nor on a thread that is already in it.
+class TimeTraceThread final {
+public:
+  TimeTraceThread();
+  ~TimeTraceThread();
+
+  TimeTraceThread(const TimeTraceThread&) = delete;
+  TimeTraceThread& operator=(const TimeTraceThread&) = delete;
+
+private:
+  bool joined_;
+};
+
+} // namespace monicelli
+
+#endif